@@ -0,0 +1,91 @@
+/**
+ * bufpool.h - muxkit 协议缓冲区池
+ *
+ * 连接的接收缓冲区和发送队列按 2 的幂分级，从池中申请、用完归还：
+ * - 每一级一条空闲链表，链表指针就存在空闲缓冲区开头，不额外分配
+ * - 池中缓存的总字节数不超过 MUXKIT_BUFPOOL_BYTES，超出时直接释放
+ * - 超过最大一级的请求直接 malloc，归还时直接 free
+ * - 进程内单线程使用，客户端和服务端各有一个池
+ *
+ * 使用方法：
+ *   size_t cap;
+ *   char *buf = bufpool_get(len, &cap);
+ *   buf = bufpool_grow(buf, used, &cap, need);
+ *   bufpool_put(buf, cap);
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+
+#define BUFPOOL_MIN_SHIFT 12 /* 最小一级 4 KiB */
+#define BUFPOOL_CLASSES 10   /* 4 KiB .. 2 MiB，覆盖最大消息 */
+
+/**
+ * 池统计信息，用于确认复用效果
+ */
+struct bufpool_stats {
+  unsigned long gets;    /* 申请次数（含扩容） */
+  unsigned long hits;    /* 从空闲链表取到的次数 */
+  unsigned long mallocs; /* 实际调用 malloc 的次数 */
+  unsigned long puts;    /* 归还次数 */
+  unsigned long frees;   /* 池满或不分级而实际释放的次数 */
+  size_t cached;         /* 池中缓存的字节数 */
+};
+
+/**
+ * @brief 申请至少 size 字节的缓冲区
+ * @param size 需要的字节数
+ * @param cap  输出实际容量，归还时原样传回
+ * @return 缓冲区，失败返回 NULL
+ */
+void *bufpool_get(size_t size, size_t *cap);
+
+/**
+ * @brief 把缓冲区扩到至少 need 字节，保留前 used 字节
+ *
+ * 换到更大一级的缓冲区，旧缓冲区归还池中。失败时旧缓冲区不变。
+ *
+ * @param buf  旧缓冲区，可为 NULL
+ * @param used 需要保留的字节数
+ * @param cap  旧容量，成功时更新为新容量
+ * @param need 需要的字节数
+ * @return 新缓冲区，失败返回 NULL
+ */
+void *bufpool_grow(void *buf, size_t used, size_t *cap, size_t need);
+
+/**
+ * @brief 归还缓冲区
+ * @param buf 缓冲区，可为 NULL
+ * @param cap bufpool_get / bufpool_grow 给出的容量
+ */
+void bufpool_put(void *buf, size_t cap);
+
+/**
+ * @brief 获取池统计信息
+ */
+const struct bufpool_stats *bufpool_stats(void);
+
+#endif /* BUFPOOL_H */
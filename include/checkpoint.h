@@ -0,0 +1,137 @@
+/**
+ * checkpoint.h - muxkit 会话检查点模块
+ *
+ * 会话状态原本只存在于服务端内存中，服务端崩溃或重启后屏幕和历史全部丢失。
+ * 本模块定期把会话写入运行时目录下的 checkpoints/，重启后可恢复：
+ * - 增量：只重写上次检查点之后有变化的会话，每个会话一个文件
+ * - 批量：一次检查点中的所有会话在同一个子进程中写入，最后只同步一次目录
+ * - 不阻塞主循环：fork 出的子进程拿到内存的写时复制副本，
+ *   序列化、写文件、fsync 都在子进程里完成
+ * - 原子替换：先写临时文件并 fsync，再 rename 覆盖旧文件
+ *
+ * 文件格式：
+ *   struct checkpoint_header
+ *   pane_count 个 { struct checkpoint_pane, len 字节网格快照 }
+ * 网格快照即 grid_serialize 的输出，自带版本和 CRC 校验。
+ * 已退出的 pane 快照长度为 0。
+ *
+ * 恢复时为每个 pane 启动新的 shell，旧的屏幕和历史作为只读回滚内容，
+ * 恢复出的会话处于分离状态，用 -s 连接。
+ *
+ * 使用方法：
+ *   // 主循环
+ *   reactor_wait(r, checkpoint_timeout());
+ *   checkpoint_run(&session_list);
+ *   // SIGCHLD
+ *   if (checkpoint_reap(pid, status)) continue;
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "list.h"
+#include "server.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CHECKPOINT_MAGIC 0x4b43584du /* "MXCK" */
+#define CHECKPOINT_VERSION 1
+
+/**
+ * 检查点文件头
+ */
+struct checkpoint_header {
+  uint32_t magic;      /* CHECKPOINT_MAGIC */
+  uint16_t version;    /* CHECKPOINT_VERSION */
+  uint16_t pane_count; /* pane 数量 */
+  int32_t id;          /* 会话 ID */
+  uint16_t ws_row;     /* 会话尺寸 */
+  uint16_t ws_col;
+};
+
+/**
+ * 每个 pane 的记录头，之后紧跟 len 字节网格快照
+ */
+struct checkpoint_pane {
+  uint32_t pane_id; /* pane 下标 */
+  uint32_t len;     /* 快照字节数，0 表示没有屏幕内容 */
+};
+
+/**
+ * 读取出的检查点
+ */
+struct checkpoint {
+  int id;                     /* 会话 ID */
+  struct winsize ws;          /* 会话尺寸 */
+  int pane_count;             /* pane 数量 */
+  int grid_fd[MAX_PANES];     /* 网格快照 memfd，-1 表示没有 */
+  size_t grid_len[MAX_PANES]; /* 快照字节数 */
+};
+
+/**
+ * @brief 距离下一次检查点的毫秒数，用作主循环的等待超时
+ * @return 毫秒数，检查点关闭时返回 -1
+ */
+int checkpoint_timeout(void);
+
+/**
+ * @brief 到期时把有变化的会话交给写盘子进程
+ * 上一批还没写完时跳过本次，变化留到下一次
+ * @param sessions 会话链表
+ */
+void checkpoint_run(struct list_head *sessions);
+
+/**
+ * @brief 回收写盘子进程
+ * 写盘失败时所有会话重新标记为有变化
+ * @param pid      waitpid 返回的进程号
+ * @param status   退出状态
+ * @param sessions 会话链表
+ * @return 1 是写盘子进程，0 不是
+ */
+int checkpoint_reap(pid_t pid, int status, struct list_head *sessions);
+
+/**
+ * @brief 列出磁盘上的检查点
+ * @param ids 输出会话 ID，升序
+ * @param max ids 容量
+ * @return 检查点数量，失败返回 -1
+ */
+int checkpoint_list(int *ids, int max);
+
+/**
+ * @brief 读取一个检查点，网格快照放入 memfd
+ * @param id 会话 ID
+ * @param ck 输出，成功后由调用者关闭 grid_fd
+ * @return 0 成功，-1 文件不存在或损坏
+ */
+int checkpoint_load(int id, struct checkpoint *ck);
+
+/**
+ * @brief 删除会话的检查点（会话结束时调用）
+ * @param id 会话 ID
+ */
+void checkpoint_remove(int id);
+
+#endif /* CHECKPOINT_H */
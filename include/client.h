@@ -39,12 +39,21 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include "muxkit-protocol.h"
+#include "record.h"
+#include "reactor.h"
 #include "render.h"
+#include "server.h"
 #include "window.h"
+#include <stdint.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <termios.h>
 
+#define PASTE_MARK_LEN 6 /* bracketed paste 标记 ESC[200~ / ESC[201~ 的长度 */
+#define PASTE_HOLD_MS 500  /* 半个粘贴开始标记最多暂留多久，之后按普通输入转发 */
+#define PASTE_ESC_HOLD_MS 10 /* 单独一个 ESC 只暂留这么久，不拖慢 Esc 键 */
+
 /**
  * 客户端状态枚举
  * 用于有限状态机 (FSM) 控制客户端行为
@@ -74,6 +83,19 @@ typedef enum {
   EV_SYNC_INPUT,      /* 同步输入 */
 } client_event;
 
+/**
+ * 一个 pane 的输入延迟跟踪
+ * 同一时间只跟踪一次按键：input_us 非 0 表示正在跟踪，
+ * output_us 非 0 表示回显已到达、等待下一帧写出
+ */
+struct pane_latency {
+  uint64_t input_us;                       /* 按键读入的时间 */
+  uint64_t write_us;                       /* 写进 PTY 的时间 */
+  uint64_t output_us;                      /* 回显到达的时间 */
+  int dirty;                               /* 有尚未上报的样本 */
+  struct latency_hist stages[LAT_STAGES];  /* 上次上报之后的样本 */
+};
+
 /**
  * 客户端上下文结构体
  * 存储客户端运行时的所有状态信息
@@ -84,7 +106,7 @@ struct client {
   int master_fd;               /* PTY 主端 fd */
   int slave_fd;                /* PTY 从端 fd */
   pid_t slave_pid;             /* 子进程 PID */
-  struct winsize ws;           /* 终端窗口尺寸 */
+  struct winsize ws;           /* 终端窗口尺寸（含状态栏） */
   struct termios orig_termios; /* 原始终端属性 (用于恢复) */
   int child_exited;            /* 子进程退出标志 */
   struct termios raw;          /* 原始模式终端属性 */
@@ -92,6 +114,31 @@ struct client {
   struct environ *environ;     /* 环境变量 */
   struct window_pane *pane;    /* 当前活动窗格 */
   int sync_input_mode;
+  int observer;                /* 只读观察者：不持有 PTY，跟随服务端的尺寸 */
+
+  struct reactor *reactor;               /* 事件循环 */
+  struct reactor_handler stdin_handler;  /* 标准输入注册项 */
+  struct reactor_handler server_handler; /* server 连接注册项 */
+  struct msg_reader in;                  /* server 连接的接收缓冲区 */
+  struct recorder *recorder;             /* MUXKIT_RECORD 录制器，NULL 表示不录制 */
+  int render_pending;                    /* 有尚未渲染的输出 */
+  int layout_pending;                    /* pane 增减或尺寸变化，需要重新布局 */
+  int frame_interval_ms;                 /* 两帧之间的最小间隔 */
+  long long last_frame_ms;               /* 上一帧的时间 */
+  int resize_pending;                    /* 收到 SIGWINCH，等待尺寸稳定 */
+  long long resize_due_ms;               /* 按最终尺寸布局的时间点 */
+  int resize_delay_ms;                   /* 尺寸稳定多久后布局 */
+
+  int in_paste;                          /* 正在接收 bracketed paste */
+  char paste_hold[PASTE_MARK_LEN];       /* 被 read 拆开的半个粘贴标记 */
+  size_t paste_held;                     /* paste_hold 中的字节数 */
+  long long paste_hold_ms;               /* 粘贴外暂留的字节最迟转发的时间点 */
+
+  uint64_t input_us;                         /* 本次 stdin 读入的时间 */
+  struct pane_latency *latency[MAX_PANES];   /* 每个 pane 的延迟跟踪，按需分配 */
+  int latency_echoed;                        /* 有回显等待写出 */
+  int latency_dirty;                         /* 有尚未上报的样本 */
+  long long latency_report_ms;               /* 下次上报的时间 */
 };
 
 /**
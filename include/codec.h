@@ -0,0 +1,84 @@
+/**
+ * codec.h - muxkit 数据编解码模块
+ *
+ * 网格快照使用的通用编解码函数：
+ * - lz_compress/lz_decompress: 轻量 LZ77 压缩，格式与 LZ4 块格式类似，
+ *   不依赖外部库，主要压缩快照中重复的样式游程和相似行
+ * - crc32: 快照完整性校验 (IEEE 802.3 多项式)
+ *
+ * 压缩格式：
+ *   若干序列，每个序列为
+ *     token (高 4 位字面量长度，低 4 位匹配长度 - 4，15 表示后续扩展字节)
+ *     [扩展长度] 字面量 2 字节小端偏移 [扩展长度]
+ *   最后一个序列只有字面量
+ *
+ * 使用方法：
+ *   char *dst = malloc(lz_bound(len));
+ *   size_t n = lz_compress(src, len, dst, lz_bound(len));
+ *   lz_decompress(dst, n, out, len);
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief 压缩输出的最坏情况大小
+ * @param len 输入字节数
+ * @return 输出缓冲区至少需要的字节数
+ */
+size_t lz_bound(size_t len);
+
+/**
+ * @brief LZ 压缩
+ * @param src 输入数据
+ * @param len 输入字节数
+ * @param dst 输出缓冲区
+ * @param cap 输出缓冲区容量
+ * @return 压缩后字节数，容量不足返回 0
+ */
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap);
+
+/**
+ * @brief LZ 解压
+ * @param src 压缩数据
+ * @param len 压缩字节数
+ * @param dst 输出缓冲区
+ * @param cap 输出缓冲区容量（应为原始字节数）
+ * @return 解压后字节数，数据损坏或容量不足返回 -1
+ */
+long lz_decompress(const void *src, size_t len, void *dst, size_t cap);
+
+/**
+ * @brief 计算 CRC32
+ * @param crc 初始值（首次为 0，可用上次结果分段计算）
+ * @param buf 数据
+ * @param len 字节数
+ * @return CRC32
+ */
+uint32_t crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif /* CODEC_H */
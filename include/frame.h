@@ -0,0 +1,139 @@
+/**
+ * frame.h - muxkit 帧输出缓冲模块
+ *
+ * 定义每帧输出缓冲区的数据结构和接口：
+ * - struct frame: 帧缓冲区，收集一帧内的所有终端输出
+ * - struct frame_stats: 帧统计信息（字节数、系统调用次数）
+ *
+ * 渲染函数 (render_pane / render_status_bar / render_pane_borders)
+ * 只向当前帧追加数据，由事件循环在一帧结束时调用 frame_flush()
+ * 一次性写出，避免每个单元格一次 write()。
+ *
+ * 使用方法：
+ *   struct frame *f = frame_current();
+ *   frame_puts(f, "\033[0m");
+ *   frame_printf(f, "\033[%u;%uH", row, col);
+ *   frame_flush(f);
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+
+#define FRAME_BUF_INIT (16 * 1024) /* 帧缓冲区初始容量 */
+
+/**
+ * 帧统计信息
+ */
+struct frame_stats {
+  size_t bytes;                 /* 上一帧输出字节数 */
+  unsigned int syscalls;        /* 上一帧 write 调用次数 */
+  unsigned long frames;         /* 累计帧数 */
+  unsigned long long total_bytes;    /* 累计输出字节数 */
+  unsigned long long total_syscalls; /* 累计 write 调用次数 */
+};
+
+/**
+ * 帧缓冲区
+ */
+struct frame {
+  char *buf;                /* 输出数据 */
+  size_t len;               /* 已写入长度 */
+  size_t cap;               /* 缓冲区容量 */
+  int fd;                   /* 输出目标 fd */
+  struct frame_stats stats; /* 统计信息 */
+};
+
+/**
+ * @brief 初始化帧缓冲区
+ * @param f  帧缓冲区指针
+ * @param fd 输出目标 fd
+ */
+void frame_init(struct frame *f, int fd);
+
+/**
+ * @brief 释放帧缓冲区
+ * @param f 帧缓冲区指针
+ */
+void frame_free(struct frame *f);
+
+/**
+ * @brief 追加数据到当前帧
+ * @param f    帧缓冲区指针
+ * @param data 数据
+ * @param len  数据长度
+ */
+void frame_append(struct frame *f, const char *data, size_t len);
+
+/**
+ * @brief 追加字符串到当前帧
+ * @param f 帧缓冲区指针
+ * @param s 以 NULL 结尾的字符串
+ */
+void frame_puts(struct frame *f, const char *s);
+
+/**
+ * @brief 追加格式化字符串到当前帧
+ * @param f   帧缓冲区指针
+ * @param fmt 格式字符串
+ */
+void frame_printf(struct frame *f, const char *fmt, ...);
+
+/**
+ * @brief 追加 n 个相同字符到当前帧
+ * @param f 帧缓冲区指针
+ * @param c 字符
+ * @param n 个数
+ */
+void frame_fill(struct frame *f, char c, size_t n);
+
+/**
+ * @brief 写出当前帧
+ *
+ * 将缓冲区中的数据一次性写到 fd（被信号打断或部分写入时继续），
+ * 并更新统计信息。空帧不产生系统调用。
+ *
+ * @param f 帧缓冲区指针
+ * @return 0 成功，-1 失败
+ */
+int frame_flush(struct frame *f);
+
+/**
+ * @brief 获取当前输出帧
+ *
+ * 默认指向标准输出的帧缓冲区。
+ *
+ * @return 帧缓冲区指针
+ */
+struct frame *frame_current(void);
+
+/**
+ * @brief 切换当前输出帧
+ * @param f 帧缓冲区指针，传 NULL 恢复为标准输出
+ * @return 之前的输出帧
+ */
+struct frame *frame_set_current(struct frame *f);
+
+#endif /* FRAME_H */
@@ -0,0 +1,238 @@
+/**
+ * history.h - muxkit 历史行存储模块
+ *
+ * 滚动历史不再按 history_size * width 预分配整行单元格，而是：
+ * - 每行去掉末尾空白后编码为变长记录（样式游程 + UTF-8 文本）
+ * - 记录追加到分段的只增内存区 (arena)，不跨段
+ * - 按绝对行号取模的环形索引，O(1) 找到任意一行
+ * - 每个 pane 有行数和字节数两个上限，超出时从最旧的行开始丢弃
+ *
+ * 记录格式：
+ *   varint 记录长度（不含本字段）
+ *   uint8  行标志 (HISTORY_LINE_WRAPPED)
+ *   varint 单元格数
+ *   varint 写入时的行宽（自动换行拼接逻辑行时用于补回被裁掉的末尾空白）
+ *   若干游程：varint (count << 1 | kind)、varint 样式 id、数据
+ *     kind 0 (TEXT)：count 个宽度为 1 的单码点单元格，UTF-8 编码
+ *     kind 1 (RAW) ：count 个 uint32 单元格字符字（宽字符、字符簇等）
+ *
+ * 记录中的样式 id 和字符簇下标指向所属 grid 的样式表和字符簇表。
+ *
+ * 可选的落盘层 (history_set_spill)：常驻内存超过 max_bytes 时，
+ * 最旧的段写入运行时目录下的临时文件并释放内存，
+ * 访问时再按需 mmap，常驻内存有界而历史长度只受磁盘上限约束。
+ *
+ * 使用方法：
+ *   struct history *h = history_create(lines, bytes);
+ *   history_push(h, cells, width, 0);
+ *   history_get(h, history_lines(h) - 1, row, width, &flags);
+ *   history_destroy(h);
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct cell;
+
+#define HISTORY_SEGMENT_SIZE (64 * 1024) /* 每段内存区大小 */
+#define HISTORY_MAP_MAX 16 /* 同时 mmap 的落盘段上限 */
+#define HISTORY_LINE_WRAPPED 0x01 /* 行标志：该行是上一行的自动换行延续 */
+
+/**
+ * 行索引项
+ */
+struct history_ref {
+  uint32_t seg; /* 所在段的绝对编号 */
+  uint32_t off; /* 段内偏移 */
+};
+
+/**
+ * 内存区段
+ */
+struct history_segment {
+  char *data;        /* 记录数据；落盘段为 mmap 地址，未映射时为 NULL */
+  size_t used;       /* 已用字节 */
+  size_t cap;        /* 容量 */
+  uint64_t end_line; /* 段内最后一行之后的绝对行号 */
+  int cold;          /* 是否已落盘 */
+  off_t file_off;    /* 落盘文件中的偏移（页对齐） */
+};
+
+/**
+ * 历史行存储
+ */
+struct history {
+  struct history_segment *segs; /* 段数组，segs[0] 最旧 */
+  unsigned int nsegs;           /* 段数 */
+  unsigned int segs_cap;        /* 段数组容量 */
+  uint32_t seg_base;            /* segs[0] 的绝对编号 */
+
+  struct history_ref *index; /* 环形索引，下标为绝对行号 & (index_cap - 1) */
+  unsigned int index_cap;    /* 索引容量（2 的幂） */
+  uint64_t first;            /* 最旧一行的绝对行号 */
+  uint64_t end;              /* 最新一行之后的绝对行号 */
+
+  unsigned int max_lines; /* 行数上限 */
+  size_t max_bytes;       /* 常驻内存字节数上限 */
+  size_t bytes;           /* 当前常驻内存字节数 */
+
+  unsigned int ncold;  /* 已落盘的段数（总是最旧的 ncold 段） */
+  size_t max_disk;     /* 落盘字节数上限，0 表示不落盘 */
+  size_t disk_bytes;   /* 当前落盘字节数 */
+  int spill_fd;        /* 落盘文件，-1 表示尚未创建 */
+  off_t spill_end;     /* 落盘文件写入位置 */
+  int spill_error;     /* 落盘失败后不再尝试 */
+  uint32_t mapped[HISTORY_MAP_MAX]; /* 已映射段的绝对编号 */
+  uint8_t map_used[HISTORY_MAP_MAX]; /* 映射槽是否在用 */
+  unsigned int map_clock;           /* 下一个被替换的映射槽 */
+};
+
+/**
+ * @brief 创建历史行存储
+ * @param max_lines 行数上限，0 表示不保存历史
+ * @param max_bytes 常驻内存字节数上限（至少保留一个段）
+ * @return 历史存储指针，失败返回 NULL
+ */
+struct history *history_create(unsigned int max_lines, size_t max_bytes);
+
+/**
+ * @brief 启用落盘层
+ * 常驻内存超过 max_bytes 的旧段写入运行时目录下的临时文件
+ * @param h        历史存储指针
+ * @param max_disk 落盘字节数上限，0 表示关闭
+ */
+void history_set_spill(struct history *h, size_t max_disk);
+
+/**
+ * @brief 销毁历史行存储
+ * @param h 历史存储指针
+ */
+void history_destroy(struct history *h);
+
+/**
+ * @brief 清空所有历史行，保留上限设置
+ * @param h 历史存储指针
+ */
+void history_clear(struct history *h);
+
+/**
+ * @brief 当前保存的行数
+ * @param h 历史存储指针，NULL 返回 0
+ * @return 行数
+ */
+unsigned int history_lines(const struct history *h);
+
+/**
+ * @brief 追加一行，末尾空白单元格不保存
+ * @param h     历史存储指针
+ * @param cells 单元格数组
+ * @param n     单元格数
+ * @param flags 行标志 (HISTORY_LINE_WRAPPED)
+ * @return 0 成功，-1 失败
+ */
+int history_push(struct history *h, const struct cell *cells, unsigned int n,
+                 uint8_t flags);
+
+/**
+ * @brief 读取一行的行头
+ * @param h     历史存储指针
+ * @param idx   行号，0 为最旧一行
+ * @param width 输出写入时的行宽，可为 NULL
+ * @param flags 输出行标志，可为 NULL
+ * @return 该行保存的单元格数，idx 越界返回 -1
+ */
+int history_info(struct history *h, unsigned int idx, unsigned int *width,
+                 uint8_t *flags);
+
+/**
+ * @brief 解码一行
+ *
+ * 输出 width 个单元格：超出保存长度的部分为空单元格，
+ * 超出 width 的部分被截断。out 为 NULL 时只读取行头。
+ *
+ * @param h     历史存储指针
+ * @param idx   行号，0 为最旧一行
+ * @param out   输出缓冲区，至少 width 个单元格，可为 NULL
+ * @param width 输出宽度
+ * @param flags 输出行标志，可为 NULL
+ * @return 该行保存的单元格数，idx 越界返回 -1
+ */
+int history_get(struct history *h, unsigned int idx, struct cell *out,
+                unsigned int width, uint8_t *flags);
+
+/**
+ * @brief 获取一行的原始记录（用于序列化）
+ * 落盘段的记录指针在下一次访问历史前有效
+ * @param h   历史存储指针
+ * @param idx 行号，0 为最旧一行
+ * @param len 输出记录长度
+ * @return 记录指针，idx 越界返回 NULL
+ */
+const void *history_record(struct history *h, unsigned int idx,
+                           size_t *len);
+
+/**
+ * @brief 单行编码后的最大字节数
+ * @param n 单元格数
+ * @return 字节数上限
+ */
+size_t history_record_bound(unsigned int n);
+
+/**
+ * @brief 把一行编码为一条独立记录（不进入存储，用于快照中的屏幕行）
+ * @param out   输出缓冲区，至少 history_record_bound(n) 字节
+ * @param cells 单元格数组
+ * @param n     单元格数
+ * @param flags 行标志
+ * @return 记录字节数
+ */
+size_t history_record_encode(void *out, const struct cell *cells,
+                             unsigned int n, uint8_t flags);
+
+/**
+ * @brief 解码一条独立记录
+ * @param rec   记录数据，以 varint 长度开头
+ * @param len   可用数据长度
+ * @param out   输出缓冲区，至少 width 个单元格
+ * @param width 输出宽度
+ * @param flags 输出行标志，可为 NULL
+ * @return 消耗的字节数，记录不完整或损坏返回 -1
+ */
+long history_record_decode(const void *rec, size_t len, struct cell *out,
+                           unsigned int width, uint8_t *flags);
+
+/**
+ * @brief 追加一条原始记录（用于反序列化）
+ * @param h   历史存储指针
+ * @param rec 记录数据，以 varint 长度开头
+ * @param len 可用数据长度
+ * @return 消耗的字节数，记录不完整或损坏返回 -1
+ */
+long history_push_record(struct history *h, const void *rec, size_t len);
+
+#endif /* HISTORY_H */
@@ -54,8 +54,11 @@ typedef enum {
   MSG_HELP_OPTIONS,
   MSG_HELP_OPT_LIST,
   MSG_HELP_OPT_ATTACH,
+  MSG_HELP_OPT_WATCH,
+  MSG_HELP_OPT_LATENCY,
   MSG_HELP_OPT_KILL,
   MSG_HELP_OPT_NEW,
+  MSG_HELP_OPT_RESTORE,
   MSG_HELP_OPT_HELP,
   MSG_HELP_KEYBINDINGS,
   MSG_HELP_KEY_DETACH,
@@ -68,8 +71,11 @@ typedef enum {
   MSG_HELP_EX_NEW,
   MSG_HELP_EX_LIST,
   MSG_HELP_EX_ATTACH,
+  MSG_HELP_EX_WATCH,
+  MSG_HELP_EX_LATENCY,
   MSG_HELP_EX_KILL,
   MSG_HELP_EX_NEW_DETACH,
+  MSG_HELP_EX_RESTORE,
 
   /* 错误信息 */
   MSG_ERR_MKDIR,
@@ -88,7 +94,10 @@ typedef enum {
   MSG_SESSION_KILLED,
   MSG_SESSION_NOT_FOUND,
   MSG_ATTACH_FAILED,
+  MSG_SESSIONS_RESTORED,
   MSG_NESTED_WARNING,
+  MSG_LATENCY_TITLE,
+  MSG_LATENCY_NONE,
 
   /* 状态栏 */
   MSG_STATUS_HISTORY,
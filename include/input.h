@@ -4,6 +4,7 @@
  * 定义 PTY 输入处理接口：
  * - pane_input: 处理来自 PTY 的数据，通过 libvterm 解析
  * - sync_vterm_from_grid: 从 grid 同步屏幕内容到 VTerm
+ * - sync_grid_rect: 按 libvterm 损坏区域增量同步到 grid
  *
  * MIT License
  * Copyright (c) 2024 LatosProject
@@ -30,6 +31,7 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include "render.h"
 #include "window.h"
 #include <stddef.h>
 
@@ -65,4 +67,28 @@ void sync_vterm_from_grid(struct window_pane *p);
  */
 void sync_grid_from_vterm(struct window_pane *p);
 
+/**
+ * @brief 从 libvterm 同步矩形区域到 grid
+ *
+ * 只读取 rect 范围内的单元格，由 libvterm damage 回调驱动，
+ * 避免每次输入后整屏同步。超出 grid 范围的部分会被裁剪。
+ *
+ * @param p    窗格指针
+ * @param rect 需要同步的区域
+ */
+void sync_grid_rect(struct window_pane *p, VTermRect rect);
+
+/**
+ * @brief libvterm 单元格转换为 grid 单元格
+ *
+ * 多码点字符簇（组合字符等）存入 g 的字符簇表，
+ * RGB 颜色映射到 256 色索引。
+ *
+ * @param g    单元格所属网格
+ * @param c    输出单元格
+ * @param cell libvterm 单元格
+ */
+void cell_from_vterm(struct grid *g, struct cell *c,
+                     const VTermScreenCell *cell);
+
 #endif /* INPUT_H */
@@ -0,0 +1,104 @@
+/**
+ * latency.h - muxkit 输入到屏幕的延迟统计
+ *
+ * 一次按键经过 stdin -> act_stdin_read -> PTY -> shell -> PTY ->
+ * 服务端模拟器 -> MSG_PANE_OUTPUT -> pane_input -> render -> stdout。
+ * 客户端在自己能看到的几个点打单调时钟时间戳，分成四段：
+ *   LAT_WRITE   读到 stdin 到写进 PTY
+ *   LAT_ECHO    写进 PTY 到这个 pane 的下一段输出到达（shell + 服务端往返）
+ *   LAT_RENDER  输出到达到包含它的一帧写到 stdout（帧率合并 + 渲染）
+ *   LAT_TOTAL   读到 stdin 到屏幕更新
+ * 每个 pane 同一时间只跟踪一次按键，等它显示出来再采下一次；
+ * 超过 MUXKIT_LATENCY_TIMEOUT 还没有回显的按键（如 sleep 期间的回车）丢弃。
+ *
+ * 直方图按对数分桶：每个 2 的幂区间再等分 LAT_SUB 份，
+ * 记录一次只是一次 clz 和一次计数，百分位误差不超过 1/LAT_SUB。
+ * 拥有者客户端定期用 MSG_LATENCY 把累计的直方图交给服务端，
+ * muxkit -L <id> 查询某个会话每个 pane 和整个会话的 p50/p99/p999。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LAT_SUB_BITS 3
+#define LAT_SUB (1 << LAT_SUB_BITS) /* 每个 2 的幂区间的子桶数 */
+#define LAT_BUCKETS 240             /* 1 微秒到约 71 分钟 */
+
+enum lat_stage {
+  LAT_WRITE,  /* stdin -> PTY */
+  LAT_ECHO,   /* PTY -> 回显到达 */
+  LAT_RENDER, /* 回显到达 -> stdout */
+  LAT_TOTAL,  /* stdin -> stdout */
+  LAT_STAGES,
+};
+
+/**
+ * 对数分桶直方图，单位微秒
+ */
+struct latency_hist {
+  uint64_t count;                 /* 样本数 */
+  uint64_t sum_us;                /* 样本总和 */
+  uint64_t max_us;                /* 最大值 */
+  uint32_t buckets[LAT_BUCKETS]; /* 各桶计数 */
+};
+
+/**
+ * @brief 单调时钟，微秒
+ */
+uint64_t latency_now_us(void);
+
+/**
+ * @brief 记录一个样本
+ */
+void latency_record(struct latency_hist *h, uint64_t us);
+
+/**
+ * @brief 把 src 累加到 dst
+ */
+void latency_merge(struct latency_hist *dst, const struct latency_hist *src);
+
+/**
+ * @brief 估算百分位
+ * @param h   直方图
+ * @param pct 百分位 (0-100)
+ * @return 所在桶的中点（微秒），没有样本返回 0
+ */
+uint64_t latency_percentile(const struct latency_hist *h, double pct);
+
+/**
+ * @brief 阶段名称
+ */
+const char *latency_stage_name(enum lat_stage stage);
+
+/**
+ * @brief 把一组阶段直方图格式化为一段文本，每个有样本的阶段一行
+ * @return 写入的字节数（不超过 size - 1）
+ */
+size_t latency_format(char *buf, size_t size, const char *label,
+                      const struct latency_hist *stages);
+
+#endif /* LATENCY_H */
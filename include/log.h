@@ -4,9 +4,15 @@
  * 提供简单的日志功能：
  * - 4 个日志级别：DEBUG, INFO, WARN, ERROR
  * - 日志输出到 stderr 和文件
- * - 可通过 ENABLE_LOG 宏开关
+ * - 可通过 ENABLE_LOG 宏开关，LOG_COMPILE_LEVEL 以下的级别在编译时去掉
  * - 自动添加时间戳、文件名、行号
  *
+ * 日志宏不在调用处格式化：每个调用点有一个静态的 log_site，
+ * 第一次调用时解析格式串记下参数类型，之后每次只把时间、调用点和
+ * 原始参数（字符串拷贝内容）写进环形缓冲。事件循环每次进入 reactor_wait
+ * 前由 log_flush 统一格式化并一次写出；ERROR 立即写出。
+ * 缓冲写满时丢弃新日志并计数，不在热路径上阻塞。
+ *
  * 使用方法：
  *   log_init("client");
  *   log_info("connected to server, fd %d", fd);
@@ -47,6 +53,21 @@ typedef enum {
   LOG_ERROR,  /* 错误 */
 } log_level_t;
 
+#define LOG_MAX_ARGS 16 /* 一条日志最多的参数个数，超出时在调用处格式化 */
+
+/**
+ * 日志调用点
+ * 由日志宏静态定义，第一次调用时填入格式串和参数类型
+ */
+struct log_site {
+  log_level_t level;                 /* 日志级别 */
+  const char *file;                  /* 源文件名 */
+  int line;                          /* 行号 */
+  const char *fmt;                   /* 格式串 */
+  int nargs;                         /* 参数个数，-1 表示尚未解析 */
+  unsigned char types[LOG_MAX_ARGS]; /* 每个参数的类型 */
+};
+
 /**
  * 初始化日志系统
  * 日志文件创建在 socket_path 同目录下
@@ -55,7 +76,7 @@ typedef enum {
 void log_init(const char *name);
 
 /**
- * 关闭日志
+ * 关闭日志，写出缓冲中剩余的日志
  */
 void log_close(void);
 
@@ -65,38 +86,57 @@ void log_close(void);
  */
 void log_set_level(log_level_t level);
 
+/**
+ * 格式化缓冲中的日志并写出，事件循环阻塞等待之前调用
+ */
+void log_flush(void);
+
 /* 日志开关 */
 /* #define ENABLE_LOG */
-#ifdef ENABLE_LOG
+
+/* 编译时最低级别：0 DEBUG, 1 INFO, 2 WARN, 3 ERROR，更低级别的日志宏展开为空 */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
 /* 日志宏 - 自动添加文件名和行号 */
-#define log_debug(...) log_write(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(...) log_write(LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(...) log_write(LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(...) log_write(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#else
-/* 日志禁用时的空宏 */
-#define log_debug(...)                                                         \
+#define LOG_EVENT(lvl, ...)                                                    \
   do {                                                                         \
+    static struct log_site log_site_ = {lvl, __FILE__, __LINE__, 0, -1, {0}}; \
+    log_event(&log_site_, __VA_ARGS__);                                        \
   } while (0)
-#define log_info(...)                                                          \
-  do {                                                                         \
-  } while (0)
-#define log_warn(...)                                                          \
-  do {                                                                         \
-  } while (0)
-#define log_error(...)                                                         \
+/* 日志禁用时的空宏 */
+#define LOG_NONE(...)                                                          \
   do {                                                                         \
   } while (0)
+
+#if defined(ENABLE_LOG) && LOG_COMPILE_LEVEL <= 0
+#define log_debug(...) LOG_EVENT(LOG_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) LOG_NONE(__VA_ARGS__)
+#endif
+#if defined(ENABLE_LOG) && LOG_COMPILE_LEVEL <= 1
+#define log_info(...) LOG_EVENT(LOG_INFO, __VA_ARGS__)
+#else
+#define log_info(...) LOG_NONE(__VA_ARGS__)
+#endif
+#if defined(ENABLE_LOG) && LOG_COMPILE_LEVEL <= 2
+#define log_warn(...) LOG_EVENT(LOG_WARN, __VA_ARGS__)
+#else
+#define log_warn(...) LOG_NONE(__VA_ARGS__)
+#endif
+#if defined(ENABLE_LOG) && LOG_COMPILE_LEVEL <= 3
+#define log_error(...) LOG_EVENT(LOG_ERROR, __VA_ARGS__)
+#else
+#define log_error(...) LOG_NONE(__VA_ARGS__)
 #endif
 
 /**
- * 写入日志 (内部函数，通过宏调用)
- * @param level 日志级别
- * @param file  源文件名
- * @param line  行号
- * @param fmt   格式字符串
+ * 记录一条日志 (内部函数，通过宏调用)
+ * @param site 调用点
+ * @param fmt  格式字符串，同一调用点每次相同
  */
-void log_write(log_level_t level, const char *file, int line, const char *fmt,
-               ...);
+void log_event(struct log_site *site, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
 
 #endif
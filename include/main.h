@@ -5,6 +5,16 @@
  * - MUXKIT_SOCK: Unix 域套接字目录路径
  * - MUXKIT_BUF_*: 各种缓冲区大小常量
  * - MUXKIT_LISTEN_BACKLOG: 服务端监听队列长度
+ * - MUXKIT_FRAME_RATE: 客户端最大刷新帧率
+ * - MUXKIT_RESIZE_DELAY: 窗口尺寸变化的合并窗口
+ * - MUXKIT_HISTORY_*: 每个窗格的滚动历史上限
+ * - MUXKIT_CLUSTER_MAX: 每个窗格的字符簇表上限
+ * - MUXKIT_SNAPSHOT_LZ: 网格快照是否压缩
+ * - MUXKIT_CHECKPOINT_INTERVAL: 会话检查点写盘间隔
+ * - MUXKIT_BUFPOOL_*: 协议缓冲区池
+ * - MUXKIT_LATENCY_*: 输入延迟采样
+ * - MUXKIT_LOG_RING: 日志缓冲大小
+ * - MUXKIT_PANE_INPUT_MAX: 窗格待写输入上限
  *
  * MIT License
  * Copyright (c) 2024 LatosProject
@@ -39,4 +49,129 @@
 #define MUXKIT_INPUT_SEQ   64    /* 输入序列缓冲 */
 #define MUXKIT_LISTEN_BACKLOG 5  /* listen() 队列长度 */
 
+/*
+ * 客户端刷新控制
+ * 大量输出时一帧内的 PTY 数据全部送入 vterm 后只渲染一次。
+ * 帧率可在编译时用 -DMUXKIT_FRAME_RATE=N 修改，
+ * 运行时可用同名环境变量覆盖
+ */
+#ifndef MUXKIT_FRAME_RATE
+#define MUXKIT_FRAME_RATE 60          /* 最大帧率 */
+#endif
+#define MUXKIT_READ_BUDGET (256 * 1024) /* 每个 pane 每次就绪最多读取的字节数 */
+
+/*
+ * 窗口尺寸变化合并
+ * 拖动终端边缘时的一串 SIGWINCH 只在最后一次之后静默这么久才布局一次，
+ * 每个 shell 只收到一次 TIOCSWINSZ。运行时可用同名环境变量覆盖（毫秒）
+ */
+#ifndef MUXKIT_RESIZE_DELAY
+#define MUXKIT_RESIZE_DELAY 50 /* 毫秒 */
+#endif
+
+/*
+ * 滚动历史上限（每个窗格）
+ * 历史行按变长编码保存，行数和字节数任一超出时丢弃最旧的行。
+ * 可在编译时用 -D 修改，运行时可用同名环境变量覆盖
+ */
+#ifndef MUXKIT_HISTORY_LINES
+#define MUXKIT_HISTORY_LINES 100000 /* 最大历史行数 */
+#endif
+#ifndef MUXKIT_HISTORY_BYTES
+#define MUXKIT_HISTORY_BYTES (16 * 1024 * 1024) /* 历史常驻内存上限 */
+#endif
+/* 超出内存上限的旧历史写入运行时目录并按需 mmap，0 表示不落盘直接丢弃 */
+#ifndef MUXKIT_HISTORY_DISK_BYTES
+#define MUXKIT_HISTORY_DISK_BYTES 0 /* 历史落盘上限 */
+#endif
+
+/*
+ * 字符簇表上限（每个窗格）
+ * 多码点字符簇按内容去重后存表，表只增不减且随每次快照传输；
+ * 满了之后新的字符簇只保留首个码点
+ */
+#ifndef MUXKIT_CLUSTER_MAX
+#define MUXKIT_CLUSTER_MAX 4096 /* 条目数，约 128 KiB */
+#endif
+
+/*
+ * 网格快照默认是否 LZ 压缩
+ * 分离时快照经 memfd 交给 server，压缩只省内存；写入磁盘时更有价值。
+ * 运行时可用同名环境变量覆盖
+ */
+#ifndef MUXKIT_SNAPSHOT_LZ
+#define MUXKIT_SNAPSHOT_LZ 0
+#endif
+
+/*
+ * 会话检查点
+ * 服务端每隔这么久把有变化的会话写入运行时目录，重启后用 -R 恢复。
+ * 写盘在子进程中完成，不阻塞主循环。0 表示关闭，运行时可用同名环境变量覆盖
+ */
+#ifndef MUXKIT_CHECKPOINT_INTERVAL
+#define MUXKIT_CHECKPOINT_INTERVAL 5000 /* 毫秒 */
+#endif
+#define MUXKIT_CHECKPOINT_MAX 256 /* 一次最多恢复的会话数 */
+
+/*
+ * 附加客户端的输出流
+ * 服务端为每个 pane 保留最近这么多字节的输出，客户端按各自的进度拉取；
+ * 落后超过这个量的客户端改收一次网格快照，每个客户端占用的内存与输出量无关
+ */
+#ifndef MUXKIT_STREAM_RING
+#define MUXKIT_STREAM_RING (256 * 1024) /* 每个 pane 的输出流容量 */
+#endif
+#define MUXKIT_STREAM_CHUNK (16 * 1024) /* 一条 MSG_PANE_OUTPUT 最多携带的字节数 */
+
+/*
+ * 连接发送队列的水位
+ * 未发出的字节低于低水位才从输出流拉取下一批；超过高水位时暂停读取
+ * 这个连接的请求，降到低水位以下再恢复
+ */
+#ifndef MUXKIT_CONN_HIGH_WATER
+#define MUXKIT_CONN_HIGH_WATER (128 * 1024) /* 高水位 */
+#endif
+#define MUXKIT_CONN_LOW_WATER (MUXKIT_CONN_HIGH_WATER / 4) /* 低水位 */
+
+/*
+ * 窗格待写输入
+ * PTY 输入缓冲区满时写不下的输入（粘贴、终端应答）先排队，PTY 可写时再写出，
+ * 事件循环从不等待 shell 读输入。积压超过这个量时丢弃新输入
+ */
+#ifndef MUXKIT_PANE_INPUT_MAX
+#define MUXKIT_PANE_INPUT_MAX (1024 * 1024)
+#endif
+
+/*
+ * 协议缓冲区池
+ * 连接的接收缓冲区和发送队列从池中申请，连接关闭时归还给下一个连接；
+ * 空闲连接只保留不超过 MUXKIT_BUFPOOL_IDLE 的缓冲区，
+ * 大消息撑大的部分用完就还回池中
+ */
+#ifndef MUXKIT_BUFPOOL_BYTES
+#define MUXKIT_BUFPOOL_BYTES (4 * 1024 * 1024) /* 池中最多缓存的字节数 */
+#endif
+#define MUXKIT_BUFPOOL_IDLE (16 * 1024) /* 空闲连接保留的缓冲区上限 */
+
+/*
+ * 输入延迟采样
+ * 拥有者客户端记录每次按键到屏幕更新的各段耗时，每隔 MUXKIT_LATENCY_REPORT
+ * 把新增的样本交给服务端；超过 MUXKIT_LATENCY_TIMEOUT 没有回显的按键不计入
+ */
+#ifndef MUXKIT_LATENCY_REPORT
+#define MUXKIT_LATENCY_REPORT 1000 /* 上报间隔，毫秒 */
+#endif
+#ifndef MUXKIT_LATENCY_TIMEOUT
+#define MUXKIT_LATENCY_TIMEOUT 1000 /* 等待回显的上限，毫秒 */
+#endif
+
+/*
+ * 日志缓冲
+ * 日志宏只把参数写进这块环形缓冲，事件循环空闲时再格式化写出；
+ * 两次写出之间的日志超过这个量时丢弃新日志并计数
+ */
+#ifndef MUXKIT_LOG_RING
+#define MUXKIT_LOG_RING (256 * 1024)
+#endif
+
 #endif /* MAIN_H */
@@ -8,12 +8,30 @@
  * 消息格式：
  *   [msg_header][payload]
  *
+ * 收发辅助 (protocol.c)：
+ * - msg_send 把一批消息的头和负载拼成一次 writev
+ * - msg_reader 是每个连接的接收缓冲区，一次 recvmsg 读入能读到的数据，
+ *   再从中切出完整的消息，负载直接指向缓冲区，不再逐条 malloc；
+ *   随数据到达的 SCM_RIGHTS fd 按顺序排队，由 msg_reader_fd 取出；
+ *   缓冲区从 bufpool 申请，大消息撑大的部分取空后还回池中
+ *
  * 主要消息类型：
  *   MSG_COMMAND      - 执行命令
  *   MSG_RESIZE       - 调整终端尺寸
  *   MSG_DETACH       - 分离/附加会话
  *   MSG_LIST_SESSIONS - 列出会话
- *   MSG_GRID_SAVE    - 保存屏幕状态
+ *   MSG_GRID_SAVE    - 保存屏幕状态（快照经 SCM_RIGHTS 以 memfd 传递）
+ *   MSG_RESTORE      - 从磁盘检查点恢复会话
+ *   MSG_WATCH        - 以只读观察者身份连接会话
+ *   MSG_LATENCY      - 拥有者定期上报各 pane 新增的输入延迟样本
+ *   MSG_LATENCY_QUERY - 查询会话的延迟分位数（muxkit -L）
+ *   MSG_PANE_*       - 服务端推送给附加客户端的 pane 输出、尺寸和退出事件
+ *
+ * 附加（MSG_DETACH 带会话 ID）和观察（MSG_WATCH）的应答：
+ *   MSG_READY (struct msg_attach)
+ *   每个 pane 一组 { MSG_PANE_NEW [+ PTY fd], MSG_GRID_SAVE + 快照 fd }
+ * 之后服务端持续推送 MSG_PANE_OUTPUT / MSG_PANE_RESIZE / MSG_PANE_EXIT，
+ * 客户端落后太多时改为推送一次 MSG_GRID_SAVE 快照。
  *
  * MIT License
  * Copyright (c) 2024 LatosProject
@@ -38,9 +56,11 @@
  */
 
 #pragma once
+#include "latency.h"
 #include <stddef.h>
+#include <sys/types.h>
 
-#define PROTOCOL_VERSION 2
+#define PROTOCOL_VERSION 10
 
 /**
  * 消息类型枚举
@@ -96,6 +116,16 @@ enum msgtype {
   MSG_READ_CANCEL,
 
   MSG_GRID_SAVE,
+  MSG_RESTORE,
+  MSG_WATCH,
+  MSG_LATENCY,
+  MSG_LATENCY_QUERY,
+
+  /* pane 事件 (400-499)，服务端推送 */
+  MSG_PANE_NEW = 400,
+  MSG_PANE_OUTPUT,
+  MSG_PANE_RESIZE,
+  MSG_PANE_EXIT,
 };
 
 /**
@@ -104,4 +134,135 @@ enum msgtype {
 struct msg_header {
   enum msgtype type; /* 消息类型 */
   size_t len;        /* 负载长度 */
-};
\ No newline at end of file
+};
+
+/**
+ * MSG_GRID_SAVE 消息体
+ * 网格快照本身不在消息中，紧随消息之后用 send_fd 传递快照 memfd，
+ * 接收端直接 mmap，避免大段历史在套接字上来回拷贝
+ */
+struct msg_grid {
+  unsigned int pane_id; /* 窗格 ID */
+  size_t len;           /* 快照字节数 */
+};
+
+/**
+ * MSG_READY 消息体：附加或观察的应答
+ */
+struct msg_attach {
+  int pane_count;            /* 随后发送的 pane 数量，0 表示失败 */
+  unsigned int next_pane_id; /* 下一个新建 pane 的 ID */
+};
+
+#define MSG_PANE_FD 0x01 /* 消息之后用 send_fd 传递 PTY 主设备 fd */
+
+/**
+ * MSG_PANE_* 消息体
+ * MSG_PANE_OUTPUT 的 PTY 输出紧跟在结构体之后
+ */
+struct msg_pane {
+  unsigned int pane_id; /* 窗格 ID */
+  unsigned short cols;  /* MSG_PANE_NEW / MSG_PANE_RESIZE 的尺寸 */
+  unsigned short rows;
+  unsigned int flags;   /* MSG_PANE_FD */
+};
+
+/**
+ * MSG_LATENCY 消息体
+ * 上次上报之后新增的样本，服务端累加到会话中这个 pane 的直方图
+ */
+struct msg_latency {
+  unsigned int pane_id;                      /* 窗格 ID */
+  struct latency_hist stages[LAT_STAGES];    /* 各阶段的直方图 */
+};
+
+/* ============ 消息收发 ============ */
+
+/**
+ * 一条待发送的消息
+ */
+struct msg_out {
+  enum msgtype type; /* 消息类型 */
+  const void *data;  /* 负载，可为 NULL */
+  size_t len;        /* 负载长度 */
+};
+
+#define MSG_BATCH_MAX 8   /* msg_send 一次最多合并的消息数 */
+#define MSG_READER_FDS 16 /* 接收缓冲区中最多暂存的 fd */
+
+/**
+ * 接收缓冲区
+ * [start, end) 是已读入、尚未解析的数据
+ */
+struct msg_reader {
+  char *buf;                /* 缓冲区 */
+  size_t cap;               /* 当前容量 */
+  size_t max;               /* 容量上限：消息头加最大负载 */
+  size_t start;             /* 下一条消息的起点 */
+  size_t end;               /* 已读入数据的末尾 */
+  int fds[MSG_READER_FDS];  /* 已收到、尚未取走的 fd */
+  int nfds;                 /* 暂存的 fd 数量 */
+};
+
+/**
+ * @brief 用一次 writev 发送多条消息，写不完时继续写剩余部分
+ * @param fd    套接字
+ * @param msgs  消息数组
+ * @param count 消息数量，不超过 MSG_BATCH_MAX
+ * @return 0 成功，-1 失败
+ */
+int msg_send(int fd, const struct msg_out *msgs, int count);
+
+/**
+ * @brief 初始化接收缓冲区
+ * @param r           接收缓冲区
+ * @param max_payload 允许的最大负载长度
+ * @return 0 成功，-1 失败
+ */
+int msg_reader_init(struct msg_reader *r, size_t max_payload);
+
+/**
+ * @brief 释放接收缓冲区，关闭尚未取走的 fd
+ * @param r 接收缓冲区
+ */
+void msg_reader_free(struct msg_reader *r);
+
+/**
+ * @brief 从套接字读一次，数据追加到缓冲区，附带的 fd 进入队列
+ * @param r  接收缓冲区
+ * @param fd 套接字
+ * @return 读到的字节数，0 对端关闭，-1 出错（errno 保留，可能是 EAGAIN）
+ */
+ssize_t msg_reader_fill(struct msg_reader *r, int fd);
+
+/**
+ * @brief 从缓冲区切出下一条完整的消息
+ *
+ * 负载指向缓冲区内部，下一次 msg_reader_fill / msg_reader_fd 之前有效，
+ * 不保证对齐。
+ *
+ * @param r       接收缓冲区
+ * @param hdr     输出消息头
+ * @param payload 输出负载指针
+ * @return 1 取到消息，0 数据还不完整，-1 负载超过上限
+ */
+int msg_reader_next(struct msg_reader *r, struct msg_header *hdr,
+                    char **payload);
+
+/**
+ * @brief 阻塞读取下一条完整的消息，用于握手等同步流程
+ * @return 0 成功，-1 连接关闭或出错
+ */
+int msg_reader_wait(struct msg_reader *r, int fd, struct msg_header *hdr,
+                    char **payload);
+
+/**
+ * @brief 取出消息之后用 send_fd 传来的 fd
+ *
+ * 消耗占位字节并返回与之一起到达的 fd，占位字节还没到时阻塞读取。
+ *
+ * @param r  接收缓冲区
+ * @param fd 套接字
+ * @return 收到的 fd，失败返回 -1
+ */
+int msg_reader_fd(struct msg_reader *r, int fd);
@@ -0,0 +1,139 @@
+/**
+ * reactor.h - muxkit 事件循环模块
+ *
+ * 对 fd 就绪通知的简单封装：
+ * - Linux 下使用 epoll，注册/注销和每次事件分发都是 O(1)
+ * - 其他平台退化为 poll()
+ *
+ * 注册项 struct reactor_handler 嵌入到调用者自己的结构体中，
+ * 回调里用 container_of() 直接取回所属对象（会话、连接、窗格），
+ * 不需要按 fd 查表。
+ *
+ * 使用方法：
+ *   struct conn {
+ *     struct reactor_handler handler;
+ *     ...
+ *   };
+ *   static void conn_event(struct reactor_handler *h, unsigned int events) {
+ *     struct conn *c = container_of(h, struct conn, handler);
+ *     ...
+ *   }
+ *   reactor_add(r, &c->handler, fd, REACTOR_READ, conn_event);
+ *   while (reactor_wait(r, -1) >= 0)
+ *     ;
+ *
+ * 回调中可以安全地 reactor_del() 并释放任意注册项（包括自己），
+ * 同一批次中尚未分发的事件会被丢弃。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stddef.h>
+
+#define REACTOR_READ 0x01  /* 可读（包括对端关闭） */
+#define REACTOR_WRITE 0x02 /* 可写 */
+#define REACTOR_ERROR 0x04 /* 出错或挂断 */
+
+#define REACTOR_MAX_EVENTS 64 /* 每次 reactor_wait 最多分发的事件数 */
+
+struct reactor;
+struct reactor_handler;
+
+/**
+ * 事件回调
+ * @param h      注册项
+ * @param events 就绪事件 (REACTOR_READ / REACTOR_WRITE / REACTOR_ERROR)
+ */
+typedef void (*reactor_cb)(struct reactor_handler *h, unsigned int events);
+
+/**
+ * 事件注册项
+ *
+ * 全部清零即为未注册状态，可以直接嵌入 calloc 出来的结构体。
+ */
+struct reactor_handler {
+  int fd;              /* 监听的 fd */
+  unsigned int events; /* 关心的事件 */
+  reactor_cb cb;       /* 回调函数 */
+  int active;          /* 内部使用：是否已注册 */
+  size_t slot;         /* 内部使用：poll 后端的数组下标 */
+};
+
+/**
+ * @brief 创建事件循环
+ * @return 事件循环指针，失败返回 NULL
+ */
+struct reactor *reactor_create(void);
+
+/**
+ * @brief 销毁事件循环
+ *
+ * 不会关闭已注册的 fd。
+ *
+ * @param r 事件循环指针
+ */
+void reactor_destroy(struct reactor *r);
+
+/**
+ * @brief 注册 fd
+ * @param r      事件循环指针
+ * @param h      注册项（由调用者持有，注销前不能释放）
+ * @param fd     文件描述符
+ * @param events 关心的事件
+ * @param cb     回调函数
+ * @return 0 成功，-1 失败
+ */
+int reactor_add(struct reactor *r, struct reactor_handler *h, int fd,
+                unsigned int events, reactor_cb cb);
+
+/**
+ * @brief 修改关心的事件
+ * @param r      事件循环指针
+ * @param h      已注册的注册项
+ * @param events 新的事件集合
+ * @return 0 成功，-1 失败
+ */
+int reactor_mod(struct reactor *r, struct reactor_handler *h,
+                unsigned int events);
+
+/**
+ * @brief 注销 fd
+ *
+ * 必须在 close(fd) 之前调用。对未注册的注册项调用无副作用。
+ *
+ * @param r 事件循环指针
+ * @param h 注册项
+ */
+void reactor_del(struct reactor *r, struct reactor_handler *h);
+
+/**
+ * @brief 等待并分发一批事件
+ * @param r          事件循环指针
+ * @param timeout_ms 超时毫秒数，-1 表示一直等待
+ * @return 分发的事件数，被信号打断返回 0，出错返回 -1
+ */
+int reactor_wait(struct reactor *r, int timeout_ms);
+
+#endif /* REACTOR_H */
@@ -0,0 +1,146 @@
+/**
+ * record.h - muxkit 会话录制和回放
+ *
+ * 客户端设置 MUXKIT_RECORD=<文件> 后，把收到的每个 pane 的原始输出连同
+ * 时间戳写入录制文件；muxkit-bench -p 按原速或最快速度回放，
+ * 得到可重复的帧延迟基准，也可以导出 asciicast v2 用 asciinema 播放。
+ *
+ * 文件格式（整数为 varint，与历史行编码相同）：
+ *   "MUXKREC1"                  8 字节文件头
+ *   记录 = 距上一条的微秒数, 类型 (1 字节), pane ID, 正文
+ *     REC_SIZE   正文为 列数, 行数；pane 第一次出现或尺寸变化时写入
+ *     REC_OUTPUT 正文为 长度, PTY 输出
+ *     REC_EXIT   无正文
+ * 客户端异常退出留下的半条记录在回放时忽略。
+ *
+ * 录制从附加时开始，附加时 pane 的已有屏幕内容来自服务端快照，不在录制中。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REC_MAGIC "MUXKREC1"
+#define REC_MAGIC_LEN 8
+#define REC_MAX_PANES 64 /* 跟踪尺寸的 pane ID 上限，与服务端 MAX_PANES 一致 */
+
+enum rec_type {
+  REC_SIZE = 1,   /* pane 尺寸 */
+  REC_OUTPUT = 2, /* pane 输出 */
+  REC_EXIT = 3,   /* pane 退出 */
+};
+
+/**
+ * 回放时读出的一条记录
+ */
+struct rec_event {
+  uint64_t time_us;     /* 距录制开始的微秒数 */
+  enum rec_type type;   /* 记录类型 */
+  unsigned int pane_id; /* 窗格 ID */
+  unsigned int cols;    /* REC_SIZE 的尺寸 */
+  unsigned int rows;
+  const char *data; /* REC_OUTPUT 的数据，指向映射的文件 */
+  size_t len;
+};
+
+struct recorder;
+
+/**
+ * 已映射到内存的录制文件
+ */
+struct replay {
+  const char *data; /* 文件内容 */
+  size_t len;       /* 文件长度 */
+  size_t off;       /* 下一条记录的位置 */
+  uint64_t time_us; /* 上一条记录的时间 */
+};
+
+/**
+ * @brief 创建录制文件并写入文件头
+ * @param path 文件路径
+ * @return 录制器，失败返回 NULL
+ */
+struct recorder *record_open(const char *path);
+
+/**
+ * @brief 记录一段 pane 输出，尺寸和上次记录的不同时先写 REC_SIZE
+ * @param r       录制器，NULL 时什么都不做
+ * @param pane_id 窗格 ID
+ * @param cols    当前列数
+ * @param rows    当前行数
+ * @param data    PTY 输出
+ * @param len     长度
+ */
+void record_output(struct recorder *r, unsigned int pane_id, unsigned int cols,
+                   unsigned int rows, const char *data, size_t len);
+
+/**
+ * @brief 记录 pane 退出
+ */
+void record_exit(struct recorder *r, unsigned int pane_id);
+
+/**
+ * @brief 写出缓冲并关闭录制文件
+ */
+void record_close(struct recorder *r);
+
+/**
+ * @brief 映射录制文件并检查文件头
+ * @return 0 成功，-1 失败
+ */
+int replay_open(struct replay *rp, const char *path);
+
+/**
+ * @brief 读出下一条记录
+ * @return 1 读到记录，0 文件结束（含末尾不完整的记录），-1 格式错误
+ */
+int replay_next(struct replay *rp, struct rec_event *ev);
+
+/**
+ * @brief 回到第一条记录
+ */
+void replay_rewind(struct replay *rp);
+
+/**
+ * @brief 解除映射
+ */
+void replay_close(struct replay *rp);
+
+/**
+ * @brief 把一个 pane 的录制导出为 asciicast v2
+ *
+ * 输出按 UTF-8 切分，被拆开的多字节字符留到下一条事件，
+ * 非法字节替换为 U+FFFD；尺寸变化导出为 "r" 事件。
+ *
+ * @param rp      回放文件（从头读取）
+ * @param out     输出文件路径
+ * @param pane_id 导出的窗格 ID
+ * @return 0 成功，-1 失败
+ */
+int replay_export_asciicast(struct replay *rp, const char *out,
+                            unsigned int pane_id);
+
+#endif /* RECORD_H */
@@ -7,7 +7,7 @@
  * - struct screen: 屏幕状态，包含光标位置和标题
  *
  * 主要功能：
- * - 窗格渲染 (render_pane)
+ * - 窗格渲染 (render_pane / render_pane_damage)
  * - 状态栏渲染 (render_status_bar)
  * - 窗格边框渲染 (render_pane_borders)
  * - 历史滚动管理 (grid_scroll_up/down)
@@ -37,8 +37,8 @@
 
 #ifndef RENDER_H
 #define RENDER_H
-#define DEFAULT_HISTORY_SIZE 1000
 
+#include "history.h"
 #include "server.h"
 #include "window.h"
 #include <stdint.h>
@@ -48,17 +48,134 @@ struct session;
 struct window_pane;
 struct client;
 
+/*
+ * 单元格字符编码 (struct cell.ch)
+ *   bit 0-20  Unicode 码点；置位 CELL_CLUSTER 时为 grid 字符簇表下标
+ *   bit 21-22 显示宽度 (0-2)
+ *   bit 31    CELL_CLUSTER：多码点字符簇（组合字符等），极少出现
+ * 码点为 0 表示空单元格（也用于宽字符的右半部分）
+ */
+#define CELL_CP_MASK 0x001fffffu
+#define CELL_WIDTH_SHIFT 21
+#define CELL_WIDTH_MASK (0x3u << CELL_WIDTH_SHIFT)
+#define CELL_CLUSTER 0x80000000u
+
+/*
+ * 样式画笔编码 (struct grid_style.pen)
+ *   bit 0-7   前景色索引 (0-255)
+ *   bit 8-15  背景色索引 (0-255)
+ *   bit 16-23 属性: bit0=bold, bit1=underline, bit2=italic, bit3=reverse
+ *   bit 24-31 标志位: bit0=默认fg, bit1=默认bg
+ */
+#define STYLE_PEN_DEFAULT (0x03u << 24) /* 默认前景色和背景色，无属性 */
+
+#define GRID_STYLE_DEFAULT 0 /* 默认样式 id，全零单元格即为默认样式 */
+#define STYLE_SGR_MAX 32     /* 预编码 SGR 序列最大长度（含结尾 0） */
+
+#define CELL_UTF8_MAX 32 /* 单个单元格 UTF-8 文本的最大长度（含结尾 0） */
+#define CELL_CLUSTER_MAX_CHARS 6 /* 字符簇最多码点数，与 libvterm 一致 */
+
 /**
  * 单元格结构体
- * 存储屏幕上每个字符的信息
+ * 存储屏幕上每个字符的信息，8 字节，通过下面的内联函数访问
  */
 struct cell {
-  char ch[5];    /* UTF-8 字符 (最多4字节 + null) */
-  uint8_t width; /* 显示宽度 (1 或 2) */
-  uint8_t fg;    /* 前景色索引 (0-255) */
-  uint8_t bg;    /* 背景色索引 (0-255) */
-  uint8_t attr; /* 属性: bit0=bold, bit1=underline, bit2=italic, bit3=reverse */
-  uint8_t flags; /* 标志位: bit0=默认fg, bit1=默认bg */
+  uint32_t ch;    /* 码点或字符簇下标 + 显示宽度 */
+  uint32_t style; /* grid 样式表中的样式 id */
+};
+
+/**
+ * 样式表条目
+ * 每种不同的画笔（颜色 + 属性）对应一个条目，渲染时直接输出 sgr
+ */
+struct grid_style {
+  uint32_t pen;             /* 打包的颜色、属性和标志位 */
+  uint8_t sgr_len;          /* sgr 长度 */
+  char sgr[STYLE_SGR_MAX];  /* 预编码的 SGR 序列，以 \033[0 开头完整重置 */
+};
+
+/**
+ * 样式表
+ * 按画笔去重，只增不减，条目 0 固定为默认样式
+ */
+struct grid_styles {
+  struct grid_style *items; /* 样式条目 */
+  unsigned int count;       /* 已用条目数 */
+  unsigned int cap;         /* 条目容量 */
+  uint32_t *hash;           /* 开放寻址哈希表，存 id + 1，0 为空槽 */
+  unsigned int hash_cap;    /* 哈希表容量（2 的幂） */
+  uint32_t last_pen;        /* 最近一次查找的画笔（连续单元格通常同色） */
+  uint32_t last_id;         /* 最近一次查找的结果 */
+};
+
+/**
+ * 字符簇表
+ * 保存多码点字符簇的 UTF-8 文本，按内容去重，只增不减，
+ * 最多 MUXKIT_CLUSTER_MAX 条
+ */
+struct cell_clusters {
+  char (*text)[CELL_UTF8_MAX]; /* 字符簇文本 */
+  unsigned int count;          /* 已用条目数 */
+  unsigned int cap;            /* 条目容量 */
+  uint32_t *hash;              /* 开放寻址哈希表，存下标 + 1，0 为空槽 */
+  unsigned int hash_cap;       /* 哈希表容量（2 的幂） */
+};
+
+static inline uint32_t style_pen_pack(uint8_t fg, uint8_t bg, uint8_t attr,
+                                      uint8_t flags) {
+  return (uint32_t)fg | (uint32_t)bg << 8 | (uint32_t)attr << 16 |
+         (uint32_t)flags << 24;
+}
+
+static inline uint8_t pen_fg(uint32_t pen) { return pen; }
+static inline uint8_t pen_bg(uint32_t pen) { return pen >> 8; }
+static inline uint8_t pen_attr(uint32_t pen) { return pen >> 16; }
+static inline uint8_t pen_flags(uint32_t pen) { return pen >> 24; }
+
+/* 单码点单元格的码点，字符簇返回 0 */
+static inline uint32_t cell_codepoint(const struct cell *c) {
+  return (c->ch & CELL_CLUSTER) ? 0 : (c->ch & CELL_CP_MASK);
+}
+
+static inline int cell_is_cluster(const struct cell *c) {
+  return (c->ch & CELL_CLUSTER) != 0;
+}
+
+static inline int cell_is_empty(const struct cell *c) {
+  return (c->ch & (CELL_CLUSTER | CELL_CP_MASK)) == 0;
+}
+
+static inline unsigned int cell_width(const struct cell *c) {
+  return (c->ch & CELL_WIDTH_MASK) >> CELL_WIDTH_SHIFT;
+}
+
+/* 设置单码点字符，超出 Unicode 范围的码点按空单元格处理 */
+static inline void cell_set_char(struct cell *c, uint32_t cp,
+                                 unsigned int width) {
+  if (cp > 0x10ffff)
+    cp = 0;
+  c->ch = cp | (uint32_t)(width & 0x3) << CELL_WIDTH_SHIFT;
+}
+
+/**
+ * 历史视图的惰性折行状态
+ *
+ * 历史按写入时的宽度保存物理行，自动换行拼接出的逻辑行是唯一数据源。
+ * 改变宽度时不重排历史，只在显示或滚动经过某个逻辑行时按当前宽度折行，
+ * 代价与可见行数和滚动行数成正比，与历史总长度无关。
+ */
+struct grid_reflow {
+  struct cell *line;       /* 当前逻辑行（拼接后的单元格） */
+  size_t cap;              /* line 容量 */
+  unsigned int len;        /* 逻辑行单元格数 */
+  unsigned int nrec;       /* 逻辑行包含的历史行数 */
+  unsigned int line_back;  /* 已解码逻辑行的首行距历史末尾的行数 */
+  uint64_t line_end;       /* 解码时的历史末尾绝对行号 */
+  unsigned int back;       /* 游标所在逻辑行的首行距历史末尾的行数，0 为屏幕 */
+  unsigned int pos;        /* 游标所在折行的起始单元格（屏幕部分为屏幕行号） */
+  unsigned int y;          /* 游标对应的显示行，UINT_MAX 表示无效 */
+  unsigned int width;      /* 游标的折行宽度 */
+  uint64_t end;            /* 游标建立时的历史末尾绝对行号 */
 };
 
 /**
@@ -70,13 +187,21 @@ struct grid {
   unsigned int width;  /* 网格宽度 */
   unsigned int height; /* 网格高度 */
 
-  struct cell *history_cells; /* 历史缓冲区 (环形) */
-  unsigned int history_size;  /* 历史缓冲区大小 */
-  unsigned int history_count; /* 已保存的历史行数 */
-  unsigned int scroll_offset; /* 当前滚动偏移 */
+  struct history *history;    /* 历史行存储（变长编码） */
+  unsigned int scroll_offset; /* 视图顶部逻辑行的首行距历史末尾的行数，0 表示未滚动 */
+  unsigned int scroll_pos;    /* 视图顶部在该逻辑行中的起始单元格 */
+  struct grid_reflow reflow;  /* 惰性折行状态 */
+
+  uint8_t *line_flags; /* 每行一个标志 */
+
+  struct cell *scratch;       /* 历史行解码缓冲区 */
+  unsigned int scratch_width; /* 解码缓冲区宽度 */
+
+  uint8_t *dirty;           /* 每行一个脏标记 (libvterm damage) */
+  unsigned int dirty_count; /* 脏行数量 */
 
-  uint8_t *line_flags;         /* 每行一个标志 */
-  uint8_t *history_line_flags; /* 历史行标志 continuation = 0x01 else 0x00 */
+  struct cell_clusters clusters; /* 屏幕和历史共用的字符簇表 */
+  struct grid_styles styles;     /* 屏幕和历史共用的样式表 */
 };
 
 /**
@@ -128,6 +253,14 @@ void render_screen(struct session *s);
  */
 void render_pane(struct window_pane *p);
 
+/**
+ * @brief 增量渲染单个窗格
+ * 只输出自上次渲染以来被 libvterm 标记为脏的行，然后定位光标。
+ * 查看历史时整体重绘。
+ * @param p 窗格指针
+ */
+void render_pane_damage(struct window_pane *p);
+
 /**
  * @brief 渲染状态栏
  * 在终端底部显示窗口名称、历史标记和版本信息
@@ -145,32 +278,37 @@ void render_pane_borders(struct window_pane *w);
 /* ============ 历史管理函数 ============ */
 
 /**
- * @brief 初始化历史缓冲区
- * 分配环形缓冲区用于保存历史屏幕内容
+ * @brief 初始化历史存储
+ * 行按变长编码保存，不预先分配整行单元格
  * @param g         网格指针
  * @param max_lines 最大历史行数
+ * @param max_bytes 历史常驻内存上限（字节）
+ * @param max_disk  历史落盘上限（字节），0 表示不落盘
  */
-void grid_init_history(struct grid *g, unsigned int max_lines);
+void grid_init_history(struct grid *g, unsigned int max_lines,
+                       size_t max_bytes, size_t max_disk);
 
 /**
- * @brief 释放历史缓冲区
- * 释放历史数据并重置计数器
- * @param g 网格指针
+ * @brief 获取默认历史上限
+ * 编译时默认值为 MUXKIT_HISTORY_LINES / MUXKIT_HISTORY_BYTES /
+ * MUXKIT_HISTORY_DISK_BYTES，运行时可用同名环境变量覆盖
+ * @param max_lines 输出最大历史行数
+ * @param max_bytes 输出历史常驻内存上限（字节）
+ * @param max_disk  输出历史落盘上限（字节）
  */
-void grid_free_history(struct grid *g);
+void grid_history_limits(unsigned int *max_lines, size_t *max_bytes,
+                         size_t *max_disk);
 
 /**
- * @brief 根据新尺寸重新调整历史缓冲区布局
- * 当窗口宽度改变时，重新组织历史缓冲区中的内容
- * @param g         网格指针
- * @param new_width 新的网格宽度
- * @return 0 成功，-1 失败
+ * @brief 释放历史存储
+ * 释放历史数据并重置滚动偏移
+ * @param g 网格指针
  */
-int grid_resize_history(struct grid *g, unsigned int new_width);
+void grid_free_history(struct grid *g);
 
 /**
  * @brief 将指定行推入历史
- * 将网格中的一行复制到历史缓冲区（环形）
+ * 将网格中的一行编码后追加到历史存储
  * @param g    网格指针
  * @param line 行号
  */
@@ -178,7 +316,7 @@ void grid_push_line_to_history(struct grid *g, unsigned int line);
 
 /**
  * @brief 向上滚动 (查看历史)
- * 增加滚动偏移量以查看更早的历史内容
+ * 视图顶部按当前宽度折行后向上移动，只折行经过的逻辑行
  * @param g     网格指针
  * @param lines 滚动行数
  */
@@ -186,7 +324,7 @@ void grid_scroll_up(struct grid *g, unsigned int lines);
 
 /**
  * @brief 向下滚动 (返回当前)
- * 减少滚动偏移量以返回当前屏幕
+ * 视图顶部向下移动，越过历史末尾即回到当前屏幕
  * @param g     网格指针
  * @param lines 滚动行数
  */
@@ -194,36 +332,186 @@ void grid_scroll_down(struct grid *g, unsigned int lines);
 
 /**
  * @brief 获取显示行 (考虑滚动偏移)
- * 根据当前滚动位置返回对应的屏幕行或历史行
+ * 根据当前滚动位置返回对应的屏幕行或按当前宽度折行后的历史行。
+ * 按 y 递增顺序调用时每行 O(1)，历史行在下次调用前有效
  * @param g 网格指针
  * @param y 行号（相对于当前视图）
  * @return 单元格数组指针，超出范围返回 NULL
  */
 struct cell *grid_get_display_line(struct grid *g, unsigned int y);
 
+/* ============ 单元格字符函数 ============ */
+
+/**
+ * @brief 设置单元格字符
+ * 单个码点直接存放在单元格中，多码点字符簇存入 grid 的字符簇表。
+ * 字符簇表分配失败时退化为只保存第一个码点。
+ * @param g     网格指针
+ * @param c     单元格指针
+ * @param chars 码点数组（以 0 结尾或最多 CELL_CLUSTER_MAX_CHARS 个）
+ * @param width 显示宽度
+ */
+void grid_cell_set_chars(struct grid *g, struct cell *c, const uint32_t *chars,
+                         unsigned int width);
+
+/**
+ * @brief 获取单元格的 UTF-8 文本
+ * @param g   网格指针
+ * @param c   单元格指针
+ * @param out 输出缓冲区，至少 CELL_UTF8_MAX 字节，以 0 结尾
+ * @return 文本字节数，空单元格返回 0
+ */
+size_t grid_cell_utf8(const struct grid *g, const struct cell *c, char *out);
+
+/**
+ * @brief 释放字符簇表
+ * @param g 网格指针
+ */
+void grid_free_clusters(struct grid *g);
+
+/* ============ 样式表函数 ============ */
+
+/**
+ * @brief 获取画笔对应的样式 id，不存在时插入
+ * 分配失败时返回默认样式 GRID_STYLE_DEFAULT。
+ * @param g   网格指针
+ * @param pen 打包的画笔 (style_pen_pack)
+ * @return 样式 id
+ */
+uint32_t grid_style_intern(struct grid *g, uint32_t pen);
+
+/**
+ * @brief 获取样式条目
+ * @param g  网格指针
+ * @param id 样式 id，越界时返回默认样式
+ * @return 样式条目指针
+ */
+const struct grid_style *grid_style_get(const struct grid *g, uint32_t id);
+
+/**
+ * @brief 释放样式表
+ * @param g 网格指针
+ */
+void grid_free_styles(struct grid *g);
+
+/* ============ 脏行管理函数 ============ */
+
+/**
+ * @brief 标记脏行
+ * 标记 [start, end) 范围内的屏幕行需要重绘
+ * @param g     网格指针
+ * @param start 起始行
+ * @param end   结束行（不含）
+ */
+void grid_mark_dirty(struct grid *g, unsigned int start, unsigned int end);
+
+/**
+ * @brief 移动网格中的矩形区域
+ * 对应 libvterm moverect 回调，滚动时直接在 grid 上 memmove，
+ * 不必重新读取被移动的单元格。越界的区域会被忽略。
+ * @param g    网格指针
+ * @param dest 目标区域
+ * @param src  源区域（与 dest 尺寸相同）
+ */
+void grid_move_rect(struct grid *g, VTermRect dest, VTermRect src);
+
+/**
+ * @brief 清除所有脏行标记
+ * @param g 网格指针
+ */
+void grid_clear_dirty(struct grid *g);
+
 /* ============ 序列化函数 ============ */
 
+/*
+ * 网格快照格式
+ *
+ *   struct grid_snapshot_header
+ *   正文（GRID_SNAPSHOT_LZ 时为 lz_compress 压缩后的数据）：
+ *     uint32 pane_id, cx, cy, width, height, max_lines, stored, scroll_offset
+ *     height 条屏幕行记录（与历史记录相同的变长编码，末尾空白不保存）
+ *     uint32 历史字节数 + stored 条历史记录
+ *     uint32 字符簇数 + 以 NUL 结尾的字符簇
+ *     uint32 样式数 + 画笔
+ *
+ * 加载时校验魔数、版本、长度和 CRC32，损坏的快照整体拒绝。
+ */
+#define GRID_SNAPSHOT_MAGIC 0x5347584du /* "MXGS" */
+#define GRID_SNAPSHOT_VERSION 1
+#define GRID_SNAPSHOT_LZ 0x0001        /* 正文经过 LZ 压缩 */
+#define GRID_SNAPSHOT_MAX_DIM 10000    /* 宽高上限，防止损坏数据导致超大分配 */
+
+/**
+ * 网格快照头
+ */
+struct grid_snapshot_header {
+  uint32_t magic;    /* GRID_SNAPSHOT_MAGIC */
+  uint16_t version;  /* GRID_SNAPSHOT_VERSION */
+  uint16_t flags;    /* GRID_SNAPSHOT_LZ */
+  uint32_t raw_len;  /* 正文解压后的字节数 */
+  uint32_t body_len; /* 正文存储的字节数 */
+  uint32_t crc;      /* 存储正文的 CRC32 */
+};
+
+/**
+ * @brief 默认快照选项
+ * 编译时默认值 MUXKIT_SNAPSHOT_LZ，可用同名环境变量覆盖
+ * @return GRID_SNAPSHOT_LZ 或 0
+ */
+unsigned int grid_snapshot_flags(void);
+
 /**
  * @brief 序列化屏幕网格
  *
- * 将网格数据（包括当前屏幕和历史）打包为二进制格式。
- * 用于会话分离时保存屏幕状态到内存。
+ * 将网格数据（包括当前屏幕和历史）打包为带版本和校验的快照。
  *
  * @param g       网格指针
  * @param pane_id 窗格 ID
  * @param cx      光标 x 坐标
  * @param cy      光标 y 坐标
+ * @param flags   GRID_SNAPSHOT_LZ 表示压缩正文
  * @param out_buf 输出缓冲区指针（调用者需要 free）
  * @return 序列化数据的字节数，失败返回 0
  */
 size_t grid_serialize(struct grid *g, unsigned int pane_id, unsigned int cx,
-                      unsigned int cy, void **out_buf);
+                      unsigned int cy, unsigned int flags, void **out_buf);
+
+/**
+ * @brief 把网格快照写入匿名共享内存文件
+ *
+ * 格式与 grid_serialize 相同，但直接写入 memfd 的映射，
+ * 得到的 fd 用 send_fd 传给对端，不再经过中间缓冲区和套接字拷贝。
+ *
+ * @param g       网格指针
+ * @param pane_id 窗格 ID
+ * @param cx      光标 x 坐标
+ * @param cy      光标 y 坐标
+ * @param flags   GRID_SNAPSHOT_LZ 表示压缩正文
+ * @param len     输出：快照字节数
+ * @return 快照 fd（调用者负责 close），失败返回 -1
+ */
+int grid_snapshot_create(struct grid *g, unsigned int pane_id, unsigned int cx,
+                         unsigned int cy, unsigned int flags, size_t *len);
+
+/**
+ * @brief 从快照 fd 恢复网格
+ * 只读映射后直接反序列化，不关闭 fd
+ * @param g       网格指针
+ * @param fd      grid_snapshot_create 创建的快照 fd
+ * @param len     快照字节数
+ * @param pane_id 输出：窗格 ID
+ * @param cx      输出：光标 x 坐标
+ * @param cy      输出：光标 y 坐标
+ * @return 0 成功，-1 失败
+ */
+int grid_snapshot_restore(struct grid *g, int fd, size_t len,
+                          unsigned int *pane_id, unsigned int *cx,
+                          unsigned int *cy);
 
 /**
  * @brief 反序列化屏幕网格
  *
- * 从二进制数据恢复网格状态。
- * 用于会话附加时恢复屏幕内容和光标位置。
+ * 校验快照头和 CRC32，必要时解压，然后恢复屏幕内容和光标位置。
  *
  * @param g        网格指针
  * @param pane_id  输出：窗格 ID
@@ -30,14 +30,18 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#define MAX_CLIENTS 64 // 最大客户端连接数
 #define MAX_PANES 64
 #define MAX_MSG_PAYLOAD (1 << 20)
+#include "latency.h"
 #include "list.h"
+#include "stream.h"
 #include <stdint.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <termios.h>
+
+struct server_conn;
+
 /**
  * 启动 muxkit 服务端
  *
@@ -56,10 +60,11 @@ int server_start(void);
  * - 关联的 shell 子进程
  * - 终端属性和窗口大小
  * - 会话的分离/附加状态
+ * - 服务端终端模拟器和每个 pane 的输出流，所有附加的客户端共享
  */
 struct session {
   int id;                      // 会话唯一标识符
-  int client_fd;               // 关联的客户端连接 fd（-1 表示无客户端）
+  struct server_conn *conn;    // 拥有者连接，可输入和调整尺寸（NULL 表示已分离）
   int master_fds[MAX_PANES];   // PTY 主设备 fd 数组（每个 pane 一个）
   int pane_count;              // 当前 pane 数量
   pid_t pane_pids[MAX_PANES];  // 每个 pane 的 shell 进程 PID
@@ -74,10 +79,26 @@ struct session {
   struct environ *environ;     // 环境变量（未使用）
 
   struct list_head link; // 链表节点，用于连接到全局会话列表
-  struct window *active_window;
+  struct window *active_window; // 服务端终端模拟器窗口，pane 状态以它为准
 
-  void *grid_data[MAX_PANES];
-  ssize_t grid_data_len[MAX_PANES];
+  struct stream streams[MAX_PANES]; // 每个 pane 的输出流
+  struct list_head clients;         // 附加的连接（拥有者和观察者）
+  uint64_t throttled;               // 等拥有者跟上而暂停读取的 pane（位图）
+  int checkpoint_dirty;       // 上次检查点之后 pane 数量或尺寸有变化
+  struct latency_hist *latency[MAX_PANES]; // 拥有者上报的每个 pane 的延迟（LAT_STAGES 个一组，按需分配）
 };
 
+/**
+ * 从 fd 读满 n 字节，被信号打断时重试
+ * @return n 成功，0 遇到 EOF，-1 失败
+ */
+ssize_t read_n(int fd, void *buf, size_t n);
+
+/**
+ * 向 fd 写满 n 字节，被信号打断时重试
+ * 会阻塞，只用于文件；发给客户端的数据走连接的发送队列
+ * @return n 成功，-1 失败
+ */
+ssize_t write_n(int fd, const void *buf, size_t n);
+
 #endif /* SERVER_H */
\ No newline at end of file
@@ -0,0 +1,123 @@
+/**
+ * stream.h - muxkit pane 输出流模块
+ *
+ * 服务端是每个 pane 的 PTY 唯一的读者，读到的输出先送入服务端终端模拟器，
+ * 再追加到该 pane 的输出流，由所有附加的客户端各自按自己的进度拉取：
+ * - 环形缓冲区按记录追加，位置是只增的绝对字节偏移
+ * - 每个客户端对每个 pane 只保存一个游标，写入方从不等待读者
+ * - 缓冲区写满时从最旧的记录开始覆盖，游标落到 tail 之前的客户端
+ *   改为接收模拟器的网格快照，之后从 head 继续
+ *
+ * 记录格式：
+ *   struct stream_record，之后紧跟 len 字节数据（只有 STREAM_OUTPUT 有数据）
+ *
+ * 使用方法：
+ *   stream_init(&st, MUXKIT_STREAM_RING);
+ *   stream_append(&st, STREAM_OUTPUT, 0, 0, buf, n);
+ *   while (stream_peek(&st, pos, &rec) > 0) {
+ *     stream_data(&st, pos, &rec, out);
+ *     pos += sizeof(rec) + rec.len;
+ *   }
+ *   stream_free(&st);
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STREAM_OUTPUT 1 /* PTY 输出 */
+#define STREAM_RESIZE 2 /* pane 尺寸变化，cols/rows 为新尺寸 */
+#define STREAM_EXIT 3   /* pane 的 shell 退出，之后不再有记录 */
+
+/**
+ * 记录头
+ */
+struct stream_record {
+  uint32_t len;  /* 数据字节数 */
+  uint16_t type; /* 记录类型 */
+  uint16_t cols; /* STREAM_RESIZE 的新尺寸 */
+  uint16_t rows;
+  uint16_t pad;
+};
+
+/**
+ * 输出流
+ */
+struct stream {
+  char *buf;     /* 环形缓冲区，NULL 表示未启用 */
+  size_t cap;    /* 容量（2 的幂） */
+  uint64_t head; /* 下一条记录的绝对偏移 */
+  uint64_t tail; /* 最旧一条完整记录的绝对偏移 */
+};
+
+/**
+ * @brief 初始化输出流
+ * @param s   输出流指针
+ * @param cap 缓冲区容量，向上取整到 2 的幂
+ * @return 0 成功，-1 失败
+ */
+int stream_init(struct stream *s, size_t cap);
+
+/**
+ * @brief 释放输出流
+ * @param s 输出流指针
+ */
+void stream_free(struct stream *s);
+
+/**
+ * @brief 追加一条记录，必要时丢弃最旧的记录
+ * @param s    输出流指针
+ * @param type 记录类型
+ * @param cols STREAM_RESIZE 的新宽度
+ * @param rows STREAM_RESIZE 的新高度
+ * @param data 数据，可为 NULL
+ * @param len  数据字节数，记录总长不能超过容量的一半
+ * @return 0 成功，-1 失败
+ */
+int stream_append(struct stream *s, uint16_t type, uint16_t cols,
+                  uint16_t rows, const void *data, uint32_t len);
+
+/**
+ * @brief 读取 pos 处的记录头
+ * @param s   输出流指针
+ * @param pos 绝对偏移
+ * @param rec 输出记录头
+ * @return 1 读到记录，0 已到 head，-1 记录已被覆盖
+ */
+int stream_peek(const struct stream *s, uint64_t pos,
+                struct stream_record *rec);
+
+/**
+ * @brief 复制 pos 处记录的数据
+ * @param s   输出流指针
+ * @param pos 绝对偏移，stream_peek 返回 1 的位置
+ * @param rec stream_peek 读到的记录头
+ * @param out 输出缓冲区，至少 rec->len 字节
+ */
+void stream_data(const struct stream *s, uint64_t pos,
+                 const struct stream_record *rec, void *out);
+
+#endif /* STREAM_H */
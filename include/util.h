@@ -6,6 +6,7 @@
  * - checkshell: 检查 shell 可执行性
  * - client_check_nested: 检查是否在 muxkit/tmux 中嵌套运行
  * - send_fd/recv_fd: Unix 域套接字传递文件描述符
+ * - runtime_tmpfile/shm_create: 运行时目录临时文件和匿名共享内存
  *
  * MIT License
  * Copyright (c) 2024 LatosProject
@@ -32,6 +33,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/socket.h>
 
@@ -68,11 +70,12 @@ int client_check_nested(void);
 /**
  * 通过 Unix 域套接字发送文件描述符
  * 使用 SCM_RIGHTS 辅助消息
- * @param sock 套接字
- * @param fd   要发送的文件描述符
- * @return 0 成功，-1 失败
+ * @param sock  套接字
+ * @param fd    要发送的文件描述符
+ * @param flags 传给 sendmsg 的标志（如 MSG_DONTWAIT）
+ * @return 0 成功，-1 失败（errno 保留）
  */
-int send_fd(int sock, int fd);
+int send_fd(int sock, int fd, int flags);
 
 /**
  * 通过 Unix 域套接字接收文件描述符
@@ -81,6 +84,23 @@ int send_fd(int sock, int fd);
  */
 int recv_fd(int sock);
 
+/**
+ * 在运行时目录（套接字所在目录）创建临时文件
+ * 创建后立即 unlink，进程退出或 close 后自动回收
+ * @param prefix 文件名前缀
+ * @return 文件描述符（FD_CLOEXEC），失败返回 -1
+ */
+int runtime_tmpfile(const char *prefix);
+
+/**
+ * 创建指定大小的匿名共享内存文件，可用 send_fd 传给其他进程后 mmap
+ * 优先使用 memfd_create，不支持时退化为 runtime_tmpfile
+ * @param name 名称（仅用于调试）
+ * @param len  文件大小
+ * @return 文件描述符（FD_CLOEXEC），失败返回 -1
+ */
+int shm_create(const char *name, size_t len);
+
 /**
  * @brief Unicode codepoint 转 UTF-8 编码
  *
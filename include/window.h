@@ -36,6 +36,7 @@
 #define WINDOW_H
 
 #include "list.h"
+#include "reactor.h"
 #include "vterm.h"
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -55,8 +56,11 @@ struct window {
   unsigned int active_point;    /* 活动点 */
   int flags;                    /* 标志位 */
   unsigned int next_pane_id;    /* 下一个 pane 的 ID */
+  void *data;                   /* 使用者附加数据（服务端指向所属 session） */
 };
 
+#define WINDOW_CHANGED 0x01 /* 标志：内容在上次检查点之后有变化 */
+
 /**
  * 窗格结构体
  * 每个窗格对应一个 PTY 和终端模拟器
@@ -85,8 +89,19 @@ struct window_pane {
   /* libvterm 终端模拟器 */
   VTerm *vt;                    /* vterm 实例 */
   VTermScreen *vts;             /* vterm 屏幕 */
+
+  struct reactor_handler handler; /* master_fd 的事件循环注册项 */
+
+  /* 尚未写进 PTY 的输入 */
+  char *in_buf;                 /* 待写数据 */
+  size_t in_len;                /* 待写字节数 */
+  size_t in_cap;                /* in_buf 容量 */
+  /* 输入开始积压时调用，由所有者关注 master_fd 可写后调用 pane_flush_input */
+  void (*input_blocked)(struct window_pane *p);
 };
 
+#define PANE_NO_REPLY 0x01 /* 标志：终端应答不写回 PTY（由附加的客户端应答） */
+
 /* ============ 窗口函数 ============ */
 
 /**
@@ -163,4 +178,28 @@ void pane_resize(struct window_pane *p, unsigned int sx, unsigned int sy);
  */
 void pane_set_master_fd(struct window_pane *p, int fd);
 
+/**
+ * @brief 向窗格的 PTY 写入数据
+ *
+ * master_fd 是非阻塞的，内核缓冲区满时写不下的部分追加到 in_buf，
+ * 积压从无到有时调用 input_blocked，从不等待。已有积压时新数据排在后面，
+ * 保证顺序。
+ *
+ * @param p    窗格指针
+ * @param data 数据
+ * @param len  数据长度
+ * @return 0 成功（含排队），-1 写入出错或积压超过 MUXKIT_PANE_INPUT_MAX
+ */
+int pane_write(struct window_pane *p, const char *data, size_t len);
+
+/**
+ * @brief 把积压的输入写进 PTY
+ *
+ * master_fd 可写时调用，写到 EAGAIN 或写完为止。
+ *
+ * @param p 窗格指针
+ * @return 剩余的积压字节数，出错时丢弃积压并返回 -1
+ */
+ssize_t pane_flush_input(struct window_pane *p);
+
 #endif /* WINDOW_H */
\ No newline at end of file
@@ -0,0 +1,744 @@
+/**
+ * bench.c - muxkit 终端模拟吞吐基准
+ *
+ * 不启动服务端和 PTY，直接把字节流喂给一个无头窗格：
+ *   pane_input (vterm_input_write + 损坏区域同步到 grid)
+ *   -> render_pane_damage / render_pane -> 帧缓冲区 -> /dev/null
+ * 每累计 frame_bytes 字节输入渲染一帧，模拟客户端满负荷输出时的节奏。
+ *
+ * 内置负载（确定性生成，每次运行字节完全相同）：
+ *   ascii  - 长行纯 ASCII，按列宽折行
+ *   sgr    - 类似 ls --color 的短彩色文件名
+ *   cjk    - 中日韩宽字符混排
+ *   tui    - 全屏 TUI 重绘：光标定位、256 色、框线字符、反显状态栏
+ *   scroll - 带时间戳的短日志行，几乎每行都滚动进历史
+ * -f 可以改为喂原始字节流（例如 script 记录的输出）。
+ * -N 只调用 pane_input 不渲染，单独测终端解析的吞吐。
+ *
+ * -p 回放 MUXKIT_RECORD 录制的会话（见 record.h）：按录制时的 pane 和尺寸
+ * 重建窗格，同一帧间隔内的输出合成一帧；默认最快速度，-P 按原速。
+ * -x 把录制导出为 asciicast v2。
+ *
+ * 结果每个负载一行 JSON，便于脚本比较不同版本：
+ *   mb_per_s / ns_per_byte  输入吞吐
+ *   allocs                  计时区间内 malloc/calloc/realloc 次数（Linux）
+ *   out_per_in              每字节输入产生的渲染输出字节数
+ *   frame_p50_us ...        每帧延迟的百分位
+ * 多次迭代时取最快的一次。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include "client.h"
+#include "frame.h"
+#include "input.h"
+#include "log.h"
+#include "main.h"
+#include "record.h"
+#include "render.h"
+#include "window.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// 渲染和日志模块引用的全局变量，基准不写日志文件，也没有客户端状态
+struct client client;
+char *socket_path;
+
+/* ============ 分配计数 ============ */
+
+static unsigned long bench_allocs;
+
+#ifdef BENCH_COUNT_ALLOCS
+// 链接时用 --wrap 截获，只计数不改变行为
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t nmemb, size_t n);
+void *__real_realloc(void *p, size_t n);
+
+void *__wrap_malloc(size_t n) {
+  bench_allocs++;
+  return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t n) {
+  bench_allocs++;
+  return __real_calloc(nmemb, n);
+}
+
+void *__wrap_realloc(void *p, size_t n) {
+  bench_allocs++;
+  return __real_realloc(p, n);
+}
+#endif
+
+/* ============ 负载生成 ============ */
+
+/*
+  输入缓冲区
+*/
+struct bench_buf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+static void buf_append(struct bench_buf *b, const char *s, size_t n) {
+  if (b->len + n > b->cap) {
+    size_t cap = b->cap ? b->cap : MUXKIT_BUF_XLARGE;
+    while (cap < b->len + n)
+      cap *= 2;
+    char *data = realloc(b->data, cap);
+    if (!data) {
+      perror("realloc");
+      exit(1);
+    }
+    b->data = data;
+    b->cap = cap;
+  }
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+}
+
+static void buf_printf(struct bench_buf *b, const char *fmt, ...) {
+  char tmp[MUXKIT_BUF_LARGE];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  va_end(ap);
+  if (n > 0)
+    buf_append(b, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+static void buf_utf8(struct bench_buf *b, uint32_t cp) {
+  char tmp[4];
+  size_t n;
+  if (cp < 0x80) {
+    tmp[0] = (char)cp;
+    n = 1;
+  } else if (cp < 0x800) {
+    tmp[0] = (char)(0xc0 | (cp >> 6));
+    tmp[1] = (char)(0x80 | (cp & 0x3f));
+    n = 2;
+  } else {
+    tmp[0] = (char)(0xe0 | (cp >> 12));
+    tmp[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    tmp[2] = (char)(0x80 | (cp & 0x3f));
+    n = 3;
+  }
+  buf_append(b, tmp, n);
+}
+
+/*
+  固定种子的线性同余发生器，保证负载可重复
+*/
+static uint32_t rng_state;
+
+static uint32_t rng(void) {
+  rng_state = rng_state * 1103515245u + 12345u;
+  return rng_state >> 8;
+}
+
+static void gen_ascii(struct bench_buf *b, size_t size) {
+  static const char chars[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,;:-_";
+  while (b->len < size) {
+    char line[MUXKIT_BUF_MEDIUM];
+    size_t n = 40 + rng() % 160;
+    for (size_t i = 0; i < n; i++)
+      line[i] = chars[rng() % (sizeof(chars) - 1)];
+    buf_append(b, line, n);
+    buf_append(b, "\r\n", 2);
+  }
+}
+
+static void gen_sgr(struct bench_buf *b, size_t size) {
+  static const char *colors[] = {"01;34", "01;32", "01;36", "40;33;01",
+                                 "01;35", "00",    "01;31", "30;42"};
+  static const char *exts[] = {"", ".c", ".h", ".txt", ".tar.gz", ".md"};
+  while (b->len < size) {
+    for (int col = 0; col < 4; col++) {
+      const char *color = colors[rng() % 8];
+      buf_printf(b, "\033[0m\033[%sm", color);
+      size_t n = 4 + rng() % 10;
+      for (size_t i = 0; i < n; i++)
+        buf_utf8(b, 'a' + rng() % 26);
+      buf_printf(b, "%s\033[0m", exts[rng() % 6]);
+      buf_append(b, "    ", 2 + rng() % 3);
+    }
+    buf_append(b, "\r\n", 2);
+  }
+}
+
+static void gen_cjk(struct bench_buf *b, size_t size) {
+  while (b->len < size) {
+    size_t n = 10 + rng() % 50;
+    for (size_t i = 0; i < n; i++) {
+      uint32_t r = rng() % 8;
+      if (r < 5)
+        buf_utf8(b, 0x4e00 + rng() % 0x51a6); // CJK 统一汉字
+      else if (r < 6)
+        buf_utf8(b, 0x3041 + rng() % 0x56); // 平假名
+      else if (r < 7)
+        buf_utf8(b, 0xff01 + rng() % 0x5e); // 全角标点
+      else
+        buf_utf8(b, 'a' + rng() % 26);
+    }
+    buf_append(b, "\r\n", 2);
+  }
+}
+
+static void gen_tui(struct bench_buf *b, size_t size, unsigned int cols,
+                    unsigned int rows) {
+  while (b->len < size) {
+    // 整屏重绘：清屏、框线、每行不同的 256 色内容、反显状态栏
+    buf_append(b, "\033[H\033[2J", 7);
+    buf_printf(b, "\033[1;1H\033[38;5;%um", 16 + rng() % 216);
+    buf_utf8(b, 0x250c);
+    for (unsigned int x = 2; x < cols; x++)
+      buf_utf8(b, 0x2500);
+    buf_utf8(b, 0x2510);
+    for (unsigned int y = 2; y < rows; y++) {
+      buf_printf(b, "\033[%u;1H\033[38;5;%um", y, 16 + rng() % 216);
+      buf_utf8(b, 0x2502);
+      buf_printf(b, "\033[48;5;%u;38;5;%um", 232 + rng() % 24,
+                 16 + rng() % 216);
+      for (unsigned int x = 2; x < cols; x++)
+        buf_utf8(b, 'a' + rng() % 26);
+      buf_append(b, "\033[0m", 4);
+      buf_utf8(b, 0x2502);
+    }
+    buf_printf(b, "\033[%u;1H\033[7m", rows);
+    for (unsigned int x = 0; x < cols; x++)
+      buf_utf8(b, x % 10 ? ' ' : '0' + (x / 10) % 10);
+    buf_append(b, "\033[0m", 4);
+
+    // 随后几帧只更新零星单元格，像 top 刷新数字
+    for (int frame = 0; frame < 8; frame++) {
+      for (int i = 0; i < 20; i++)
+        buf_printf(b, "\033[%u;%uH\033[1;3%um%5u\033[0m", 2 + rng() % (rows - 2),
+                   2 + rng() % (cols - 8), rng() % 8, rng() % 100000);
+    }
+  }
+}
+
+static void gen_scroll(struct bench_buf *b, size_t size) {
+  static const char *levels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+  unsigned long ms = 0;
+  while (b->len < size) {
+    ms += rng() % 50;
+    buf_printf(b, "2026-01-01 %02lu:%02lu:%02lu.%03lu %-5s [worker-%u] "
+               "request %08x done in %ums\r\n",
+               ms / 3600000 % 24, ms / 60000 % 60, ms / 1000 % 60, ms % 1000,
+               levels[rng() % 4], rng() % 16, rng(), rng() % 1000);
+  }
+}
+
+static int gen_file(struct bench_buf *b, const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+  char tmp[MUXKIT_BUF_XLARGE];
+  size_t n;
+  while ((n = fread(tmp, 1, sizeof(tmp), fp)) > 0)
+    buf_append(b, tmp, n);
+  fclose(fp);
+  return b->len > 0 ? 0 : -1;
+}
+
+/* ============ 计时 ============ */
+
+struct bench_opts {
+  size_t size;           /* 每个负载的输入字节数 */
+  int iterations;        /* 迭代次数，取最快 */
+  unsigned int cols;     /* 窗格宽度 */
+  unsigned int rows;     /* 窗格高度 */
+  size_t read_bytes;     /* 每次 pane_input 的字节数，模拟一次 read */
+  size_t frame_bytes;    /* 每帧输入字节数 */
+  int full;              /* 每帧整体重绘而不是只画脏行 */
+  int parse_only;        /* 只解析不渲染 */
+  int realtime;          /* 回放按录制时的节奏，而不是最快速度 */
+};
+
+struct bench_result {
+  double seconds;
+  unsigned long allocs;
+  unsigned long long out_bytes;
+  unsigned long frames;
+  double *lat;   /* 每帧延迟（秒） */
+  size_t nlat;
+  size_t lat_cap;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void lat_push(struct bench_result *r, double secs) {
+  if (r->nlat == r->lat_cap) {
+    size_t cap = r->lat_cap ? r->lat_cap * 2 : MUXKIT_BUF_XLARGE;
+    double *lat = realloc(r->lat, cap * sizeof(*lat));
+    if (!lat)
+      return;
+    r->lat = lat;
+    r->lat_cap = cap;
+  }
+  r->lat[r->nlat++] = secs;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+  第 pct 百分位的帧延迟（微秒），lat 须已排序
+*/
+static double lat_percentile(const struct bench_result *r, double pct) {
+  if (r->nlat == 0)
+    return 0;
+  size_t i = (size_t)(pct / 100 * (r->nlat - 1) + 0.5);
+  return r->lat[i] * 1e6;
+}
+
+/*
+  输出一帧：脏行或整体重绘后写到 sink
+*/
+static void bench_render(const struct bench_opts *o, struct window_pane *p) {
+  if (o->parse_only)
+    return;
+  if (o->full)
+    render_pane(p);
+  else
+    render_pane_damage(p);
+}
+
+/*
+  销毁窗口和其中所有窗格
+*/
+static void bench_free_window(struct window *w) {
+  struct window_pane *p, *tmp;
+  list_for_each_entry_safe(p, tmp, &w->panes, link) {
+    list_del(&p->link);
+    pane_destroy(p);
+  }
+  window_destroy(w);
+}
+
+/*
+  跑一次：新建窗格（不计时），喂完整个输入。
+  帧延迟是一帧的输入解析加渲染的耗时
+*/
+static int bench_once(const struct bench_opts *o, const struct bench_buf *in,
+                      int sink, struct bench_result *r) {
+  struct window *w = window_create("bench");
+  if (!w)
+    return -1;
+  struct window_pane *p = pane_create(w, o->cols, o->rows, 0, 0);
+  if (!p) {
+    window_destroy(w);
+    return -1;
+  }
+  p->flags |= PANE_NO_REPLY;
+
+  struct frame f;
+  frame_init(&f, sink);
+  struct frame *prev = frame_set_current(&f);
+
+  unsigned long allocs = bench_allocs;
+  double start = now_seconds();
+  double frame_start = start;
+  size_t pending = 0;
+  for (size_t off = 0; off < in->len;) {
+    size_t n = in->len - off < o->read_bytes ? in->len - off : o->read_bytes;
+    pane_input(p, in->data + off, n);
+    off += n;
+    pending += n;
+    if (pending >= o->frame_bytes || off == in->len) {
+      bench_render(o, p);
+      frame_flush(&f);
+      pending = 0;
+      double end = now_seconds();
+      lat_push(r, end - frame_start);
+      frame_start = end;
+    }
+  }
+  r->seconds = now_seconds() - start;
+  r->allocs = bench_allocs - allocs;
+  r->out_bytes = f.stats.total_bytes;
+  r->frames = f.stats.frames;
+
+  frame_set_current(prev);
+  frame_free(&f);
+  bench_free_window(w);
+  return 0;
+}
+
+/*
+  回放录制中的一条记录，REC_OUTPUT 返回所属窗格
+*/
+static struct window_pane *replay_apply(struct window *w,
+                                        struct window_pane **panes,
+                                        const struct rec_event *ev) {
+  if (ev->pane_id >= REC_MAX_PANES)
+    return NULL;
+  struct window_pane *p = panes[ev->pane_id];
+  switch (ev->type) {
+  case REC_SIZE:
+    if (!p) {
+      p = pane_create(w, ev->cols, ev->rows, 0, 0);
+      if (p)
+        p->flags |= PANE_NO_REPLY;
+      panes[ev->pane_id] = p;
+    } else if (p->sx != ev->cols || p->sy != ev->rows) {
+      pane_resize(p, ev->cols, ev->rows);
+    }
+    return NULL;
+  case REC_OUTPUT:
+    if (p)
+      pane_input(p, ev->data, ev->len);
+    return p;
+  case REC_EXIT:
+    if (p) {
+      list_del(&p->link);
+      pane_destroy(p);
+      panes[ev->pane_id] = NULL;
+    }
+    return NULL;
+  }
+  return NULL;
+}
+
+/*
+  回放一次录制。录制时间落在同一个帧间隔内的记录合成一帧，
+  只渲染这一帧里有输出的窗格，与客户端按帧率合并输出一致。
+  最快速度时帧延迟是这一帧的处理耗时；
+  按原速时先等到记录的时间点，帧延迟从这一帧最后一段输出“到达”算到写完
+*/
+static int bench_replay_once(const struct bench_opts *o, struct replay *rp,
+                             int sink, struct bench_result *r) {
+  struct window *w = window_create("replay");
+  if (!w)
+    return -1;
+  struct window_pane *panes[REC_MAX_PANES] = {0};
+  int touched[REC_MAX_PANES];
+  uint64_t frame_us = 1000000 / MUXKIT_FRAME_RATE;
+
+  struct frame f;
+  frame_init(&f, sink);
+  struct frame *prev = frame_set_current(&f);
+
+  unsigned long allocs = bench_allocs;
+  double start = now_seconds();
+  struct rec_event ev;
+  replay_rewind(rp);
+  int ret = replay_next(rp, &ev);
+  while (ret > 0) {
+    uint64_t frame_end = ev.time_us + frame_us;
+    double frame_start = now_seconds();
+    double due = frame_start;
+    memset(touched, 0, sizeof(touched));
+    do {
+      if (o->realtime) {
+        due = start + ev.time_us / 1e6;
+        double wait = due - now_seconds();
+        if (wait > 0) {
+          struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+          nanosleep(&ts, NULL);
+        }
+      }
+      if (replay_apply(w, panes, &ev))
+        touched[ev.pane_id] = 1;
+    } while ((ret = replay_next(rp, &ev)) > 0 && ev.time_us < frame_end);
+
+    int rendered = 0;
+    for (int i = 0; i < REC_MAX_PANES; i++) {
+      if (touched[i] && panes[i]) {
+        bench_render(o, panes[i]);
+        rendered = 1;
+      }
+    }
+    if (rendered) {
+      frame_flush(&f);
+      lat_push(r, now_seconds() - (o->realtime ? due : frame_start));
+    }
+  }
+  r->seconds = now_seconds() - start;
+  r->allocs = bench_allocs - allocs;
+  r->out_bytes = f.stats.total_bytes;
+  r->frames = f.stats.frames;
+
+  frame_set_current(prev);
+  frame_free(&f);
+  bench_free_window(w);
+  return ret < 0 ? -1 : 0;
+}
+
+/*
+  每个负载一行 JSON
+*/
+static void bench_report(const char *name, size_t bytes,
+                         const struct bench_opts *o, struct bench_result *best) {
+  double secs = best->seconds > 0 ? best->seconds : 1e-9;
+  qsort(best->lat, best->nlat, sizeof(double), cmp_double);
+  printf("{\"workload\":\"%s\",\"bytes\":%zu,\"cols\":%u,\"rows\":%u,"
+         "\"render\":\"%s\",\"pacing\":\"%s\",\"iterations\":%d,"
+         "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"ns_per_byte\":%.3f,"
+         "\"allocs\":%lu,\"frames\":%lu,\"out_bytes\":%llu,"
+         "\"out_per_in\":%.4f,\"frame_p50_us\":%.1f,\"frame_p90_us\":%.1f,"
+         "\"frame_p99_us\":%.1f,\"frame_max_us\":%.1f}\n",
+         name, bytes, o->cols, o->rows,
+         o->parse_only ? "none" : o->full ? "full" : "damage",
+         o->realtime ? "realtime" : "max", o->iterations, secs,
+         bytes / secs / 1e6, secs * 1e9 / bytes, best->allocs, best->frames,
+         best->out_bytes, (double)best->out_bytes / bytes,
+         lat_percentile(best, 50), lat_percentile(best, 90),
+         lat_percentile(best, 99), lat_percentile(best, 100));
+  fflush(stdout);
+}
+
+/*
+  跑 iterations 次，报告最快的一次。in 为 NULL 时回放 rp
+*/
+static int bench_run(const char *name, const struct bench_opts *o,
+                     const struct bench_buf *in, struct replay *rp,
+                     size_t bytes, int sink) {
+  struct bench_result best = {0};
+  for (int i = 0; i < o->iterations; i++) {
+    struct bench_result r = {0};
+    int ret = in ? bench_once(o, in, sink, &r)
+                 : bench_replay_once(o, rp, sink, &r);
+    if (ret < 0) {
+      fprintf(stderr, "%s: run failed\n", name);
+      free(r.lat);
+      free(best.lat);
+      return -1;
+    }
+    if (i == 0 || r.seconds < best.seconds) {
+      free(best.lat);
+      best = r;
+    } else {
+      free(r.lat);
+    }
+  }
+  bench_report(name, bytes, o, &best);
+  free(best.lat);
+  return 0;
+}
+
+/* ============ 入口 ============ */
+
+static const char *workloads[] = {"ascii", "sgr", "cjk", "tui", "scroll"};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-w ascii,sgr,cjk,tui,scroll] [-f file] [-s MiB]\n"
+          "          [-i iterations] [-c cols] [-r rows] [-b frame-bytes] "
+          "[-F] [-N]\n"
+          "       %s -p recording [-P] [-i iterations] [-F]\n"
+          "       %s -p recording -x out.cast [-n pane]\n"
+          "  -w  workloads to run (default: all)\n"
+          "  -f  replay a raw byte stream (e.g. a script typescript)\n"
+          "  -s  input size per workload in MiB (default 16)\n"
+          "  -i  iterations, the fastest is reported (default 3)\n"
+          "  -c  pane columns (default 80)\n"
+          "  -r  pane rows (default 24)\n"
+          "  -b  input bytes per rendered frame (default %d)\n"
+          "  -F  redraw the whole pane every frame\n"
+          "  -N  parse only, skip rendering\n"
+          "  -p  replay a MUXKIT_RECORD recording\n"
+          "  -P  pace the replay as recorded instead of at full speed\n"
+          "  -x  export the recording as asciicast v2\n"
+          "  -n  pane to export (default: the first one recorded)\n",
+          prog, prog, prog, MUXKIT_STREAM_CHUNK);
+}
+
+static void generate(const char *name, const struct bench_opts *o,
+                     struct bench_buf *b) {
+  rng_state = 1;
+  b->len = 0;
+  if (strcmp(name, "ascii") == 0)
+    gen_ascii(b, o->size);
+  else if (strcmp(name, "sgr") == 0)
+    gen_sgr(b, o->size);
+  else if (strcmp(name, "cjk") == 0)
+    gen_cjk(b, o->size);
+  else if (strcmp(name, "tui") == 0)
+    gen_tui(b, o->size, o->cols, o->rows);
+  else
+    gen_scroll(b, o->size);
+}
+
+/*
+  回放或导出录制
+*/
+static int bench_recording(const char *path, const char *export_path,
+                           int pane_id, const struct bench_opts *o, int sink) {
+  struct replay rp;
+  if (replay_open(&rp, path) < 0) {
+    fprintf(stderr, "%s: cannot open recording\n", path);
+    return -1;
+  }
+
+  // 统计输出总量，默认导出第一个出现的窗格，报告中的尺寸也取它的
+  struct bench_opts ro = *o;
+  struct rec_event ev;
+  size_t bytes = 0;
+  int ret;
+  while ((ret = replay_next(&rp, &ev)) > 0) {
+    if (ev.type == REC_OUTPUT) {
+      bytes += ev.len;
+    } else if (ev.type == REC_SIZE && pane_id < 0) {
+      pane_id = (int)ev.pane_id;
+      ro.cols = ev.cols;
+      ro.rows = ev.rows;
+    }
+  }
+
+  if (ret < 0 || bytes == 0) {
+    fprintf(stderr, "%s: %s\n", path, ret < 0 ? "corrupt" : "no output");
+    ret = -1;
+  } else if (export_path) {
+    ret = replay_export_asciicast(&rp, export_path, (unsigned int)pane_id);
+    if (ret < 0)
+      fprintf(stderr, "%s: export failed\n", export_path);
+  } else {
+    const char *base = strrchr(path, '/');
+    char name[MUXKIT_BUF_MEDIUM];
+    snprintf(name, sizeof(name), "replay:%s", base ? base + 1 : path);
+    ret = bench_run(name, &ro, NULL, &rp, bytes, sink);
+  }
+  replay_close(&rp);
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  struct bench_opts o = {
+      .size = 16u << 20,
+      .iterations = 3,
+      .cols = 80,
+      .rows = 24,
+      .read_bytes = MUXKIT_BUF_XLARGE,
+      .frame_bytes = MUXKIT_STREAM_CHUNK,
+  };
+  const char *file = NULL;
+  const char *recording = NULL;
+  const char *export_path = NULL;
+  int pane_id = -1;
+  char *selected = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:f:s:i:c:r:b:FNp:Px:n:h")) != -1) {
+    switch (opt) {
+    case 'w':
+      selected = optarg;
+      break;
+    case 'f':
+      file = optarg;
+      break;
+    case 's':
+      o.size = (size_t)strtoul(optarg, NULL, 10) << 20;
+      break;
+    case 'i':
+      o.iterations = atoi(optarg);
+      break;
+    case 'c':
+      o.cols = (unsigned int)strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      o.rows = (unsigned int)strtoul(optarg, NULL, 10);
+      break;
+    case 'b':
+      o.frame_bytes = strtoul(optarg, NULL, 10);
+      break;
+    case 'F':
+      o.full = 1;
+      break;
+    case 'N':
+      o.parse_only = 1;
+      break;
+    case 'p':
+      recording = optarg;
+      break;
+    case 'P':
+      o.realtime = 1;
+      break;
+    case 'x':
+      export_path = optarg;
+      break;
+    case 'n':
+      pane_id = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (o.size == 0 || o.iterations < 1 || o.cols < 10 || o.rows < 3 ||
+      o.frame_bytes == 0 || (export_path && !recording)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Debug 构建的逐帧日志会拖慢计时
+  log_set_level(LOG_WARN);
+
+  int sink = open("/dev/null", O_WRONLY);
+  if (sink == -1) {
+    perror("/dev/null");
+    return 1;
+  }
+
+  struct bench_buf in = {0};
+  int ret = 0;
+  if (recording) {
+    if (bench_recording(recording, export_path, pane_id, &o, sink) < 0)
+      ret = 1;
+  } else if (file) {
+    const char *base = strrchr(file, '/');
+    char name[MUXKIT_BUF_MEDIUM];
+    snprintf(name, sizeof(name), "file:%s", base ? base + 1 : file);
+    if (gen_file(&in, file) < 0 ||
+        bench_run(name, &o, &in, NULL, in.len, sink) < 0)
+      ret = 1;
+  } else {
+    for (size_t i = 0; i < NWORKLOADS; i++) {
+      if (selected && !strstr(selected, workloads[i]))
+        continue;
+      generate(workloads[i], &o, &in);
+      if (bench_run(workloads[i], &o, &in, NULL, in.len, sink) < 0)
+        ret = 1;
+    }
+  }
+  free(in.data);
+  close(sink);
+  return ret;
+}
@@ -35,17 +35,21 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include "list.h"
 #include "muxkit-protocol.h"
 #include "render.h"
 #include "window.h"
-#define _GNU_SOURCE
 #include "client.h"
+#include "bufpool.h"
+#include "frame.h"
 #include "i18n.h"
 #include "input.h"
 #include "keyboard.h"
+#include "latency.h"
 #include "log.h"
 #include "main.h"
+#include "record.h"
 #include "server.h"
 #include "util.h"
 #include <arpa/inet.h>
@@ -63,6 +67,7 @@
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 int server_fd;
 extern char *socket_path;
@@ -84,6 +89,10 @@ static const state_transition table[] = {
 
 #define NTRANS (sizeof(table) / sizeof(table[0]))
 
+/* 外层终端的 bracketed paste 标记 */
+#define PASTE_START "\033[200~"
+#define PASTE_END "\033[201~"
+
 void dispatch_event(struct client *c, client_event ev) {
   for (size_t i = 0; i < NTRANS; i++) {
     if (table[i].state == c->state && table[i].event == ev) {
@@ -164,86 +173,26 @@ static int client_connect(const char *path) {
 }
 
 int send_server(enum msgtype type, int fd, const void *buf, size_t len) {
-  struct msg_header hdr = {type, len};
-  ssize_t n;
-  const char *ph = (const char *)&hdr;
-  // 发送消息头
-  size_t sent = 0;
-  while (sent < sizeof(hdr)) {
-    ssize_t n = write(fd, ph + sent, sizeof(hdr) - sent);
-    if (n == -1) {
-      if (errno == EINTR)
-        continue; // 被信号打断，重试
-      return -1;
-    }
-    sent += n;
-  }
-
-  // 发送数据
-  const char *p = buf;
-  sent = 0;
-  while (sent < len) {
-    ssize_t n = write(fd, p + sent, len - sent);
-    if (n == -1) {
-      if (errno == EINTR)
-        continue; // 被信号打断，重试
-      return -1;
-    }
-    sent += n;
-  }
-  return 0;
+  // 消息头和负载一次 writev
+  struct msg_out m = {type, buf, len};
+  return msg_send(fd, &m, 1);
 }
 
+/*
+  终端尺寸稳定后只记下新尺寸，布局和重绘由主循环的 client_relayout 完成，
+  观察者同样重新排列
+*/
 void act_resize(struct client *c, client_event ev) {
-  // 设置终端尺寸
-  if (ioctl(STDIN_FILENO, TIOCGWINSZ, &(c->ws)) == -1) {
+  if (ioctl(STDIN_FILENO, TIOCGWINSZ, &(c->ws)) == -1)
     return;
-  }
-  struct winsize ws_pane = c->ws;
-  ws_pane.ws_row -= 1;
-
-  unsigned int new_height = c->ws.ws_row - 1; // 留一行给状态栏
-  unsigned int new_width = c->ws.ws_col;
-
-  // 遍历所有 pane，计算新尺寸
-  struct window_pane *p;
-  int pane_count = 0;
-  list_for_each_entry(p, &c->pane->window->panes, link) { pane_count++; }
-  unsigned int pane_width = (new_width - pane_count + 1) / pane_count;
-  unsigned int x_offset = 0;
-
-  // 调整 pane 结构大小，并通知每个 PTY 正确的尺寸
-  list_for_each_entry(p, &c->pane->window->panes, link) {
-    pane_resize(p, pane_width, new_height);
-    p->xoff = x_offset;
-    x_offset += pane_width + 1;
-
-    // 通知 PTY 这个 pane 的实际尺寸
-    struct winsize ws = {.ws_row = new_height, .ws_col = pane_width};
-    ioctl(p->master_fd, TIOCSWINSZ, &ws);
-  }
-
-  // 清屏并移动光标到左上角
-  write(STDOUT_FILENO, "\033[2J\033[H", 7);
-
-  // 重新渲染所有 pane 和边框
-  list_for_each_entry(p, &c->pane->window->panes, link) {
-    render_pane(p);
-    if (p->link.next != &c->pane->window->panes) {
-      render_pane_borders(p);
-    }
-  }
-  render_status_bar(c);
-
-  // 通知 server 保存整体尺寸（但 server 不再给 PTY 发 TIOCSWINSZ）
-  send_server(MSG_RESIZE, c->server_fd, &ws_pane, sizeof(ws_pane));
-  return;
+  c->layout_pending = 1;
 }
 
 void act_child_exit(struct client *c, client_event ev) {
   c->child_exited = 1;
   // 切换回主屏幕缓冲区
-  write(STDOUT_FILENO, "\033[?1049l", 8);
+  frame_append(frame_current(), "\033[?2004l\033[?1049l", 16);
+  frame_flush(frame_current());
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &(c->orig_termios));
 }
 
@@ -265,69 +214,197 @@ void act_pty_read(struct client *c, client_event ev) {
   }
   pane_input(c->pane, buff, n);
   render_status_bar(c);
-  render_pane(c->pane);
+  render_pane_damage(c->pane);
+}
+
+static void client_latency_report(struct client *c);
+
+/*
+  按键写进了 pane 的 PTY：pane 空闲或上一次按键等回显超时时，
+  从这次按键开始跟踪
+*/
+static void client_latency_input(struct client *c, struct window_pane *p) {
+  if (c->observer || p->id >= MAX_PANES)
+    return;
+  struct pane_latency *l = c->latency[p->id];
+  if (!l && !(l = c->latency[p->id] = calloc(1, sizeof(*l))))
+    return;
+  uint64_t now = latency_now_us();
+  if (l->input_us && now - l->input_us < MUXKIT_LATENCY_TIMEOUT * 1000ULL)
+    return;
+  l->input_us = c->input_us;
+  l->write_us = now;
+  l->output_us = 0;
+}
+
+/*
+  转发一段连续的输入：同步模式下每个 pane 一次写入，否则只写当前 pane
+*/
+static void client_forward(struct client *c, const char *data, size_t len) {
+  if (len == 0)
+    return;
+  if (c->sync_input_mode) {
+    struct window_pane *p;
+    list_for_each_entry(p, &c->pane->window->panes, link) {
+      pane_write(p, data, len);
+      client_latency_input(c, p);
+    }
+  } else {
+    pane_write(c->pane, data, len);
+    client_latency_input(c, c->pane);
+  }
+}
+
+/*
+  粘贴开始/结束：目标程序开启了 bracketed paste 时由 vterm 补上标记
+*/
+static void client_paste_mark(struct client *c, int start) {
+  struct window_pane *p;
+  list_for_each_entry(p, &c->pane->window->panes, link) {
+    if (!c->sync_input_mode && p != c->pane)
+      continue;
+    if (start)
+      vterm_keyboard_start_paste(p->vt);
+    else
+      vterm_keyboard_end_paste(p->vt);
+  }
+}
+
+/*
+  单调时钟毫秒数
+*/
+static long long client_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+  buf 末尾与 mark 开头重合的最长长度（标记被拆到两次 read 中）
+*/
+static size_t paste_partial(const char *buf, size_t len, const char *mark) {
+  for (size_t k = PASTE_MARK_LEN - 1; k > 0; k--) {
+    if (k <= len && memcmp(buf + len - k, mark, k) == 0)
+      return k;
+  }
+  return 0;
+}
+
+/*
+  暂留的半个开始标记没等到后半段（例如单独按下的 Esc）：按普通输入转发
+*/
+static void client_paste_expire(struct client *c) {
+  if (c->in_paste || c->paste_held == 0 ||
+      client_now_ms() < c->paste_hold_ms)
+    return;
+  size_t held = c->paste_held;
+  c->paste_held = 0;
+  client_forward(c, c->paste_hold, held);
 }
 
 void act_stdin_read(struct client *c, client_event ev) {
-  char buff[MUXKIT_BUF_XLARGE];
-  ssize_t n = read(STDIN_FILENO, buff, sizeof(buff));
+  char buff[MUXKIT_BUF_XLARGE + PASTE_MARK_LEN];
+  // 上次留下的半个粘贴标记
+  size_t held = c->paste_held;
+  memcpy(buff, c->paste_hold, held);
+  c->paste_held = 0;
+  ssize_t n = read(STDIN_FILENO, buff + held, MUXKIT_BUF_XLARGE);
   if (n <= 0) {
     dispatch_event(c, EV_EOF_STDIN);
     return;
   }
+  c->input_us = latency_now_us();
 
   static int ctrl_b_pressed = 0;
+  size_t len = held + n;
+  size_t i = 0;
+
+  while (i < len && !c->child_exited) {
+    // 粘贴内容整块转发，其中的 Ctrl+B 不当作前缀键
+    if (c->in_paste) {
+      char *end = memmem(buff + i, len - i, PASTE_END, PASTE_MARK_LEN);
+      if (!end) {
+        size_t keep = paste_partial(buff + i, len - i, PASTE_END);
+        client_forward(c, buff + i, len - i - keep);
+        memcpy(c->paste_hold, buff + len - keep, keep);
+        c->paste_held = keep;
+        return;
+      }
+      client_forward(c, buff + i, end - (buff + i));
+      client_paste_mark(c, 0);
+      c->in_paste = 0;
+      i = end - buff + PASTE_MARK_LEN;
+      continue;
+    }
 
-  for (ssize_t i = 0; i < n; i++) {
     if (buff[i] == 0x02) { // ctrl+b
       if (ctrl_b_pressed) {
         // Ctrl+B + Ctrl+B = 发送一个真正的 Ctrl+B 到 PTY
-        write(c->pane->master_fd, &buff[i], 1);
+        pane_write(c->pane, &buff[i], 1);
       }
       ctrl_b_pressed = 1;
+      i++;
       continue;
     }
     if (ctrl_b_pressed) {
       enum key_table table = KEY_PREFIX;
       handle_key(c, table, buff[i]);
       ctrl_b_pressed = 0;
-    } else {
-      // 如果正在查看历史，非 Ctrl+B 按键退出历史模式
-      if (c->pane->grid->scroll_offset > 0) {
-        c->pane->grid->scroll_offset = 0;
-        render_pane(c->pane);
-        // 如果是 Esc 或 q，不发送到 shell
-        if (buff[i] == 0x1b || buff[i] == 'q') {
-          continue;
-        }
+      i++;
+      continue;
+    }
+
+    // 如果正在查看历史，非 Ctrl+B 按键退出历史模式
+    if (c->pane->grid->scroll_offset > 0) {
+      c->pane->grid->scroll_offset = 0;
+      render_pane(c->pane);
+      // 如果是 Esc 或 q，不发送到 shell
+      if (buff[i] == 0x1b || buff[i] == 'q') {
+        i++;
+        continue;
       }
-      if (c->sync_input_mode) {
-        // 广播到所有 pane
-        struct window_pane *p;
-        list_for_each_entry(p, &c->pane->window->panes, link) {
-          write(p->master_fd, &buff[i], 1);
-        }
-      } else {
-        write(c->pane->master_fd, &buff[i], 1);
+    }
+
+    if (len - i >= PASTE_MARK_LEN &&
+        memcmp(buff + i, PASTE_START, PASTE_MARK_LEN) == 0) {
+      client_paste_mark(c, 1);
+      c->in_paste = 1;
+      i += PASTE_MARK_LEN;
+      continue;
+    }
+
+    // 找到下一个前缀键或粘贴开始标记，中间的字节一次写出
+    size_t j = i + 1;
+    while (j < len && buff[j] != 0x02 &&
+           !(buff[j] == 0x1b && len - j >= PASTE_MARK_LEN &&
+             memcmp(buff + j, PASTE_START, PASTE_MARK_LEN) == 0))
+      j++;
+    // 开始标记被 read 拆开：前半段留到下次，不能当作按键转发
+    if (j == len) {
+      size_t keep = paste_partial(buff + i, len - i, PASTE_START);
+      if (keep) {
+        client_forward(c, buff + i, len - i - keep);
+        memcpy(c->paste_hold, buff + len - keep, keep);
+        c->paste_held = keep;
+        c->paste_hold_ms =
+            client_now_ms() + (keep == 1 ? PASTE_ESC_HOLD_MS : PASTE_HOLD_MS);
+        return;
       }
     }
+    client_forward(c, buff + i, j - i);
+    i = j;
   }
 }
 
 void act_detach(struct client *c, client_event ev) {
-  struct window_pane *p;
-  list_for_each_entry(p, &c->pane->window->panes, link) {
-    void *buf;
-    size_t n = grid_serialize(p->grid, p->id, p->cx, p->cy, &buf);
-    if (n > 0) {
-      send_server(MSG_GRID_SAVE, server_fd, buf, n);
-      free(buf);
-    }
-  }
+  // 屏幕状态一直在服务端，分离只需断开；断开前交出剩余的延迟样本
+  if (c->latency_dirty)
+    client_latency_report(c);
   send_server(MSG_DETACH, server_fd, NULL, 0);
   c->child_exited = 1;
   // 切换回主屏幕缓冲区
-  write(STDOUT_FILENO, "\033[?1049l", 8);
+  frame_append(frame_current(), "\033[?2004l\033[?1049l", 16);
+  frame_flush(frame_current());
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &(c->orig_termios));
 }
 
@@ -353,55 +430,368 @@ void signal_handler(int sig) {
   }
 }
 
-void act_pane_split(struct client *c, client_event ev) {
-  struct window_pane *p;
+/*
+  pane 的回显到达：正在跟踪的按键进入等待写出的阶段
+*/
+static void client_latency_output(struct client *c, struct window_pane *p) {
+  struct pane_latency *l = p->id < MAX_PANES ? c->latency[p->id] : NULL;
+  if (!l || !l->input_us || l->output_us)
+    return;
+  l->output_us = latency_now_us();
+  c->latency_echoed = 1;
+}
 
-  // 统计现有 pane 数量
-  int pane_count = 0;
-  list_for_each_entry(p, &c->pane->window->panes, link) { pane_count++; }
+/*
+  一帧写到了 stdout：回显已到达的按键各记一个样本
+*/
+static void client_latency_frame(struct client *c) {
+  uint64_t now = latency_now_us();
+  for (int i = 0; i < MAX_PANES; i++) {
+    struct pane_latency *l = c->latency[i];
+    if (!l || !l->output_us)
+      continue;
+    latency_record(&l->stages[LAT_WRITE], l->write_us - l->input_us);
+    latency_record(&l->stages[LAT_ECHO], l->output_us - l->write_us);
+    latency_record(&l->stages[LAT_RENDER], now - l->output_us);
+    latency_record(&l->stages[LAT_TOTAL], now - l->input_us);
+    l->input_us = 0;
+    l->output_us = 0;
+    l->dirty = 1;
+    c->latency_dirty = 1;
+  }
+  c->latency_echoed = 0;
+}
 
-  // 计算分割后每个 pane 的宽度
-  unsigned int total_width = c->ws.ws_col;
-  unsigned int total_height = c->pane->sy;
-  int new_pane_count = pane_count + 1;
-  // 总宽度减去边框数量(new_pane_count - 1)，再平分
-  unsigned int pane_width =
-      (total_width - (new_pane_count - 1)) / new_pane_count;
+/*
+  把上次上报之后的样本交给服务端，每个有新样本的 pane 一条 MSG_LATENCY
+*/
+static void client_latency_report(struct client *c) {
+  struct msg_latency ml;
+  memset(&ml, 0, sizeof(ml));
+  for (int i = 0; i < MAX_PANES; i++) {
+    struct pane_latency *l = c->latency[i];
+    if (!l || !l->dirty)
+      continue;
+    ml.pane_id = i;
+    memcpy(ml.stages, l->stages, sizeof(ml.stages));
+    send_server(MSG_LATENCY, c->server_fd, &ml, sizeof(ml));
+    memset(l->stages, 0, sizeof(l->stages));
+    l->dirty = 0;
+  }
+  c->latency_dirty = 0;
+  c->latency_report_ms = client_now_ms() + MUXKIT_LATENCY_REPORT;
+}
 
-  // 先发送新 pane 的尺寸给 server
-  struct winsize new_ws = {.ws_row = total_height, .ws_col = pane_width};
-  send_server(MSG_RESIZE, server_fd, &new_ws, sizeof(new_ws));
+/*
+  pane 的 PTY 重新可写：写出积压的输入，写完后不再关注可写
+*/
+static void client_pane_event(struct reactor_handler *h, unsigned int events) {
+  extern struct client client;
+  struct window_pane *p = container_of(h, struct window_pane, handler);
+  (void)events;
+  if (pane_flush_input(p) <= 0)
+    reactor_del(client.reactor, h);
+}
 
-  char buf[MUXKIT_BUF_SMALL] = "pane-split";
-  send_server(MSG_COMMAND, server_fd, buf, strlen(buf) + 1);
-  int new_fd = recv_fd(server_fd);
-  if (new_fd == -1) {
-    log_error("recv_fd failed");
+/*
+  pane 的输入开始积压：等 PTY 可写，不阻塞事件循环
+*/
+static void client_pane_blocked(struct window_pane *p) {
+  extern struct client client;
+  if (!p->handler.active)
+    reactor_add(client.reactor, &p->handler, p->master_fd, REACTOR_WRITE,
+                client_pane_event);
+}
+
+/*
+  关闭 pane 的 PTY fd，连同可写关注一起注销
+*/
+static void client_pane_close_fd(struct client *c, struct window_pane *p) {
+  if (p->handler.active)
+    reactor_del(c->reactor, &p->handler);
+  if (p->master_fd >= 0)
+    close(p->master_fd);
+  p->master_fd = -1;
+}
+
+/*
+  pane 的 shell 退出：从窗口移除，必要时切换活动 pane
+*/
+static void client_pane_close(struct client *c, struct window_pane *p) {
+  client_pane_close_fd(c, p);
+
+  // 如果是当前活动 pane，切换到另一个
+  if (c->pane == p) {
+    struct window_pane *next =
+        list_entry(p->link.next, struct window_pane, link);
+    if (&next->link == &c->pane->window->panes) {
+      // 到达链表头，尝试前一个
+      next = list_entry(p->link.prev, struct window_pane, link);
+    }
+    if (&next->link != &c->pane->window->panes) {
+      c->pane = next;
+    }
+  }
+
+  // 从链表移除并销毁
+  struct list_head *panes = &p->window->panes;
+  list_del(&p->link);
+  pane_destroy(p);
+  c->layout_pending = 1;
+
+  // 检查是否还有 pane
+  if (list_empty(panes)) {
+    c->pane = NULL;
+    c->child_exited = 1;
+  }
+}
+
+/*
+  标准输入可读
+*/
+static void client_stdin_event(struct reactor_handler *h, unsigned int events) {
+  struct client *c = container_of(h, struct client, stdin_handler);
+  dispatch_event(c, EV_STDIN_READ);
+  c->render_pending = 1;
+}
+
+/*
+  阻塞读取一条服务端消息，负载复制到 buf
+  返回 0 成功，-1 连接关闭或消息错误
+*/
+static int client_read_msg(struct client *c, struct msg_header *hdr, void *buf,
+                           size_t cap) {
+  char *payload;
+  if (msg_reader_wait(&c->in, c->server_fd, hdr, &payload) < 0)
+    return -1;
+  if (hdr->len > cap) {
+    log_error("message %d too large: %zu", hdr->type, hdr->len);
+    return -1;
+  }
+  memcpy(buf, payload, hdr->len);
+  return 0;
+}
+
+/*
+  根据服务端的 pane ID 查找 pane
+*/
+static struct window_pane *client_find_pane(struct window *w,
+                                            unsigned int id) {
+  struct window_pane *p;
+  list_for_each_entry(p, &w->panes, link) {
+    if (p->id == id)
+      return p;
+  }
+  return NULL;
+}
+
+/*
+  按 MSG_PANE_NEW 创建 pane，ID 和尺寸以服务端为准，fd 为 -1 表示只读
+*/
+static struct window_pane *client_add_pane(struct client *c, struct window *w,
+                                           const struct msg_pane *mp, int fd) {
+  struct window_pane *p = pane_create(w, mp->cols, mp->rows, 0, 0);
+  if (!p) {
+    log_error("create pane %u failed", mp->pane_id);
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+  p->id = mp->pane_id;
+  if (w->next_pane_id <= p->id)
+    w->next_pane_id = p->id + 1;
+  pane_set_master_fd(p, fd);
+  if (fd >= 0)
+    p->input_blocked = client_pane_blocked;
+  if (!c->pane) {
+    c->pane = p;
+    c->master_fd = fd;
+  }
+  return p;
+}
+
+/*
+  用服务端模拟器的快照替换 pane 的屏幕和历史：
+  拥有者按自己的布局重排，观察者采用快照的尺寸
+*/
+static void client_restore_grid(struct client *c, struct window_pane *p,
+                                int gfd, size_t len) {
+  unsigned int pane_id, cx, cy;
+  if (grid_snapshot_restore(p->grid, gfd, len, &pane_id, &cx, &cy) < 0) {
+    log_warn("restore grid of pane %u failed", p->id);
     return;
   }
+  p->cx = cx;
+  p->cy = cy;
+  unsigned int sx = c->observer ? p->grid->width : p->sx;
+  unsigned int sy = c->observer ? p->grid->height : p->sy;
+  if (p->grid->width != sx || p->grid->height != sy || p->sx != sx ||
+      p->sy != sy) {
+    pane_resize(p, sx, sy);
+    c->layout_pending = 1;
+  }
+  sync_vterm_from_grid(p);
+}
+
+/*
+  处理一条服务端推送的 pane 消息
+*/
+static int client_handle_msg(struct client *c, const struct msg_header *hdr,
+                             const char *buf) {
+  struct window *w = c->pane->window;
+  struct window_pane *p;
+
+  if (hdr->type == MSG_GRID_SAVE) {
+    // 落后太多，服务端改发整屏快照
+    struct msg_grid mg;
+    if (hdr->len != sizeof(mg))
+      return -1;
+    memcpy(&mg, buf, sizeof(mg));
+    int gfd = msg_reader_fd(&c->in, c->server_fd);
+    if (gfd == -1)
+      return -1;
+    p = client_find_pane(w, mg.pane_id);
+    if (p) {
+      client_restore_grid(c, p, gfd, mg.len);
+      render_pane(p);
+    }
+    close(gfd);
+    c->render_pending = 1;
+    return 0;
+  }
+
+  struct msg_pane mp;
+  if (hdr->len < sizeof(mp)) {
+    log_warn("unexpected message %d, len %zu", hdr->type, hdr->len);
+    return 0;
+  }
+  memcpy(&mp, buf, sizeof(mp));
+  p = client_find_pane(w, mp.pane_id);
+
+  switch (hdr->type) {
+  case MSG_PANE_OUTPUT:
+    if (p) {
+      record_output(c->recorder, p->id, p->sx, p->sy, buf + sizeof(mp),
+                    hdr->len - sizeof(mp));
+      pane_input(p, buf + sizeof(mp), hdr->len - sizeof(mp));
+      client_latency_output(c, p);
+    }
+    c->render_pending = 1;
+    break;
+  case MSG_PANE_RESIZE:
+    // 拥有者自己设置的尺寸，只有观察者需要跟随
+    if (p && c->observer) {
+      pane_resize(p, mp.cols, mp.rows);
+      c->layout_pending = 1;
+    }
+    break;
+  case MSG_PANE_NEW: {
+    int fd = -1;
+    if ((mp.flags & MSG_PANE_FD) &&
+        (fd = msg_reader_fd(&c->in, c->server_fd)) == -1)
+      return -1;
+    if (!p && client_add_pane(c, w, &mp, fd))
+      c->layout_pending = 1;
+    break;
+  }
+  case MSG_PANE_EXIT:
+    if (p) {
+      record_exit(c->recorder, p->id);
+      client_pane_close(c, p);
+    }
+    break;
+  default:
+    log_warn("unknown msgtype %d", hdr->type);
+  }
+  return 0;
+}
+
+/*
+  server 连接可读：读一次，处理缓冲区中所有完整的推送消息，
+  不完整的留到下次可读。关闭连接说明 session 结束
+*/
+static void client_server_event(struct reactor_handler *h,
+                                unsigned int events) {
+  struct client *c = container_of(h, struct client, server_handler);
+  struct msg_header hdr;
+  char *payload;
+  int ret;
+
+  if (msg_reader_fill(&c->in, c->server_fd) <= 0)
+    goto eof;
+  while (!c->child_exited &&
+         (ret = msg_reader_next(&c->in, &hdr, &payload)) != 0) {
+    if (ret < 0 || client_handle_msg(c, &hdr, payload) < 0)
+      goto eof;
+  }
+  return;
+
+eof:
+  reactor_del(c->reactor, h);
+  dispatch_event(c, EV_EOF_PTY);
+}
+
+/*
+  渲染一帧：所有 pane 的脏行、状态栏和光标
+*/
+static void client_render_frame(struct client *c) {
+  struct window_pane *p;
+  list_for_each_entry(p, &c->pane->window->panes, link) {
+    render_pane_damage(p);
+  }
+  render_status_bar(c);
 
-  // 调整所有现有 pane 的尺寸和位置
+  // 重新定位光标到当前活动 pane
+  frame_printf(frame_current(), "\033[%u;%uH", c->pane->yoff + c->pane->cy + 1,
+               c->pane->xoff + c->pane->cx + 1);
+  c->render_pending = 0;
+  c->last_frame_ms = client_now_ms();
+}
+
+/*
+  按 pane 数量平分宽度，把尺寸设置到每个 PTY 并告知服务端。
+  观察者沿用服务端的尺寸，只重新排列位置
+*/
+static void client_layout(struct client *c) {
+  struct window_pane *p;
   unsigned int x_offset = 0;
+  if (c->observer) {
+    list_for_each_entry(p, &c->pane->window->panes, link) {
+      p->xoff = x_offset;
+      x_offset += p->sx + 1;
+    }
+    return;
+  }
+
+  unsigned int new_height = c->ws.ws_row - 1; // 留一行给状态栏
+  unsigned int new_width = c->ws.ws_col;
+  int pane_count = 0;
+  list_for_each_entry(p, &c->pane->window->panes, link) { pane_count++; }
+  unsigned int pane_width = (new_width - (pane_count - 1)) / pane_count;
+  struct winsize ws = {.ws_row = new_height, .ws_col = pane_width};
+
   list_for_each_entry(p, &c->pane->window->panes, link) {
-    pane_resize(p, pane_width, total_height);
     p->xoff = x_offset;
-    x_offset += pane_width + 1; // +1 是边框
-
-    // 通知 PTY 新尺寸
-    struct winsize ws = {.ws_row = total_height, .ws_col = pane_width};
+    x_offset += pane_width + 1;
+    // 尺寸没变不打扰 shell
+    if (p->sx == pane_width && p->sy == new_height)
+      continue;
+    pane_resize(p, pane_width, new_height);
     ioctl(p->master_fd, TIOCSWINSZ, &ws);
   }
+  // 服务端模拟器跟随新尺寸，之后新建的 pane 也用这个尺寸
+  send_server(MSG_RESIZE, c->server_fd, &ws, sizeof(ws));
+}
 
-  // 创建新 pane
-  struct window_pane *new_pane = pane_create(
-      c->pane->window, pane_width, total_height, x_offset, c->pane->yoff);
-  pane_set_master_fd(new_pane, new_fd);
-
-  struct winsize ws = {.ws_row = new_pane->sy, .ws_col = new_pane->sx};
-  ioctl(new_fd, TIOCSWINSZ, &ws);
+/*
+  pane 增减或尺寸变化：重新布局并整屏重绘
+*/
+static void client_relayout(struct client *c) {
+  struct window_pane *p;
+  client_layout(c);
 
-  // 清屏并渲染所有 pane
-  write(STDOUT_FILENO, "\033[2J", 4);
+  // 清屏并重新渲染
+  frame_append(frame_current(), "\033[2J", 4);
   render_status_bar(c);
   list_for_each_entry(p, &c->pane->window->panes, link) {
     render_pane(p);
@@ -409,6 +799,34 @@ void act_pane_split(struct client *c, client_event ev) {
       render_pane_borders(p);
     }
   }
+  c->render_pending = 1;
+}
+
+void act_pane_split(struct client *c, client_event ev) {
+  struct window_pane *p;
+  if (c->observer)
+    return;
+
+  // 统计现有 pane 数量
+  int pane_count = 0;
+  list_for_each_entry(p, &c->pane->window->panes, link) { pane_count++; }
+
+  // 计算分割后每个 pane 的宽度
+  unsigned int total_width = c->ws.ws_col;
+  unsigned int total_height = c->pane->sy;
+  int new_pane_count = pane_count + 1;
+  // 总宽度减去边框数量(new_pane_count - 1)，再平分
+  unsigned int pane_width =
+      (total_width - (new_pane_count - 1)) / new_pane_count;
+
+  // 先发送新 pane 的尺寸给 server
+  struct winsize new_ws = {.ws_row = total_height, .ws_col = pane_width};
+
+  // 新 pane 随 MSG_PANE_NEW 到达后再布局
+  const char *cmd = "pane-split";
+  struct msg_out msgs[] = {{MSG_RESIZE, &new_ws, sizeof(new_ws)},
+                           {MSG_COMMAND, cmd, strlen(cmd) + 1}};
+  msg_send(server_fd, msgs, 2);
 }
 
 /*
@@ -422,6 +840,35 @@ void client_init(struct client *c) {
   c->slave_pid = -1;
   c->child_exited = 0;
   c->sync_input_mode = 0;
+  c->observer = 0;
+  c->pane = NULL;
+  c->reactor = NULL;
+  c->recorder = NULL;
+  c->render_pending = 0;
+  c->layout_pending = 0;
+  c->in_paste = 0;
+  c->paste_held = 0;
+  c->last_frame_ms = 0;
+  c->input_us = 0;
+  memset(c->latency, 0, sizeof(c->latency));
+  c->latency_echoed = 0;
+  c->latency_dirty = 0;
+  c->latency_report_ms = 0;
+
+  // 帧率：编译时默认值，可用环境变量覆盖
+  long rate = MUXKIT_FRAME_RATE;
+  const char *env = getenv("MUXKIT_FRAME_RATE");
+  if (env && strtol(env, NULL, 10) > 0)
+    rate = strtol(env, NULL, 10);
+  c->frame_interval_ms = rate >= 1000 ? 0 : (int)(1000 / rate);
+
+  // 尺寸变化的合并窗口，0 表示每次 SIGWINCH 立即布局
+  c->resize_pending = 0;
+  c->resize_due_ms = 0;
+  c->resize_delay_ms = MUXKIT_RESIZE_DELAY;
+  env = getenv("MUXKIT_RESIZE_DELAY");
+  if (env && strtol(env, NULL, 10) >= 0)
+    c->resize_delay_ms = (int)strtol(env, NULL, 10);
   tcgetattr(STDIN_FILENO, &(c->orig_termios));
   ioctl(STDIN_FILENO, TIOCGWINSZ, &(c->ws));
 }
@@ -430,149 +877,158 @@ void client_init(struct client *c) {
   客户端循环处理
 */
 void client_loop(struct client *c) {
-  while (1) {
-    if (c->child_exited)
-      break;
-    fd_set rfds;
-    // 输入和输出
-    int maxfd;
-    FD_ZERO(&rfds);
-
-    FD_SET(STDIN_FILENO, &rfds);
-    FD_SET(c->server_fd, &rfds); // 监听 server 连接
-
-    maxfd = c->master_fd > STDIN_FILENO ? c->master_fd : STDIN_FILENO;
-    struct window_pane *p;
-    list_for_each_entry(p, &c->pane->window->panes, link) {
-      if (p->master_fd > 0) {
-        FD_SET(p->master_fd, &rfds);
-        if (p->master_fd > maxfd) {
-          maxfd = p->master_fd;
-        }
-      }
+  c->reactor = reactor_create();
+  if (!c->reactor) {
+    dispatch_event(c, EV_INTERRUPT);
+    return;
+  }
+  reactor_add(c->reactor, &c->stdin_handler, STDIN_FILENO, REACTOR_READ,
+              client_stdin_event);
+  reactor_add(c->reactor, &c->server_handler, c->server_fd, REACTOR_READ,
+              client_server_event); // pane 输出由 server 推送
+
+  while (!c->child_exited) {
+    // 有待渲染的输出时，最多等到下一帧的时间点；
+    // 等待尺寸稳定期间不渲染，只等到布局的时间点
+    int timeout = -1;
+    if (c->resize_pending) {
+      long long wait = c->resize_due_ms - client_now_ms();
+      timeout = wait > 0 ? (int)wait : 0;
+    } else if (c->render_pending) {
+      long long wait = c->last_frame_ms + c->frame_interval_ms - client_now_ms();
+      timeout = wait > 0 ? (int)wait : 0;
+    }
+    // 暂留的半个粘贴开始标记到期后按普通输入转发
+    if (c->paste_held && !c->in_paste) {
+      long long wait = c->paste_hold_ms - client_now_ms();
+      if (wait < 0)
+        wait = 0;
+      if (timeout < 0 || wait < timeout)
+        timeout = (int)wait;
+    }
+    // 空闲时也按时上报最后一批延迟样本
+    if (c->latency_dirty) {
+      long long wait = c->latency_report_ms - client_now_ms();
+      if (wait < 0)
+        wait = 0;
+      if (timeout < 0 || wait < timeout)
+        timeout = (int)wait;
     }
-    if (c->server_fd > maxfd)
-      maxfd = c->server_fd;
 
-    int select_ok = 1;
-    if (select(maxfd + 1, &rfds, NULL, NULL, NULL) < 0) {
-      // 防止收到信号后中断 fd
-      if (errno != EINTR) {
-        dispatch_event(c, EV_INTERRUPT);
-        log_error("select failed: %s", strerror(errno));
-        break;
-      }
-      // fd 检查完毕
-      select_ok = 0;
+    // 被信号打断时返回 0，继续检查信号标志
+    if (reactor_wait(c->reactor, timeout) < 0) {
+      dispatch_event(c, EV_INTERRUPT);
+      log_error("reactor wait failed: %s", strerror(errno));
+      break;
     }
 
+    // 拖动窗口边缘会连续产生 SIGWINCH，每次都推迟布局，
+    // 尺寸稳定 resize_delay_ms 后只按最终尺寸布局一次
     if (sigwinch_pending) {
       sigwinch_pending = 0;
+      c->resize_pending = 1;
+      c->resize_due_ms = client_now_ms() + c->resize_delay_ms;
+    }
+    if (c->resize_pending && client_now_ms() >= c->resize_due_ms) {
+      c->resize_pending = 0;
       dispatch_event(c, EV_WINCH);
     }
+    client_paste_expire(c);
 
     if (sigchld_pending) {
       sigchld_pending = 0;
       dispatch_event(c, EV_CHLD_EXIT);
     }
 
-    // 只有 select 成功时才检查 fd
-    if (select_ok) {
-      // server 关闭连接，说明 session 结束
-      if (FD_ISSET(c->server_fd, &rfds)) {
-        char buf[1];
-        if (read(c->server_fd, buf, 1) <= 0) {
-          dispatch_event(c, EV_EOF_PTY);
-        }
-      }
+    if (c->child_exited)
+      break;
 
-      // 使用 safe 版本，因为可能在循环中删除 pane
-      struct window_pane *tmp;
-      int pane_removed = 0;
-      list_for_each_entry_safe(p, tmp, &c->pane->window->panes, link) {
-        if (p->master_fd >= 0 && FD_ISSET(p->master_fd, &rfds)) {
-          char buff[MUXKIT_BUF_XLARGE];
-          ssize_t n = read(p->master_fd, buff, sizeof(buff));
-          if (n > 0) {
-            pane_input(p, buff, n);
-            render_pane(p);
-            if (p->link.next != &c->pane->window->panes) {
-              render_pane_borders(p);
-            }
-          } else if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
-            // pane 的 shell 退出了
-            close(p->master_fd);
-            p->master_fd = -1;
-
-            // 如果是当前活动 pane，切换到另一个
-            if (c->pane == p) {
-              struct window_pane *next =
-                  list_entry(p->link.next, struct window_pane, link);
-              if (&next->link == &c->pane->window->panes) {
-                // 到达链表头，尝试前一个
-                next = list_entry(p->link.prev, struct window_pane, link);
-              }
-              if (&next->link != &c->pane->window->panes) {
-                c->pane = next;
-              }
-            }
-
-            // 从链表移除并销毁
-            list_del(&p->link);
-            pane_destroy(p);
-            pane_removed = 1;
-
-            // 检查是否还有 pane
-            if (list_empty(&c->pane->window->panes)) {
-              c->child_exited = 1;
-              break;
-            }
-          }
-        }
-      }
+    if (c->layout_pending) {
+      c->layout_pending = 0;
+      client_relayout(c);
+    }
 
-      // 如果有 pane 被移除，重新调整剩余 pane 的尺寸
-      if (pane_removed && !c->child_exited) {
-        unsigned int new_height = c->ws.ws_row - 1;
-        unsigned int new_width = c->ws.ws_col;
-        int pane_count = 0;
-        list_for_each_entry(p, &c->pane->window->panes, link) { pane_count++; }
-        unsigned int pane_width = (new_width - (pane_count - 1)) / pane_count;
-        unsigned int x_offset = 0;
-
-        list_for_each_entry(p, &c->pane->window->panes, link) {
-          pane_resize(p, pane_width, new_height);
-          p->xoff = x_offset;
-          x_offset += pane_width + 1;
-          struct winsize ws = {.ws_row = new_height, .ws_col = pane_width};
-          ioctl(p->master_fd, TIOCSWINSZ, &ws);
-        }
-
-        // 清屏并重新渲染
-        write(STDOUT_FILENO, "\033[2J", 4);
-        render_status_bar(c);
-        list_for_each_entry(p, &c->pane->window->panes, link) {
-          render_pane(p);
-          if (p->link.next != &c->pane->window->panes) {
-            render_pane_borders(p);
-          }
-        }
-      }
+    // 按帧率合并渲染，大量输出时一帧只渲染一次。
+    // 等待布局期间 pane 仍是旧尺寸，输出照常送入 vterm，布局后整体重绘
+    int rendered = 0;
+    if (c->render_pending && !c->resize_pending &&
+        client_now_ms() - c->last_frame_ms >= c->frame_interval_ms) {
+      client_render_frame(c);
+      rendered = 1;
+    }
 
-      render_status_bar(c);
+    // 本轮所有渲染输出一次写出，回显随这一帧到达屏幕
+    frame_flush(frame_current());
+    if (rendered && c->latency_echoed)
+      client_latency_frame(c);
+    if (c->latency_dirty && client_now_ms() >= c->latency_report_ms)
+      client_latency_report(c);
+  }
 
-      // 重新定位光标到当前活动 pane
-      char cursor_buf[32];
-      int clen = snprintf(cursor_buf, sizeof(cursor_buf), "\033[%u;%uH",
-                          c->pane->yoff + c->pane->cy + 1,
-                          c->pane->xoff + c->pane->cx + 1);
-      write(STDOUT_FILENO, cursor_buf, clen);
+  reactor_destroy(c->reactor);
+  c->reactor = NULL;
+}
 
-      if (FD_ISSET(STDIN_FILENO, &rfds)) {
-        dispatch_event(c, EV_STDIN_READ);
-      }
-    }
+/*
+  附加或观察 session：读取应答中每个 pane 的尺寸、
+  PTY fd（只有拥有者）和服务端模拟器的快照，然后按本地终端布局
+  返回窗口，失败返回 NULL
+*/
+static struct window *client_attach(struct client *c, int session_id) {
+  int fd = c->server_fd;
+  struct msg_header hdr;
+  struct msg_attach ma;
+  send_server(c->observer ? MSG_WATCH : MSG_DETACH, fd, &session_id,
+              sizeof(session_id));
+  if (client_read_msg(c, &hdr, &ma, sizeof(ma)) < 0 ||
+      hdr.type != MSG_READY || hdr.len != sizeof(ma) || ma.pane_count <= 0)
+    return NULL;
+  log_info("attaching to session %d with %d panes%s", session_id,
+           ma.pane_count, c->observer ? " (read-only)" : "");
+
+  struct window *w = window_create(TR(MSG_WINDOW_ATTACHED));
+  if (!w)
+    return NULL;
+  for (int i = 0; i < ma.pane_count; i++) {
+    struct msg_pane mp;
+    struct msg_grid mg;
+    int pfd = -1;
+    if (client_read_msg(c, &hdr, &mp, sizeof(mp)) < 0 ||
+        hdr.type != MSG_PANE_NEW || hdr.len != sizeof(mp))
+      goto fail;
+    if ((mp.flags & MSG_PANE_FD) && (pfd = msg_reader_fd(&c->in, fd)) == -1)
+      goto fail;
+    struct window_pane *p = client_add_pane(c, w, &mp, pfd);
+
+    // 每个 pane 之后是服务端模拟器的快照
+    if (client_read_msg(c, &hdr, &mg, sizeof(mg)) < 0 ||
+        hdr.type != MSG_GRID_SAVE || hdr.len != sizeof(mg))
+      goto fail;
+    int gfd = msg_reader_fd(&c->in, fd);
+    if (gfd == -1)
+      goto fail;
+    if (p)
+      client_restore_grid(c, p, gfd, mg.len);
+    close(gfd);
+  }
+  if (!c->pane)
+    goto fail;
+  w->next_pane_id = ma.next_pane_id;
+  client_layout(c);
+  c->layout_pending = 0;
+  return w;
+
+fail:
+  log_error("client attach: bad reply from server");
+  struct window_pane *p, *tmp;
+  list_for_each_entry_safe(p, tmp, &w->panes, link) {
+    client_pane_close_fd(c, p);
+    list_del(&p->link);
+    pane_destroy(p);
   }
+  window_destroy(w);
+  c->pane = NULL;
+  return NULL;
 }
 
 int client_main(struct client *c) {
@@ -587,10 +1043,17 @@ int client_main(struct client *c) {
   log_info("connected to server, fd %d", server_fd);
   // 保存 server 连接 fd
   c->server_fd = server_fd;
+  // 最大的推送消息是一块 pane 输出
+  if (msg_reader_init(&c->in, sizeof(struct msg_pane) + MUXKIT_STREAM_CHUNK) <
+      0)
+    return -1;
   extern int new_session_detach;
   extern int detached_session_id;
   extern int list_sessions;
   extern int kill_session_id;
+  extern int restore_sessions;
+  extern int watch_session_id;
+  extern int latency_session_id;
   struct window *w = NULL;
   int client_version = PROTOCOL_VERSION;
   int server_version = 0;
@@ -622,6 +1085,21 @@ int client_main(struct client *c) {
     return 0;
   }
 
+  // 从检查点恢复 session，长度和正文都要读满，不能只靠一次 read
+  if (restore_sessions) {
+    send_server(MSG_RESTORE, server_fd, NULL, 0);
+    size_t len;
+    if (read_n(server_fd, &len, sizeof(len)) > 0 && len > 0) {
+      char *response = malloc(len);
+      if (response && read_n(server_fd, response, len) > 0)
+        printf("%s", response);
+      free(response);
+    }
+    close(server_fd);
+    log_close();
+    return 0;
+  }
+
   // 杀死指定 session
   if (kill_session_id != -1) {
     send_server(MSG_DETACHKILL, server_fd, &kill_session_id,
@@ -640,109 +1118,38 @@ int client_main(struct client *c) {
     return 0;
   }
 
-  // attach 指定 session
-  if (detached_session_id != -1) {
-    send_server(MSG_DETACH, server_fd, &detached_session_id,
-                sizeof(detached_session_id));
-    // attach: 先读取 pane 数量
-    int pane_count = 0;
-    if (read(server_fd, &pane_count, sizeof(int)) <= 0 || pane_count <= 0) {
+  // 查询 session 的输入延迟，报告可能超过一次 read 能读到的长度
+  if (latency_session_id != -1) {
+    send_server(MSG_LATENCY_QUERY, server_fd, &latency_session_id,
+                sizeof(latency_session_id));
+    size_t len;
+    if (read_n(server_fd, &len, sizeof(len)) > 0 && len > 0) {
+      char *response = malloc(len);
+      if (response && read_n(server_fd, response, len) > 0)
+        printf("%s", response);
+      free(response);
+    }
+    close(server_fd);
+    log_close();
+    return 0;
+  }
+
+  // attach 或观察指定 session
+  if (detached_session_id != -1 || watch_session_id != -1) {
+    int session_id = detached_session_id;
+    if (watch_session_id != -1) {
+      session_id = watch_session_id;
+      c->observer = 1;
+    }
+    w = client_attach(c, session_id);
+    if (!w) {
       char buff[MUXKIT_BUF_SMALL] = {0};
-      snprintf(buff, sizeof(buff), TR(MSG_ATTACH_FAILED), detached_session_id);
+      snprintf(buff, sizeof(buff), TR(MSG_ATTACH_FAILED), session_id);
       write(STDOUT_FILENO, buff, strlen(buff));
       log_warn("attach failed: session %d not found or not detached",
-               detached_session_id);
+               session_id);
       return 0;
     }
-
-    log_info("attaching to session with %d panes", pane_count);
-
-    // 创建 window
-    w = window_create(TR(MSG_WINDOW_ATTACHED));
-    c->ws.ws_row -= 1;
-
-    // 计算每个 pane 的宽度
-    unsigned int pane_width = (c->ws.ws_col - (pane_count - 1)) / pane_count;
-    unsigned int x_offset = 0;
-
-    // 接收所有 pane 的 fd 并创建 pane
-    for (int i = 0; i < pane_count; i++) {
-      int fd = recv_fd(server_fd);
-      if (fd == -1) {
-        log_error("recv_fd failed for pane %d", i);
-        continue;
-      }
-      struct window_pane *p =
-          pane_create(w, pane_width, c->ws.ws_row, x_offset, 0);
-      pane_set_master_fd(p, fd);
-
-      // 通知 PTY 新尺寸
-      struct winsize ws = {.ws_row = c->ws.ws_row, .ws_col = pane_width};
-      ioctl(fd, TIOCSWINSZ, &ws);
-
-      if (i == 0) {
-        c->pane = p;
-        c->master_fd = fd;
-      }
-      x_offset += pane_width + 1;
-    }
-    // 读取 grid 数量
-    int grid_count = 0;
-    read(server_fd, &grid_count, sizeof(grid_count));
-    log_info("client attach: received grid_count=%d", grid_count);
-
-    for (int i = 0; i < grid_count; i++) {
-      struct msg_header gh;
-      ssize_t hdr_read = read(server_fd, &gh, sizeof(gh));
-      log_info("client attach: read header, got %zd bytes, type=%d, len=%zu",
-               hdr_read, gh.type, gh.len);
-      if (hdr_read == sizeof(gh) && gh.type == MSG_GRID_SAVE) {
-        void *data = malloc(gh.len);
-        // 循环读取，确保读取完整数据
-        size_t total_read = 0;
-        while (total_read < gh.len) {
-          ssize_t n =
-              read(server_fd, (char *)data + total_read, gh.len - total_read);
-          if (n <= 0) {
-            log_error("client attach: read failed at %zu/%zu bytes", total_read,
-                      gh.len);
-            break;
-          }
-          total_read += n;
-        }
-        log_info("client attach: read data, got %zu bytes total", total_read);
-        if (total_read == gh.len) {
-          unsigned int pane_id;
-          memcpy(&pane_id, data, sizeof(pane_id));
-          log_info("client attach: grid pane_id=%u, len=%zu", pane_id, gh.len);
-
-          struct window_pane *wp;
-          int found = 0;
-          list_for_each_entry(wp, &w->panes, link) {
-            log_info("client attach: checking wp->id=%u vs pane_id=%u", wp->id,
-                     pane_id);
-            if (wp->id == pane_id) {
-              unsigned int cx, cy;
-              int ret =
-                  grid_deserialize(wp->grid, &pane_id, &cx, &cy, data, gh.len);
-              if (ret == 0) {
-                wp->cx = cx;
-                wp->cy = cy;
-                sync_vterm_from_grid(wp);
-              }
-              log_info("client attach: grid_deserialize returned %d", ret);
-              found = 1;
-              free(data);
-              break;
-            }
-          }
-          if (!found) {
-            log_warn("client attach: no pane found for pane_id=%u", pane_id);
-            free(data);
-          }
-        }
-      }
-    }
   } else {
     // 不允许嵌套运行
     if (client_check_nested()) {
@@ -750,23 +1157,30 @@ int client_main(struct client *c) {
       write(STDOUT_FILENO, msg, strlen(msg));
       _exit(-1);
     }
-    // 创建新session
-    char buf[MUXKIT_BUF_SMALL] = "new-session";
+    // 创建新session：尺寸和命令一次发出
+    const char *cmd = "new-session";
     struct winsize ws_pty = c->ws;
     ws_pty.ws_row -= 1;
-    send_server(MSG_RESIZE, server_fd, &ws_pty, sizeof(ws_pty));
-    send_server(MSG_COMMAND, server_fd, buf, strlen(buf) + 1);
-
-    // 获取 server 主进程fd
-    c->master_fd = recv_fd(server_fd);
-    if (c->master_fd == -1) {
-      log_error("recv_fd failed");
+    struct msg_out msgs[] = {{MSG_RESIZE, &ws_pty, sizeof(ws_pty)},
+                             {MSG_COMMAND, cmd, strlen(cmd) + 1}};
+    msg_send(server_fd, msgs, 2);
+
+    // 服务端建好 pane 后推送 MSG_PANE_NEW，PTY 主设备 fd 紧随其后
+    struct msg_header hdr;
+    struct msg_pane mp;
+    int fd = -1;
+    if (client_read_msg(c, &hdr, &mp, sizeof(mp)) < 0 ||
+        hdr.type != MSG_PANE_NEW || hdr.len != sizeof(mp) ||
+        !(mp.flags & MSG_PANE_FD) ||
+        (fd = msg_reader_fd(&c->in, server_fd)) == -1) {
+      log_error("recv new pane failed");
+      return -1;
+    }
+    w = window_create(TR(MSG_WINDOW_NEW));
+    if (!w || !client_add_pane(c, w, &mp, fd)) {
+      log_error("create window failed");
       return -1;
     }
-    struct window *w = window_create(TR(MSG_WINDOW_NEW));
-    c->ws.ws_row -= 1;
-    c->pane = pane_create(w, c->ws.ws_col, c->ws.ws_row, 0, 0);
-    pane_set_master_fd(c->pane, c->master_fd);
   }
 
   if (new_session_detach == 1) {
@@ -782,9 +1196,12 @@ int client_main(struct client *c) {
 
   dispatch_event(c, EV_ENABLE_RAW_MODE);
   // 切换到备用屏幕缓冲区（防止滚动看到之前的历史）
-  write(STDOUT_FILENO, "\033[?1049h", 8);
+  struct frame *f = frame_current();
+  frame_append(f, "\033[?1049h", 8);
+  // 开启外层终端的 bracketed paste，粘贴内容整块转发
+  frame_append(f, "\033[?2004h", 8);
   // 清屏
-  write(STDOUT_FILENO, "\033[2J\033[H", 7);
+  frame_append(f, "\033[2J\033[H", 7);
 
   // 初始渲染所有 pane 和状态栏
   render_status_bar(c);
@@ -797,20 +1214,36 @@ int client_main(struct client *c) {
     }
   }
   // 定位光标
-  char cursor_buf[32];
-  int clen = snprintf(cursor_buf, sizeof(cursor_buf), "\033[%u;%uH",
-                      c->pane->yoff + c->pane->cy + 1,
-                      c->pane->xoff + c->pane->cx + 1);
-  write(STDOUT_FILENO, cursor_buf, clen);
+  frame_printf(f, "\033[%u;%uH", c->pane->yoff + c->pane->cy + 1,
+               c->pane->xoff + c->pane->cx + 1);
+  frame_flush(f);
+
+  // 录制从这里开始，附加前的屏幕内容来自快照，不在录制中
+  const char *record_path = getenv("MUXKIT_RECORD");
+  if (record_path && *record_path)
+    c->recorder = record_open(record_path);
 
   log_info("entering client loop");
   client_loop(c);
+  record_close(c->recorder);
+  c->recorder = NULL;
+  if (c->latency_dirty)
+    client_latency_report(c);
+  for (int i = 0; i < MAX_PANES; i++) {
+    free(c->latency[i]);
+    c->latency[i] = NULL;
+  }
 
   char buf[MUXKIT_BUF_SMALL];
   memset(buf, 0, sizeof(buf));
   snprintf(buf, sizeof(buf), "%d", c->slave_pid);
   send_server(MSG_EXITED, server_fd, buf, strlen(buf) + 1);
-  log_info("client exiting");
+  log_info("client exiting, %lu frames, %llu bytes, %llu write syscalls",
+           f->stats.frames, f->stats.total_bytes, f->stats.total_syscalls);
+  msg_reader_free(&c->in);
+  log_info("buffer pool: %lu gets, %lu hits, %lu mallocs, %lu frees",
+           bufpool_stats()->gets, bufpool_stats()->hits,
+           bufpool_stats()->mallocs, bufpool_stats()->frees);
   log_close();
   window_destroy(w);
   pane_destroy(c->pane);
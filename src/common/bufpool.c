@@ -0,0 +1,110 @@
+/**
+ * bufpool.c - muxkit 协议缓冲区池实现
+ *
+ * - 申请时向上取到 2 的幂，命中空闲链表直接返回，否则 malloc
+ * - 归还时挂回对应一级的链表头，池中缓存超出上限时直接释放
+ * - 扩容换到更大一级再拷贝已用部分，不用 realloc，旧缓冲区还能被复用
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bufpool.h"
+#include "log.h"
+#include "main.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFPOOL_MAX ((size_t)1 << (BUFPOOL_MIN_SHIFT + BUFPOOL_CLASSES - 1))
+
+struct bufpool_free {
+  struct bufpool_free *next;
+};
+
+static struct bufpool_free *free_lists[BUFPOOL_CLASSES];
+static struct bufpool_stats stats;
+
+/*
+  size 所在的级别，超过最大一级返回 -1
+*/
+static int bufpool_class(size_t size) {
+  if (size > BUFPOOL_MAX)
+    return -1;
+  int c = 0;
+  while (((size_t)1 << (BUFPOOL_MIN_SHIFT + c)) < size)
+    c++;
+  return c;
+}
+
+void *bufpool_get(size_t size, size_t *cap) {
+  stats.gets++;
+  int c = bufpool_class(size);
+  size_t n = c < 0 ? size : (size_t)1 << (BUFPOOL_MIN_SHIFT + c);
+  if (c >= 0 && free_lists[c]) {
+    struct bufpool_free *b = free_lists[c];
+    free_lists[c] = b->next;
+    stats.hits++;
+    stats.cached -= n;
+    *cap = n;
+    return b;
+  }
+  void *buf = malloc(n);
+  if (!buf) {
+    log_error("malloc %zu byte buffer failed", n);
+    return NULL;
+  }
+  stats.mallocs++;
+  *cap = n;
+  return buf;
+}
+
+void *bufpool_grow(void *buf, size_t used, size_t *cap, size_t need) {
+  if (buf && need <= *cap)
+    return buf;
+  size_t n;
+  void *grown = bufpool_get(need, &n);
+  if (!grown)
+    return NULL;
+  if (used)
+    memcpy(grown, buf, used);
+  bufpool_put(buf, *cap);
+  *cap = n;
+  return grown;
+}
+
+void bufpool_put(void *buf, size_t cap) {
+  if (!buf)
+    return;
+  stats.puts++;
+  int c = bufpool_class(cap);
+  if (c < 0 || ((size_t)1 << (BUFPOOL_MIN_SHIFT + c)) != cap ||
+      stats.cached + cap > MUXKIT_BUFPOOL_BYTES) {
+    stats.frees++;
+    free(buf);
+    return;
+  }
+  struct bufpool_free *b = buf;
+  b->next = free_lists[c];
+  free_lists[c] = b;
+  stats.cached += cap;
+}
+
+const struct bufpool_stats *bufpool_stats(void) { return &stats; }
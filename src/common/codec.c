@@ -0,0 +1,188 @@
+/**
+ * codec.c - muxkit 数据编解码模块实现
+ *
+ * LZ 压缩：
+ * - 4096 项哈希表记录每个 4 字节前缀最近出现的位置，只查一个候选
+ * - 偏移最大 65535，匹配最短 4 字节
+ * - 解压逐字节复制匹配，允许源和目标重叠（用于长游程）
+ *
+ * CRC32 使用 16 项半字节查找表，表是常量，可在任意线程中调用。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "codec.h"
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+size_t lz_bound(size_t len) { return len + len / 255 + 16; }
+
+/*
+  写入扩展长度：若干个 255 加一个余数
+*/
+static uint8_t *lz_put_ext(uint8_t *op, size_t n) {
+  for (; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = (uint8_t)n;
+  return op;
+}
+
+/*
+  输出一个序列，mlen 为 0 表示只有字面量的最后一个序列
+*/
+static int lz_emit(uint8_t **opp, const uint8_t *oend, const uint8_t *lit,
+                   size_t nlit, size_t off, size_t mlen) {
+  uint8_t *op = *opp;
+  size_t ml = mlen ? mlen - LZ_MIN_MATCH : 0;
+  size_t need = 1 + nlit / 255 + 1 + nlit + 2 + ml / 255 + 1;
+  if ((size_t)(oend - op) < need)
+    return 0;
+
+  uint8_t *token = op++;
+  *token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+  if (nlit >= 15)
+    op = lz_put_ext(op, nlit - 15);
+  memcpy(op, lit, nlit);
+  op += nlit;
+  if (mlen) {
+    *op++ = (uint8_t)(off & 0xff);
+    *op++ = (uint8_t)(off >> 8);
+    *token |= (uint8_t)(ml < 15 ? ml : 15);
+    if (ml >= 15)
+      op = lz_put_ext(op, ml - 15);
+  }
+  *opp = op;
+  return 1;
+}
+
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap) {
+  const uint8_t *base = src;
+  const uint8_t *end = base + len;
+  const uint8_t *ip = base;
+  const uint8_t *anchor = base;
+  uint8_t *op = dst;
+  const uint8_t *oend = op + cap;
+  uint32_t table[1 << LZ_HASH_BITS]; // 位置 + 1，0 表示空
+  memset(table, 0, sizeof(table));
+
+  while (len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+    uint32_t seq;
+    memcpy(&seq, ip, sizeof(seq));
+    uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    uint32_t cand = table[h];
+    table[h] = (uint32_t)(ip - base) + 1;
+    if (cand) {
+      const uint8_t *ref = base + cand - 1;
+      uint32_t rseq;
+      memcpy(&rseq, ref, sizeof(rseq));
+      if (ip - ref <= LZ_MAX_OFFSET && rseq == seq) {
+        size_t mlen = LZ_MIN_MATCH;
+        while (ip + mlen < end && ref[mlen] == ip[mlen])
+          mlen++;
+        if (!lz_emit(&op, oend, anchor, ip - anchor, ip - ref, mlen))
+          return 0;
+        ip += mlen;
+        anchor = ip;
+        continue;
+      }
+    }
+    ip++;
+  }
+
+  // 剩余的字面量
+  if (!lz_emit(&op, oend, anchor, end - anchor, 0, 0))
+    return 0;
+  return op - (uint8_t *)dst;
+}
+
+/*
+  读取扩展长度，越界返回 -1
+*/
+static int lz_get_ext(const uint8_t **ipp, const uint8_t *iend, size_t *n) {
+  const uint8_t *ip = *ipp;
+  uint8_t b;
+  do {
+    if (ip >= iend)
+      return -1;
+    b = *ip++;
+    *n += b;
+  } while (b == 255);
+  *ipp = ip;
+  return 0;
+}
+
+long lz_decompress(const void *src, size_t len, void *dst, size_t cap) {
+  const uint8_t *ip = src;
+  const uint8_t *iend = ip + len;
+  uint8_t *op = dst;
+  uint8_t *oend = op + cap;
+
+  while (ip < iend) {
+    unsigned int token = *ip++;
+    size_t nlit = token >> 4;
+    if (nlit == 15 && lz_get_ext(&ip, iend, &nlit) < 0)
+      return -1;
+    if (nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op))
+      return -1;
+    memcpy(op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip >= iend) // 最后一个序列
+      break;
+
+    if (iend - ip < 2)
+      return -1;
+    size_t off = ip[0] | (size_t)ip[1] << 8;
+    ip += 2;
+    size_t mlen = token & 15;
+    if (mlen == 15 && lz_get_ext(&ip, iend, &mlen) < 0)
+      return -1;
+    mlen += LZ_MIN_MATCH;
+    if (off == 0 || off > (size_t)(op - (uint8_t *)dst) ||
+        mlen > (size_t)(oend - op))
+      return -1;
+    // 可能与输出重叠，逐字节复制
+    const uint8_t *ref = op - off;
+    for (size_t i = 0; i < mlen; i++)
+      op[i] = ref[i];
+    op += mlen;
+  }
+  return op - (uint8_t *)dst;
+}
+
+uint32_t crc32(uint32_t crc, const void *buf, size_t len) {
+  static const uint32_t table[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+  const uint8_t *p = buf;
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= p[i];
+    crc = (crc >> 4) ^ table[crc & 15];
+    crc = (crc >> 4) ^ table[crc & 15];
+  }
+  return ~crc;
+}
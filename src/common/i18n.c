@@ -52,8 +52,11 @@ static const char *messages_en[MSG_COUNT] = {
     [MSG_HELP_OPTIONS] = "Options:\n",
     [MSG_HELP_OPT_LIST] = "  -l         List all sessions\n",
     [MSG_HELP_OPT_ATTACH] = "  -s <id>    Attach to detached session by id\n",
+    [MSG_HELP_OPT_WATCH] = "  -w, --watch <id>  Watch a session read-only\n",
+    [MSG_HELP_OPT_LATENCY] = "  -L, --latency <id>  Show key-to-screen latency of a session\n",
     [MSG_HELP_OPT_KILL] = "  -k <id>    Kill session by id\n",
     [MSG_HELP_OPT_NEW] = "  -n, --new-session  Create a new session in background\n",
+    [MSG_HELP_OPT_RESTORE] = "  -R, --restore  Restore sessions from checkpoints\n",
     [MSG_HELP_OPT_HELP] = "  -h         Show this help message\n\n",
     [MSG_HELP_KEYBINDINGS] = "Key bindings:\n",
     [MSG_HELP_KEY_DETACH] = "  Ctrl+B d   Detach from current session\n",
@@ -66,8 +69,11 @@ static const char *messages_en[MSG_COUNT] = {
     [MSG_HELP_EX_NEW] = "  %s           Start a new session\n",
     [MSG_HELP_EX_LIST] = "  %s -l        List all sessions\n",
     [MSG_HELP_EX_ATTACH] = "  %s -s 0      Attach to session 0\n",
+    [MSG_HELP_EX_WATCH] = "  %s -w 0      Watch session 0 alongside its owner\n",
+    [MSG_HELP_EX_LATENCY] = "  %s -L 0      Show latency percentiles of session 0\n",
     [MSG_HELP_EX_KILL] = "  %s -k 0      Kill session 0\n",
     [MSG_HELP_EX_NEW_DETACH] = "  %s --new-session  Create a new detached session\n",
+    [MSG_HELP_EX_RESTORE] = "  %s -R        Restore sessions after a server restart\n",
 
     /* 错误信息 - 各类操作失败时显示 */
     [MSG_ERR_MKDIR] = "mkdir failed\n",
@@ -87,7 +93,10 @@ static const char *messages_en[MSG_COUNT] = {
     [MSG_SESSION_NOT_FOUND] = "session %d not found\n",
     [MSG_ATTACH_FAILED] =
         "attach failed: session %d not found or not detached\n",
+    [MSG_SESSIONS_RESTORED] = "restored %d sessions (%d panes) in %.1f ms\n",
     [MSG_NESTED_WARNING] = "sessions should be nested with care\n",
+    [MSG_LATENCY_TITLE] = "Session %d key-to-screen latency (microseconds):\n",
+    [MSG_LATENCY_NONE] = "Session %d has no latency samples yet\n",
 
     /* 状态栏 - 底部状态栏显示的文本 */
     [MSG_STATUS_HISTORY] = "[history]",
@@ -109,8 +118,11 @@ static const char *messages_zh[MSG_COUNT] = {
     [MSG_HELP_OPTIONS] = "选项:\n",
     [MSG_HELP_OPT_LIST] = "  -l         列出所有会话\n",
     [MSG_HELP_OPT_ATTACH] = "  -s <id>    连接到指定会话\n",
+    [MSG_HELP_OPT_WATCH] = "  -w, --watch <id>  以只读方式观察会话\n",
+    [MSG_HELP_OPT_LATENCY] = "  -L, --latency <id>  显示会话按键到屏幕的延迟\n",
     [MSG_HELP_OPT_KILL] = "  -k <id>    终止指定会话\n",
     [MSG_HELP_OPT_NEW] = "  -n, --new-session  在后台创建新会话\n",
+    [MSG_HELP_OPT_RESTORE] = "  -R, --restore  从检查点恢复会话\n",
     [MSG_HELP_OPT_HELP] = "  -h         显示帮助信息\n\n",
     [MSG_HELP_KEYBINDINGS] = "快捷键:\n",
     [MSG_HELP_KEY_DETACH] = "  Ctrl+B d   分离当前会话\n",
@@ -123,8 +135,11 @@ static const char *messages_zh[MSG_COUNT] = {
     [MSG_HELP_EX_NEW] = "  %s           启动新会话\n",
     [MSG_HELP_EX_LIST] = "  %s -l        列出所有会话\n",
     [MSG_HELP_EX_ATTACH] = "  %s -s 0      连接到会话 0\n",
+    [MSG_HELP_EX_WATCH] = "  %s -w 0      与会话 0 的使用者一起观察\n",
+    [MSG_HELP_EX_LATENCY] = "  %s -L 0      查看会话 0 的延迟分位数\n",
     [MSG_HELP_EX_KILL] = "  %s -k 0      终止会话 0\n",
     [MSG_HELP_EX_NEW_DETACH] = "  %s --new-session  创建后台会话\n",
+    [MSG_HELP_EX_RESTORE] = "  %s -R        服务端重启后恢复会话\n",
 
     /* 错误信息 - 各类操作失败时显示 */
     [MSG_ERR_MKDIR] = "创建目录失败\n",
@@ -143,7 +158,10 @@ static const char *messages_zh[MSG_COUNT] = {
     [MSG_SESSION_KILLED] = "已终止会话 %d\n",
     [MSG_SESSION_NOT_FOUND] = "会话 %d 不存在\n",
     [MSG_ATTACH_FAILED] = "连接失败: 会话 %d 不存在或未分离\n",
+    [MSG_SESSIONS_RESTORED] = "已恢复 %d 个会话 (%d 个窗格)，耗时 %.1f 毫秒\n",
     [MSG_NESTED_WARNING] = "警告: 不建议嵌套运行会话\n",
+    [MSG_LATENCY_TITLE] = "会话 %d 按键到屏幕的延迟（微秒）:\n",
+    [MSG_LATENCY_NONE] = "会话 %d 还没有延迟样本\n",
 
     /* 状态栏 - 底部状态栏显示的文本 */
     [MSG_STATUS_HISTORY] = "[历史]",
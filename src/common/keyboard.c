@@ -119,9 +119,8 @@ void handle_key(struct client *c, enum key_table table, char key) {
     }
   }
   // 没有匹配的快捷键，发送 Ctrl+B + 原字符到 PTY
-  char cb = 0x02;
-  write(c->pane->master_fd, &cb, 1);
-  write(c->pane->master_fd, &key, 1);
+  char seq[2] = {0x02, key};
+  pane_write(c->pane, seq, sizeof(seq));
 }
 void keybind_init() {
   keybinds[keybind_count++] = (struct keybind){'d', KEY_PREFIX, detach_session};
@@ -0,0 +1,124 @@
+/**
+ * latency.c - muxkit 延迟直方图实现
+ *
+ * 桶编号：小于 LAT_SUB 的值各占一桶；更大的值按最高位 o 所在的
+ * 2 的幂区间分组，区间内用最高位之后的 LAT_SUB_BITS 位选子桶。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "latency.h"
+#include <stdio.h>
+#include <time.h>
+
+uint64_t latency_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int bucket_of(uint64_t us) {
+  if (us < LAT_SUB)
+    return (unsigned int)us;
+  unsigned int o = 63 - __builtin_clzll(us);
+  unsigned int sub = (unsigned int)(us >> (o - LAT_SUB_BITS)) & (LAT_SUB - 1);
+  unsigned int idx = (o - LAT_SUB_BITS + 1) * LAT_SUB + sub;
+  return idx < LAT_BUCKETS ? idx : LAT_BUCKETS - 1;
+}
+
+/*
+  桶的下界
+*/
+static uint64_t bucket_low(unsigned int idx) {
+  if (idx < LAT_SUB)
+    return idx;
+  unsigned int o = idx / LAT_SUB + LAT_SUB_BITS - 1;
+  return (uint64_t)(LAT_SUB + idx % LAT_SUB) << (o - LAT_SUB_BITS);
+}
+
+void latency_record(struct latency_hist *h, uint64_t us) {
+  h->buckets[bucket_of(us)]++;
+  h->count++;
+  h->sum_us += us;
+  if (us > h->max_us)
+    h->max_us = us;
+}
+
+void latency_merge(struct latency_hist *dst, const struct latency_hist *src) {
+  for (int i = 0; i < LAT_BUCKETS; i++)
+    dst->buckets[i] += src->buckets[i];
+  dst->count += src->count;
+  dst->sum_us += src->sum_us;
+  if (src->max_us > dst->max_us)
+    dst->max_us = src->max_us;
+}
+
+uint64_t latency_percentile(const struct latency_hist *h, double pct) {
+  if (h->count == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(pct / 100 * h->count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < LAT_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      if (i == LAT_BUCKETS - 1)
+        return h->max_us;
+      uint64_t mid = (bucket_low(i) + bucket_low(i + 1)) / 2;
+      return mid < h->max_us ? mid : h->max_us;
+    }
+  }
+  return h->max_us;
+}
+
+const char *latency_stage_name(enum lat_stage stage) {
+  static const char *names[LAT_STAGES] = {"write", "echo", "render", "total"};
+  return stage < LAT_STAGES ? names[stage] : "?";
+}
+
+size_t latency_format(char *buf, size_t size, const char *label,
+                      const struct latency_hist *stages) {
+  size_t off = 0;
+  if (size == 0)
+    return 0;
+  buf[0] = '\0';
+  for (int s = 0; s < LAT_STAGES && off + 1 < size; s++) {
+    const struct latency_hist *h = &stages[s];
+    if (h->count == 0)
+      continue;
+    int n = snprintf(buf + off, size - off,
+                     "%-10s %-6s n=%-8llu avg=%-8llu p50=%-8llu p99=%-8llu "
+                     "p999=%-8llu max=%llu\n",
+                     label, latency_stage_name(s),
+                     (unsigned long long)h->count,
+                     (unsigned long long)(h->sum_us / h->count),
+                     (unsigned long long)latency_percentile(h, 50),
+                     (unsigned long long)latency_percentile(h, 99),
+                     (unsigned long long)latency_percentile(h, 99.9),
+                     (unsigned long long)h->max_us);
+    if (n < 0)
+      break;
+    off += (size_t)n < size - off ? (size_t)n : size - off - 1;
+  }
+  return off;
+}
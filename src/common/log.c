@@ -4,7 +4,12 @@
  * 本模块实现简单的日志功能：
  * - 输出到 stderr 和文件
  * - 日志格式：[时间] [级别] [文件:行号] 消息
- * - 行缓冲模式确保实时写入
+ * - 调用处只把参数写进环形缓冲，log_flush 时再格式化，一批日志一次写出
+ *
+ * 缓冲中的一条记录：
+ *   struct log_rec | 参数...
+ * 数值参数各占一个 union log_arg，字符串为 2 字节长度加内容（不含 '\0'）。
+ * 记录只在本进程内使用，调用点和格式串直接存指针。
  *
  * 日志文件位置：
  *   /tmp/muxkit-<uid>/client.log
@@ -36,9 +41,13 @@
 #include "log.h"
 #include "main.h"
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 extern char *socket_path;
 
@@ -48,7 +57,83 @@ static const char *log_name = "unknown";
 
 static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
 
+/* 参数类型，决定取参数和格式化时使用的 C 类型 */
+enum {
+  ARG_INT,     /* int、char、short（%d %c %hd 等） */
+  ARG_PREC,    /* 精度 '*'，限制随后字符串的拷贝长度 */
+  ARG_LONG,    /* %ld */
+  ARG_LLONG,   /* %lld */
+  ARG_SIZE,    /* %zu */
+  ARG_INTMAX,  /* %jd */
+  ARG_PTRDIFF, /* %td */
+  ARG_DOUBLE,  /* %f %g 等 */
+  ARG_LDOUBLE, /* %Lf，按 double 保存 */
+  ARG_PTR,     /* %p */
+  ARG_STR,     /* %s，拷贝内容 */
+  ARG_RAW,     /* 格式串无法解析：整条在调用处格式化成字符串 */
+};
+
+union log_arg {
+  int i;
+  long l;
+  long long ll;
+  size_t z;
+  intmax_t j;
+  ptrdiff_t t;
+  double d;
+  void *p;
+};
+
+/*
+  记录头
+*/
+struct log_rec {
+  const struct log_site *site; /* 调用点 */
+  time_t sec;                  /* 时间 */
+  size_t len;                  /* 整条记录的字节数 */
+};
+
+#define LOG_REC_MAX MUXKIT_BUF_LARGE /* 一条记录的上限，超出的字符串截断 */
+#define LOG_LINE_MAX (MUXKIT_BUF_LARGE + MUXKIT_BUF_MEDIUM)
+
+static unsigned char log_ring[MUXKIT_LOG_RING];
+static size_t ring_head;      /* 累计写入的字节数 */
+static size_t ring_tail;      /* 累计读出的字节数 */
+static unsigned long dropped; /* 缓冲写满而丢弃的日志数 */
+static pid_t ring_pid;        /* 缓冲所属的进程，fork 出的子进程不写出父进程的日志 */
+
+static void ring_put(const void *data, size_t n) {
+  size_t off = ring_head % MUXKIT_LOG_RING;
+  size_t first = MUXKIT_LOG_RING - off < n ? MUXKIT_LOG_RING - off : n;
+  memcpy(log_ring + off, data, first);
+  memcpy(log_ring, (const unsigned char *)data + first, n - first);
+  ring_head += n;
+}
+
+static void ring_get(void *data, size_t n) {
+  size_t off = ring_tail % MUXKIT_LOG_RING;
+  size_t first = MUXKIT_LOG_RING - off < n ? MUXKIT_LOG_RING - off : n;
+  memcpy(data, log_ring + off, first);
+  memcpy((unsigned char *)data + first, log_ring, n - first);
+  ring_tail += n;
+}
+
+/*
+  丢掉从父进程继承来的日志，缓冲归当前进程
+*/
+static void ring_adopt(void) {
+  pid_t pid = getpid();
+  if (ring_pid != pid) {
+    ring_tail = ring_head;
+    dropped = 0;
+    ring_pid = pid;
+  }
+}
+
 void log_init(const char *name) {
+  // 之前的日志照旧只写到 stderr
+  log_flush();
+  ring_adopt();
   log_name = name;
 
   // 从 socket_path 提取目录，创建日志文件
@@ -62,14 +147,13 @@ void log_init(const char *name) {
     } else {
       snprintf(log_path, sizeof(log_path), "%s.log", name);
     }
+    // 全缓冲，每次 log_flush 结束时写出
     log_fp = fopen(log_path, "a");
-    if (log_fp) {
-      setvbuf(log_fp, NULL, _IOLBF, 0); // 行缓冲
-    }
   }
 }
 
 void log_close(void) {
+  log_flush();
   if (log_fp) {
     fclose(log_fp);
     log_fp = NULL;
@@ -78,38 +162,389 @@ void log_close(void) {
 
 void log_set_level(log_level_t level) { min_level = level; }
 
-void log_write(log_level_t level, const char *file, int line, const char *fmt,
-               ...) {
-  if (level < min_level)
+/*
+  解析格式串，按顺序记下每个参数的类型（宽度和精度的 '*' 各占一个 int）。
+  位置参数、%n、宽字符串或参数太多时退回到调用处格式化
+*/
+static void log_parse(struct log_site *site, const char *fmt) {
+  int n = 0;
+  site->fmt = fmt;
+  for (const char *p = fmt; *p; p++) {
+    if (*p != '%')
+      continue;
+    if (*++p == '%')
+      continue;
+    p += strspn(p, "-+ #0");
+    int stars[2], nstar = 0;
+    if (*p == '*') {
+      stars[nstar++] = ARG_INT;
+      p++;
+    }
+    p += strspn(p, "0123456789");
+    if (*p == '.') {
+      p++;
+      if (*p == '*') {
+        stars[nstar++] = ARG_PREC;
+        p++;
+      }
+      p += strspn(p, "0123456789");
+    }
+    int type = ARG_INT;
+    if (p[0] == 'h') {
+      p += p[1] == 'h' ? 2 : 1;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+      type = ARG_LLONG;
+      p += 2;
+    } else if (*p == 'l') {
+      type = ARG_LONG;
+      p++;
+    } else if (*p == 'q') {
+      type = ARG_LLONG;
+      p++;
+    } else if (*p == 'z') {
+      type = ARG_SIZE;
+      p++;
+    } else if (*p == 'j') {
+      type = ARG_INTMAX;
+      p++;
+    } else if (*p == 't') {
+      type = ARG_PTRDIFF;
+      p++;
+    } else if (*p == 'L') {
+      type = ARG_LDOUBLE;
+      p++;
+    }
+    switch (*p) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+      if (type == ARG_LDOUBLE)
+        goto raw;
+      break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a':
+    case 'A':
+      if (type != ARG_LDOUBLE)
+        type = ARG_DOUBLE;
+      break;
+    case 's':
+      if (type != ARG_INT)
+        goto raw;
+      type = ARG_STR;
+      break;
+    case 'p':
+      type = ARG_PTR;
+      break;
+    default:
+      goto raw;
+    }
+    if (n + nstar + 1 > LOG_MAX_ARGS)
+      goto raw;
+    for (int i = 0; i < nstar; i++)
+      site->types[n++] = stars[i];
+    site->types[n++] = type;
+  }
+  site->nargs = n;
+  return;
+
+raw:
+  site->types[0] = ARG_RAW;
+  site->nargs = 1;
+}
+
+void log_event(struct log_site *site, const char *fmt, ...) {
+  if (site->level < min_level)
     return;
+  if (site->nargs < 0)
+    log_parse(site, fmt);
+  if (!ring_pid) {
+    ring_pid = getpid();
+    atexit(log_flush);
+  }
 
-  // 获取时间戳
-  time_t now = time(NULL);
-  struct tm *tm_info = localtime(&now);
-  char time_buf[32];
-  strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm_info);
+  unsigned char rec[LOG_REC_MAX];
+  size_t len = sizeof(struct log_rec);
+  int prec = -1;
+  va_list ap;
+  va_start(ap, fmt);
+  for (int i = 0; i < site->nargs; i++) {
+    union log_arg a;
+    if (len + sizeof(a) > LOG_REC_MAX)
+      break;
+    memset(&a, 0, sizeof(a));
+    switch (site->types[i]) {
+    case ARG_INT:
+      a.i = va_arg(ap, int);
+      break;
+    case ARG_PREC:
+      a.i = prec = va_arg(ap, int);
+      break;
+    case ARG_LONG:
+      a.l = va_arg(ap, long);
+      break;
+    case ARG_LLONG:
+      a.ll = va_arg(ap, long long);
+      break;
+    case ARG_SIZE:
+      a.z = va_arg(ap, size_t);
+      break;
+    case ARG_INTMAX:
+      a.j = va_arg(ap, intmax_t);
+      break;
+    case ARG_PTRDIFF:
+      a.t = va_arg(ap, ptrdiff_t);
+      break;
+    case ARG_DOUBLE:
+      a.d = va_arg(ap, double);
+      break;
+    case ARG_LDOUBLE:
+      a.d = (double)va_arg(ap, long double);
+      break;
+    case ARG_PTR:
+      a.p = va_arg(ap, void *);
+      break;
+    case ARG_STR:
+    case ARG_RAW: {
+      // 字符串：2 字节长度加内容，放不下的部分截断
+      unsigned short n = 0;
+      size_t room = LOG_REC_MAX - len - sizeof(n);
+      if (site->types[i] == ARG_RAW) {
+        int r = vsnprintf((char *)rec + len + sizeof(n), room, fmt, ap);
+        n = r < 0 ? 0 : (size_t)r < room ? (size_t)r : room - 1;
+      } else {
+        const char *str = va_arg(ap, const char *);
+        if (!str)
+          str = "(null)";
+        n = strnlen(str, prec >= 0 && (size_t)prec < room ? (size_t)prec
+                                                          : room - 1);
+        memcpy(rec + len + sizeof(n), str, n);
+        prec = -1;
+      }
+      memcpy(rec + len, &n, sizeof(n));
+      len += sizeof(n) + n;
+      continue;
+    }
+    }
+    memcpy(rec + len, &a, sizeof(a));
+    len += sizeof(a);
+  }
+  va_end(ap);
 
-  // 提取文件名
-  const char *base = strrchr(file, '/');
-  base = base ? base + 1 : file;
+  struct log_rec h = {site, 0, len};
+#ifdef CLOCK_REALTIME_COARSE
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  h.sec = ts.tv_sec;
+#else
+  h.sec = time(NULL);
+#endif
+  memcpy(rec, &h, sizeof(h));
+  if (MUXKIT_LOG_RING - (ring_head - ring_tail) < len) {
+    dropped++;
+    return;
+  }
+  ring_put(rec, len);
 
-  // 格式化用户消息
-  char msg[MUXKIT_BUF_LARGE];
-  va_list args;
-  va_start(args, fmt);
-  vsnprintf(msg, sizeof(msg), fmt, args);
-  va_end(args);
+  // 错误日志不等到空闲，避免随后崩溃时丢失
+  if (site->level >= LOG_ERROR)
+    log_flush();
+}
 
-  // 完整日志行
-  char log_line[MUXKIT_BUF_LARGE + MUXKIT_BUF_MEDIUM];
-  snprintf(log_line, sizeof(log_line), "[%s] [%s] [%s:%d] %s\n", time_buf,
-           level_names[level], base, line, msg);
+/*
+  按格式串还原一条消息，args 是记录头之后的参数
+*/
+static size_t log_format(char *buf, size_t size, const struct log_site *site,
+                         const unsigned char *args, size_t alen) {
+  size_t off = 0, pos = 0;
+  int idx = 0;
+  char str[LOG_REC_MAX];
 
-  // 输出到 stderr
-  fputs(log_line, stderr);
+#define ARG_NEXT(a)                                                            \
+  do {                                                                         \
+    memset(&(a), 0, sizeof(a));                                                \
+    if (pos + sizeof(a) <= alen)                                               \
+      memcpy(&(a), args + pos, sizeof(a));                                     \
+    pos += sizeof(a);                                                          \
+    idx++;                                                                     \
+  } while (0)
+#define STR_NEXT()                                                             \
+  do {                                                                         \
+    unsigned short n = 0;                                                      \
+    if (pos + sizeof(n) <= alen)                                               \
+      memcpy(&n, args + pos, sizeof(n));                                       \
+    pos += sizeof(n);                                                          \
+    if (pos + n > alen)                                                        \
+      n = pos < alen ? alen - pos : 0;                                         \
+    memcpy(str, args + pos, n);                                                \
+    str[n] = '\0';                                                             \
+    pos += n;                                                                  \
+    idx++;                                                                     \
+  } while (0)
 
-  // 输出到文件
-  if (log_fp) {
-    fputs(log_line, log_fp);
+  if (site->types[0] == ARG_RAW) {
+    STR_NEXT();
+    snprintf(buf, size, "%s", str);
+    return strlen(buf);
+  }
+
+  const char *p = site->fmt;
+  while (*p && off + 1 < size) {
+    if (*p != '%' || p[1] == '%') {
+      buf[off++] = *p;
+      p += *p == '%' ? 2 : 1;
+      continue;
+    }
+    // 一个转换说明，原样交给 snprintf
+    size_t slen = 1 + strspn(p + 1, "-+ #0123456789.*hlqzjtL");
+    if (!p[slen] || slen + 2 > MUXKIT_BUF_SMALL)
+      break;
+    char spec[MUXKIT_BUF_SMALL];
+    memcpy(spec, p, slen + 1);
+    spec[slen + 1] = '\0';
+    p += slen + 1;
+
+    int star[2] = {0, 0}, nstar = 0;
+    for (const char *q = spec; *q && nstar < 2; q++) {
+      if (*q == '*') {
+        union log_arg a;
+        ARG_NEXT(a);
+        star[nstar++] = a.i;
+      }
+    }
+
+#define LOG_FMT(v)                                                             \
+  (nstar == 0   ? snprintf(buf + off, size - off, spec, v)                    \
+   : nstar == 1 ? snprintf(buf + off, size - off, spec, star[0], v)           \
+                : snprintf(buf + off, size - off, spec, star[0], star[1], v))
+
+    int n = 0;
+    union log_arg a;
+    switch (idx < site->nargs ? site->types[idx] : ARG_RAW) {
+    case ARG_STR:
+      STR_NEXT();
+      n = LOG_FMT(str);
+      break;
+    case ARG_LONG:
+      ARG_NEXT(a);
+      n = LOG_FMT(a.l);
+      break;
+    case ARG_LLONG:
+      ARG_NEXT(a);
+      n = LOG_FMT(a.ll);
+      break;
+    case ARG_SIZE:
+      ARG_NEXT(a);
+      n = LOG_FMT(a.z);
+      break;
+    case ARG_INTMAX:
+      ARG_NEXT(a);
+      n = LOG_FMT(a.j);
+      break;
+    case ARG_PTRDIFF:
+      ARG_NEXT(a);
+      n = LOG_FMT(a.t);
+      break;
+    case ARG_DOUBLE:
+      ARG_NEXT(a);
+      n = LOG_FMT(a.d);
+      break;
+    case ARG_LDOUBLE:
+      ARG_NEXT(a);
+      n = LOG_FMT((long double)a.d);
+      break;
+    case ARG_PTR:
+      ARG_NEXT(a);
+      n = LOG_FMT(a.p);
+      break;
+    case ARG_INT:
+    case ARG_PREC:
+      ARG_NEXT(a);
+      n = LOG_FMT(a.i);
+      break;
+    default:
+      n = 0;
+    }
+#undef LOG_FMT
+    if (n < 0)
+      break;
+    off += (size_t)n < size - off ? (size_t)n : size - off - 1;
+  }
+  buf[off] = '\0';
+  return off;
+#undef ARG_NEXT
+#undef STR_NEXT
+}
+
+/*
+  一批日志写到 stderr 和日志文件
+*/
+static void log_output(const char *buf, size_t len) {
+  if (len == 0)
+    return;
+  fwrite(buf, 1, len, stderr);
+  if (log_fp)
+    fwrite(buf, 1, len, log_fp);
+}
+
+void log_flush(void) {
+  if (ring_head == ring_tail && !dropped)
+    return;
+  ring_adopt();
+
+  static char out[4 * LOG_LINE_MAX];
+  static time_t cached_sec = -1;
+  static char time_buf[32];
+  size_t used = 0;
+  unsigned char rec[LOG_REC_MAX];
+
+  while (ring_head != ring_tail || dropped) {
+    struct log_rec h;
+    char line[LOG_LINE_MAX];
+    char msg[MUXKIT_BUF_LARGE];
+    const char *level;
+    const char *file;
+    int lineno;
+
+    if (ring_head != ring_tail) {
+      ring_get(&h, sizeof(h));
+      ring_get(rec, h.len - sizeof(h));
+      log_format(msg, sizeof(msg), h.site, rec, h.len - sizeof(h));
+      level = level_names[h.site->level];
+      file = h.site->file;
+      lineno = h.site->line;
+    } else {
+      // 缓冲写满丢掉的日志，排在最后报告一次
+      h.sec = time(NULL);
+      snprintf(msg, sizeof(msg), "%lu log messages dropped", dropped);
+      dropped = 0;
+      level = level_names[LOG_WARN];
+      file = __FILE__;
+      lineno = __LINE__;
+    }
+
+    // 同一秒内的日志共用格式化好的时间
+    if (h.sec != cached_sec) {
+      struct tm tm_info;
+      localtime_r(&h.sec, &tm_info);
+      strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm_info);
+      cached_sec = h.sec;
+    }
+
+    // 提取文件名
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+
+    int n = snprintf(line, sizeof(line), "[%s] [%s] [%s:%d] %s\n", time_buf,
+                     level, base, lineno, msg);
+    if (n < 0)
+      continue;
+    if ((size_t)n >= sizeof(line))
+      n = sizeof(line) - 1;
+    if (used + n > sizeof(out)) {
+      log_output(out, used);
+      used = 0;
+    }
+    memcpy(out + used, line, n);
+    used += n;
   }
+  log_output(out, used);
+  if (log_fp)
+    fflush(log_fp);
 }
@@ -0,0 +1,215 @@
+/**
+ * protocol.c - muxkit 消息收发实现
+ *
+ * 发送：每条消息两个 iovec（头和负载），一批消息一次 writev，
+ * 部分写入时跳过已写完的 iovec 继续写。
+ *
+ * 接收：每次 recvmsg 前把未解析的剩余数据移到缓冲区开头，
+ * 缓冲区按需翻倍，最多到一条最大消息的大小。
+ * 一次 recvmsg 最多带回一个 send_fd 的 fd（内核在带 fd 的数据段处停止），
+ * 所以 fd 队列和数据流中的占位字节一一对应。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "muxkit-protocol.h"
+#include "bufpool.h"
+#include "log.h"
+#include "main.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+int msg_send(int fd, const struct msg_out *msgs, int count) {
+  struct msg_header hdrs[MSG_BATCH_MAX];
+  struct iovec iov[MSG_BATCH_MAX * 2];
+  int n = 0;
+  if (count > MSG_BATCH_MAX)
+    return -1;
+  for (int i = 0; i < count; i++) {
+    hdrs[i].type = msgs[i].type;
+    hdrs[i].len = msgs[i].len;
+    iov[n].iov_base = &hdrs[i];
+    iov[n].iov_len = sizeof(hdrs[i]);
+    n++;
+    if (msgs[i].len) {
+      iov[n].iov_base = (void *)msgs[i].data;
+      iov[n].iov_len = msgs[i].len;
+      n++;
+    }
+  }
+
+  struct iovec *v = iov;
+  while (n > 0) {
+    ssize_t w = writev(fd, v, n);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue; // 被信号打断，重试
+      return -1;
+    }
+    // 跳过已写完的 iovec，剩余部分继续写
+    while (n > 0 && (size_t)w >= v->iov_len) {
+      w -= v->iov_len;
+      v++;
+      n--;
+    }
+    if (n > 0) {
+      v->iov_base = (char *)v->iov_base + w;
+      v->iov_len -= w;
+    }
+  }
+  return 0;
+}
+
+int msg_reader_init(struct msg_reader *r, size_t max_payload) {
+  memset(r, 0, sizeof(*r));
+  r->max = sizeof(struct msg_header) + max_payload;
+  r->buf = bufpool_get(MUXKIT_BUF_XLARGE, &r->cap);
+  return r->buf ? 0 : -1;
+}
+
+void msg_reader_free(struct msg_reader *r) {
+  for (int i = 0; i < r->nfds; i++)
+    close(r->fds[i]);
+  bufpool_put(r->buf, r->cap);
+  memset(r, 0, sizeof(*r));
+}
+
+/*
+  把未解析的数据移到开头，缓冲区已满时翻倍；
+  大消息撑大的缓冲区取空后还回池中，换回小的
+*/
+static int reader_make_room(struct msg_reader *r) {
+  if (r->start > 0) {
+    memmove(r->buf, r->buf + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+  }
+  if (r->end == 0 && r->cap > MUXKIT_BUFPOOL_IDLE) {
+    size_t cap;
+    char *buf = bufpool_get(MUXKIT_BUF_XLARGE, &cap);
+    if (buf) {
+      bufpool_put(r->buf, r->cap);
+      r->buf = buf;
+      r->cap = cap;
+    }
+  }
+  if (r->end < r->cap)
+    return 0;
+  if (r->cap >= r->max) {
+    log_error("receive buffer full (%zu bytes)", r->cap);
+    return -1;
+  }
+  size_t need = r->cap * 2 < r->max ? r->cap * 2 : r->max;
+  char *buf = bufpool_grow(r->buf, r->end, &r->cap, need);
+  if (!buf) {
+    log_error("grow receive buffer failed");
+    return -1;
+  }
+  r->buf = buf;
+  return 0;
+}
+
+ssize_t msg_reader_fill(struct msg_reader *r, int fd) {
+  if (reader_make_room(r) < 0) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  char cmsgbuf[CMSG_SPACE(sizeof(int) * MSG_READER_FDS)];
+  struct iovec iov = {r->buf + r->end, r->cap - r->end};
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsgbuf;
+  msg.msg_controllen = sizeof(cmsgbuf);
+
+  ssize_t n;
+  do {
+    n = recvmsg(fd, &msg, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return n;
+  r->end += n;
+
+  struct cmsghdr *cmsg;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int *fds = (int *)CMSG_DATA(cmsg);
+    for (int i = 0; i < count; i++) {
+      if (r->nfds < MSG_READER_FDS) {
+        r->fds[r->nfds++] = fds[i];
+      } else {
+        log_warn("too many fds pending, dropping fd %d", fds[i]);
+        close(fds[i]);
+      }
+    }
+  }
+  return n;
+}
+
+int msg_reader_next(struct msg_reader *r, struct msg_header *hdr,
+                    char **payload) {
+  size_t avail = r->end - r->start;
+  if (avail < sizeof(*hdr))
+    return 0;
+  memcpy(hdr, r->buf + r->start, sizeof(*hdr));
+  if (hdr->len > r->max - sizeof(*hdr)) {
+    log_error("message %d too large: %zu", hdr->type, hdr->len);
+    return -1;
+  }
+  if (avail < sizeof(*hdr) + hdr->len)
+    return 0;
+  *payload = r->buf + r->start + sizeof(*hdr);
+  r->start += sizeof(*hdr) + hdr->len;
+  return 1;
+}
+
+int msg_reader_wait(struct msg_reader *r, int fd, struct msg_header *hdr,
+                    char **payload) {
+  for (;;) {
+    int ret = msg_reader_next(r, hdr, payload);
+    if (ret != 0)
+      return ret > 0 ? 0 : -1;
+    if (msg_reader_fill(r, fd) <= 0)
+      return -1;
+  }
+}
+
+int msg_reader_fd(struct msg_reader *r, int fd) {
+  while (r->start == r->end) {
+    if (msg_reader_fill(r, fd) <= 0)
+      return -1;
+  }
+  r->start++; // 占位字节
+  if (r->nfds == 0) {
+    log_error("expected fd did not arrive");
+    return -1;
+  }
+  int got = r->fds[0];
+  r->nfds--;
+  memmove(r->fds, r->fds + 1, r->nfds * sizeof(int));
+  return got;
+}
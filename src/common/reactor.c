@@ -0,0 +1,247 @@
+/**
+ * reactor.c - muxkit 事件循环模块实现
+ *
+ * 两个后端：
+ * - epoll (Linux)：注册项指针直接放在 epoll_event.data.ptr 中，
+ *   就绪事件直接映射回所属对象
+ * - poll（其他平台）：pollfd 数组 + 注册项指针数组，
+ *   注销时用最后一项填补空位，保持数组紧凑
+ *
+ * 每批就绪事件先收集到 ready[] 再逐个分发。回调中注销的注册项
+ * 会在 ready[] 中被置空，避免分发到已释放的对象。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "reactor.h"
+#include "log.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#define REACTOR_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+struct reactor_event {
+  struct reactor_handler *h; /* NULL 表示已在本批次中注销 */
+  unsigned int events;
+};
+
+struct reactor {
+#ifdef REACTOR_EPOLL
+  int epfd;
+#else
+  struct pollfd *pfds;
+  struct reactor_handler **handlers;
+  size_t count;
+  size_t cap;
+#endif
+  struct reactor_event ready[REACTOR_MAX_EVENTS];
+  int nready;    /* 当前批次事件数 */
+  int next;      /* 下一个待分发的事件 */
+};
+
+struct reactor *reactor_create(void) {
+  struct reactor *r = calloc(1, sizeof(*r));
+  if (!r)
+    return NULL;
+#ifdef REACTOR_EPOLL
+  r->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (r->epfd == -1) {
+    log_error("epoll_create1 failed: %s", strerror(errno));
+    free(r);
+    return NULL;
+  }
+#endif
+  return r;
+}
+
+void reactor_destroy(struct reactor *r) {
+  if (!r)
+    return;
+#ifdef REACTOR_EPOLL
+  close(r->epfd);
+#else
+  free(r->pfds);
+  free(r->handlers);
+#endif
+  free(r);
+}
+
+#ifdef REACTOR_EPOLL
+static uint32_t to_epoll(unsigned int events) {
+  uint32_t ev = 0;
+  if (events & REACTOR_READ)
+    ev |= EPOLLIN;
+  if (events & REACTOR_WRITE)
+    ev |= EPOLLOUT;
+  return ev;
+}
+#else
+static short to_poll(unsigned int events) {
+  short ev = 0;
+  if (events & REACTOR_READ)
+    ev |= POLLIN;
+  if (events & REACTOR_WRITE)
+    ev |= POLLOUT;
+  return ev;
+}
+#endif
+
+int reactor_add(struct reactor *r, struct reactor_handler *h, int fd,
+                unsigned int events, reactor_cb cb) {
+  if (h->active) {
+    log_warn("reactor_add: fd %d already registered", h->fd);
+    return -1;
+  }
+  h->fd = fd;
+  h->events = events;
+  h->cb = cb;
+#ifdef REACTOR_EPOLL
+  struct epoll_event ev = {.events = to_epoll(events), .data.ptr = h};
+  if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    log_error("epoll_ctl add fd %d failed: %s", fd, strerror(errno));
+    return -1;
+  }
+#else
+  if (r->count == r->cap) {
+    size_t cap = r->cap ? r->cap * 2 : 16;
+    struct pollfd *pfds = realloc(r->pfds, cap * sizeof(*pfds));
+    if (!pfds)
+      return -1;
+    r->pfds = pfds;
+    struct reactor_handler **handlers =
+        realloc(r->handlers, cap * sizeof(*handlers));
+    if (!handlers)
+      return -1;
+    r->handlers = handlers;
+    r->cap = cap;
+  }
+  h->slot = r->count++;
+  r->pfds[h->slot].fd = fd;
+  r->pfds[h->slot].events = to_poll(events);
+  r->pfds[h->slot].revents = 0;
+  r->handlers[h->slot] = h;
+#endif
+  h->active = 1;
+  return 0;
+}
+
+int reactor_mod(struct reactor *r, struct reactor_handler *h,
+                unsigned int events) {
+  if (!h->active)
+    return -1;
+  if (h->events == events)
+    return 0;
+#ifdef REACTOR_EPOLL
+  struct epoll_event ev = {.events = to_epoll(events), .data.ptr = h};
+  if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, h->fd, &ev) == -1) {
+    log_error("epoll_ctl mod fd %d failed: %s", h->fd, strerror(errno));
+    return -1;
+  }
+#else
+  r->pfds[h->slot].events = to_poll(events);
+#endif
+  h->events = events;
+  return 0;
+}
+
+void reactor_del(struct reactor *r, struct reactor_handler *h) {
+  if (!h->active)
+    return;
+#ifdef REACTOR_EPOLL
+  if (epoll_ctl(r->epfd, EPOLL_CTL_DEL, h->fd, NULL) == -1)
+    log_warn("epoll_ctl del fd %d failed: %s", h->fd, strerror(errno));
+#else
+  size_t last = --r->count;
+  if (h->slot != last) {
+    r->pfds[h->slot] = r->pfds[last];
+    r->handlers[h->slot] = r->handlers[last];
+    r->handlers[h->slot]->slot = h->slot;
+  }
+#endif
+  h->active = 0;
+
+  // 丢弃本批次中尚未分发的事件
+  for (int i = r->next; i < r->nready; i++) {
+    if (r->ready[i].h == h)
+      r->ready[i].h = NULL;
+  }
+}
+
+int reactor_wait(struct reactor *r, int timeout_ms) {
+  int n;
+  // 本轮积累的日志在等待之前一次写出
+  log_flush();
+#ifdef REACTOR_EPOLL
+  struct epoll_event evs[REACTOR_MAX_EVENTS];
+  n = epoll_wait(r->epfd, evs, REACTOR_MAX_EVENTS, timeout_ms);
+  if (n == -1)
+    return errno == EINTR ? 0 : -1;
+  for (int i = 0; i < n; i++) {
+    unsigned int events = 0;
+    if (evs[i].events & EPOLLIN)
+      events |= REACTOR_READ;
+    if (evs[i].events & EPOLLOUT)
+      events |= REACTOR_WRITE;
+    if (evs[i].events & (EPOLLERR | EPOLLHUP))
+      events |= REACTOR_ERROR | REACTOR_READ; // 让读回调看到 EOF
+    r->ready[i].h = evs[i].data.ptr;
+    r->ready[i].events = events;
+  }
+#else
+  n = poll(r->pfds, r->count, timeout_ms);
+  if (n == -1)
+    return errno == EINTR ? 0 : -1;
+  n = 0;
+  for (size_t i = 0; i < r->count && n < REACTOR_MAX_EVENTS; i++) {
+    short re = r->pfds[i].revents;
+    if (!re)
+      continue;
+    unsigned int events = 0;
+    if (re & POLLIN)
+      events |= REACTOR_READ;
+    if (re & POLLOUT)
+      events |= REACTOR_WRITE;
+    if (re & (POLLERR | POLLHUP | POLLNVAL))
+      events |= REACTOR_ERROR | REACTOR_READ;
+    r->ready[n].h = r->handlers[i];
+    r->ready[n].events = events;
+    n++;
+  }
+#endif
+
+  r->nready = n;
+  for (r->next = 0; r->next < r->nready;) {
+    struct reactor_event *e = &r->ready[r->next++];
+    if (e->h)
+      e->h->cb(e->h, e->events);
+  }
+  r->nready = 0;
+  r->next = 0;
+  return n;
+}
@@ -0,0 +1,388 @@
+/**
+ * record.c - muxkit 会话录制和回放实现
+ *
+ * 录制：
+ * - stdio 全缓冲写入，客户端每收到一段输出只是一次 memcpy
+ * - 每个 pane 记住上次写入的尺寸，变化时才补一条 REC_SIZE
+ * - 写失败后记一条警告并停止录制，不影响客户端
+ *
+ * 回放：
+ * - 整个文件只读 mmap，REC_OUTPUT 的数据直接指向映射，回放不再拷贝
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "record.h"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VARINT_MAX 10 /* uint64 varint 最大字节数 */
+#define REC_BUF_SIZE (64 * 1024) /* 录制文件的 stdio 缓冲 */
+
+struct recorder {
+  FILE *fp;
+  char *buf;                        /* stdio 缓冲区 */
+  uint64_t start_us;                /* 录制开始时间 */
+  uint64_t last_us;                 /* 上一条记录的时间 */
+  unsigned int cols[REC_MAX_PANES]; /* 每个 pane 上次记录的尺寸，0 表示未记录 */
+  unsigned int rows[REC_MAX_PANES];
+  int failed; /* 写失败后不再录制 */
+};
+
+static size_t varint_put(char *p, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (char)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (char)v;
+  return n;
+}
+
+/*
+  读取 varint，越界或超长返回 0
+*/
+static size_t varint_get(const char *p, const char *end, uint64_t *v) {
+  uint64_t r = 0;
+  for (size_t n = 0; n < VARINT_MAX && p + n < end; n++) {
+    uint8_t b = (uint8_t)p[n];
+    r |= (uint64_t)(b & 0x7f) << (7 * n);
+    if (!(b & 0x80)) {
+      *v = r;
+      return n + 1;
+    }
+  }
+  return 0;
+}
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct recorder *record_open(const char *path) {
+  struct recorder *r = calloc(1, sizeof(*r));
+  if (!r)
+    return NULL;
+  r->fp = fopen(path, "wb");
+  if (!r->fp) {
+    log_warn("open recording %s failed: %s", path, strerror(errno));
+    free(r);
+    return NULL;
+  }
+  r->buf = malloc(REC_BUF_SIZE);
+  if (r->buf)
+    setvbuf(r->fp, r->buf, _IOFBF, REC_BUF_SIZE);
+  fwrite(REC_MAGIC, 1, REC_MAGIC_LEN, r->fp);
+  r->start_us = r->last_us = now_us();
+  log_info("recording pane output to %s", path);
+  return r;
+}
+
+/*
+  写入记录头：时间差、类型、pane ID
+*/
+static void record_header(struct recorder *r, enum rec_type type,
+                          unsigned int pane_id) {
+  char hdr[2 * VARINT_MAX + 1];
+  uint64_t now = now_us();
+  size_t n = varint_put(hdr, now - r->last_us);
+  hdr[n++] = (char)type;
+  n += varint_put(hdr + n, pane_id);
+  r->last_us = now;
+  fwrite(hdr, 1, n, r->fp);
+}
+
+/*
+  检查写入错误，出错后停止录制
+*/
+static void record_check(struct recorder *r) {
+  if (ferror(r->fp)) {
+    log_warn("recording write failed, recording stopped");
+    r->failed = 1;
+  }
+}
+
+void record_output(struct recorder *r, unsigned int pane_id, unsigned int cols,
+                   unsigned int rows, const char *data, size_t len) {
+  if (!r || r->failed)
+    return;
+  if (pane_id < REC_MAX_PANES &&
+      (r->cols[pane_id] != cols || r->rows[pane_id] != rows)) {
+    char body[2 * VARINT_MAX];
+    size_t n = varint_put(body, cols);
+    n += varint_put(body + n, rows);
+    record_header(r, REC_SIZE, pane_id);
+    fwrite(body, 1, n, r->fp);
+    r->cols[pane_id] = cols;
+    r->rows[pane_id] = rows;
+  }
+  char lenbuf[VARINT_MAX];
+  record_header(r, REC_OUTPUT, pane_id);
+  fwrite(lenbuf, 1, varint_put(lenbuf, len), r->fp);
+  fwrite(data, 1, len, r->fp);
+  record_check(r);
+}
+
+void record_exit(struct recorder *r, unsigned int pane_id) {
+  if (!r || r->failed)
+    return;
+  record_header(r, REC_EXIT, pane_id);
+  if (pane_id < REC_MAX_PANES)
+    r->cols[pane_id] = r->rows[pane_id] = 0;
+  record_check(r);
+}
+
+void record_close(struct recorder *r) {
+  if (!r)
+    return;
+  if (fclose(r->fp) != 0)
+    log_warn("close recording failed: %s", strerror(errno));
+  free(r->buf);
+  free(r);
+}
+
+int replay_open(struct replay *rp, const char *path) {
+  memset(rp, 0, sizeof(*rp));
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    log_error("open recording %s failed: %s", path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < REC_MAGIC_LEN) {
+    log_error("recording %s is too short", path);
+    close(fd);
+    return -1;
+  }
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    log_error("mmap recording %s failed: %s", path, strerror(errno));
+    return -1;
+  }
+  if (memcmp(p, REC_MAGIC, REC_MAGIC_LEN) != 0) {
+    log_error("%s is not a muxkit recording", path);
+    munmap(p, st.st_size);
+    return -1;
+  }
+  rp->data = p;
+  rp->len = st.st_size;
+  rp->off = REC_MAGIC_LEN;
+  return 0;
+}
+
+int replay_next(struct replay *rp, struct rec_event *ev) {
+  const char *p = rp->data + rp->off;
+  const char *end = rp->data + rp->len;
+  uint64_t dt, id, a, b;
+  size_t n;
+
+  if (p == end)
+    return 0;
+  // 半条记录说明录制被打断，当作文件结束
+  if (!(n = varint_get(p, end, &dt)) || p + n >= end)
+    return 0;
+  p += n;
+  int type = (uint8_t)*p++;
+  if (!(n = varint_get(p, end, &id)))
+    return 0;
+  p += n;
+
+  memset(ev, 0, sizeof(*ev));
+  ev->time_us = rp->time_us + dt;
+  ev->type = type;
+  ev->pane_id = (unsigned int)id;
+  switch (type) {
+  case REC_SIZE:
+    if (!(n = varint_get(p, end, &a)))
+      return 0;
+    p += n;
+    if (!(n = varint_get(p, end, &b)))
+      return 0;
+    p += n;
+    ev->cols = (unsigned int)a;
+    ev->rows = (unsigned int)b;
+    break;
+  case REC_OUTPUT:
+    if (!(n = varint_get(p, end, &a)))
+      return 0;
+    p += n;
+    if (a > (uint64_t)(end - p))
+      return 0;
+    ev->data = p;
+    ev->len = a;
+    p += a;
+    break;
+  case REC_EXIT:
+    break;
+  default:
+    log_error("unknown record type %d at offset %zu", type, rp->off);
+    return -1;
+  }
+  rp->off = p - rp->data;
+  rp->time_us = ev->time_us;
+  return 1;
+}
+
+void replay_rewind(struct replay *rp) {
+  rp->off = REC_MAGIC_LEN;
+  rp->time_us = 0;
+}
+
+void replay_close(struct replay *rp) {
+  if (rp->data)
+    munmap((void *)rp->data, rp->len);
+  memset(rp, 0, sizeof(*rp));
+}
+
+/*
+  UTF-8 序列长度，非法的首字节返回 0
+*/
+static size_t utf8_seq_len(uint8_t b) {
+  if (b < 0x80)
+    return 1;
+  if ((b & 0xe0) == 0xc0)
+    return b >= 0xc2 ? 2 : 0;
+  if ((b & 0xf0) == 0xe0)
+    return 3;
+  if ((b & 0xf8) == 0xf0)
+    return b <= 0xf4 ? 4 : 0;
+  return 0;
+}
+
+/*
+  以 JSON 字符串写出 data，返回末尾被截断的 UTF-8 字节数（留给下一段）
+*/
+static size_t cast_write_string(FILE *fp, const char *data, size_t len,
+                                int last) {
+  const uint8_t *p = (const uint8_t *)data;
+  size_t i = 0;
+  fputc('"', fp);
+  while (i < len) {
+    uint8_t b = p[i];
+    size_t n = utf8_seq_len(b);
+    if (n == 1) {
+      if (b == '"' || b == '\\')
+        fprintf(fp, "\\%c", b);
+      else if (b < 0x20 || b == 0x7f)
+        fprintf(fp, "\\u%04x", b);
+      else
+        fputc(b, fp);
+      i++;
+      continue;
+    }
+    if (n > 0 && i + n > len && !last)
+      break; // 多字节字符被拆到下一段
+    size_t k = 1;
+    while (n > 0 && k < n && i + k < len && (p[i + k] & 0xc0) == 0x80)
+      k++;
+    if (n == 0 || k < n) {
+      fputs("\\ufffd", fp);
+      i += n == 0 ? 1 : k;
+      continue;
+    }
+    fwrite(p + i, 1, n, fp);
+    i += n;
+  }
+  fputc('"', fp);
+  return len - i;
+}
+
+int replay_export_asciicast(struct replay *rp, const char *out,
+                            unsigned int pane_id) {
+  struct rec_event ev;
+  unsigned int cols = 0, rows = 0;
+  int ret;
+
+  // 文件头需要初始尺寸
+  replay_rewind(rp);
+  while ((ret = replay_next(rp, &ev)) > 0) {
+    if (ev.pane_id == pane_id && ev.type == REC_SIZE) {
+      cols = ev.cols;
+      rows = ev.rows;
+      break;
+    }
+  }
+  if (cols == 0) {
+    log_error("pane %u not found in recording", pane_id);
+    return -1;
+  }
+
+  FILE *fp = fopen(out, "w");
+  if (!fp) {
+    log_error("open %s failed: %s", out, strerror(errno));
+    return -1;
+  }
+  fprintf(fp, "{\"version\": 2, \"width\": %u, \"height\": %u}\n", cols,
+          rows);
+
+  char carry[4];
+  size_t held = 0;
+  int sized = 0;
+  replay_rewind(rp);
+  while ((ret = replay_next(rp, &ev)) > 0) {
+    if (ev.pane_id != pane_id)
+      continue;
+    double t = ev.time_us / 1e6;
+    if (ev.type == REC_SIZE) {
+      // 第一条尺寸已经写在文件头
+      if (sized++)
+        fprintf(fp, "[%.6f, \"r\", \"%ux%u\"]\n", t, ev.cols, ev.rows);
+    } else if (ev.type == REC_OUTPUT) {
+      char *buf = malloc(held + ev.len);
+      if (!buf) {
+        ret = -1;
+        break;
+      }
+      memcpy(buf, carry, held);
+      memcpy(buf + held, ev.data, ev.len);
+      fprintf(fp, "[%.6f, \"o\", ", t);
+      size_t rest = cast_write_string(fp, buf, held + ev.len, 0);
+      fputs("]\n", fp);
+      memcpy(carry, buf + held + ev.len - rest, rest);
+      held = rest;
+      free(buf);
+    } else if (ev.type == REC_EXIT) {
+      break;
+    }
+  }
+  if (held > 0) {
+    fprintf(fp, "[%.6f, \"o\", ", rp->time_us / 1e6);
+    cast_write_string(fp, carry, held, 1);
+    fputs("]\n", fp);
+  }
+  if (fclose(fp) != 0 || ret < 0) {
+    log_error("write %s failed", out);
+    return -1;
+  }
+  return 0;
+}
@@ -6,6 +6,7 @@
  * - 检查 shell 可执行性
  * - 检查嵌套运行 (MUXKIT/TMUX 环境变量)
  * - 文件描述符传递 (SCM_RIGHTS)
+ * - 运行时目录临时文件、匿名共享内存 (memfd)
  *
  * 文件描述符传递：
  *   使用 sendmsg/recvmsg 和 SCM_RIGHTS 辅助消息
@@ -33,12 +34,19 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include "util.h"
+#include "log.h"
+#include "main.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <paths.h>
 #include <pwd.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <unistd.h>
 struct passwd *pw;
 
@@ -88,7 +96,7 @@ int client_check_nested() {
 }
 
 // fdpass.c
-int send_fd(int sock, int fd) {
+int send_fd(int sock, int fd, int flags) {
   struct msghdr msg = {0};
   struct iovec iov[1];
   char buf[1] = {0};
@@ -110,7 +118,7 @@ int send_fd(int sock, int fd) {
   cmsg->cmsg_len = CMSG_LEN(sizeof(int));
   *(int *)CMSG_DATA(cmsg) = fd; // 把 fd 放进去
 
-  return sendmsg(sock, &msg, 0) >= 0 ? 0 : -1; // fd内核检查
+  return sendmsg(sock, &msg, flags) >= 0 ? 0 : -1; // fd内核检查
 }
 
 int recv_fd(int sock) {
@@ -136,6 +144,42 @@ int recv_fd(int sock) {
   return -1;
 }
 
+int runtime_tmpfile(const char *prefix) {
+  extern char *socket_path;
+  char path[MUXKIT_BUF_PATH];
+  const char *slash = socket_path ? strrchr(socket_path, '/') : NULL;
+  int dir_len = slash ? (int)(slash - socket_path) : 1;
+  snprintf(path, sizeof(path), "%.*s/%s-XXXXXX", dir_len,
+           slash ? socket_path : ".", prefix);
+  int fd = mkstemp(path);
+  if (fd == -1) {
+    log_warn("create %s: %s", path, strerror(errno));
+    return -1;
+  }
+  unlink(path);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
+
+int shm_create(const char *name, size_t len) {
+  int fd = -1;
+#ifdef MFD_CLOEXEC
+  fd = memfd_create(name, MFD_CLOEXEC);
+  if (fd == -1)
+    log_debug("memfd_create failed: %s, falling back to tmpfile",
+              strerror(errno));
+#endif
+  if (fd == -1 && (fd = runtime_tmpfile(name)) == -1)
+    return -1;
+  if (ftruncate(fd, (off_t)len) == -1) {
+    log_error("ftruncate shm %s to %zu failed: %s", name, len,
+              strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
 // Unicode codepoint 转 UTF-8
 int unicode_to_utf8(uint32_t cp, char *buf) {
   if (cp < 0x80) {
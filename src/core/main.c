@@ -58,6 +58,9 @@ int detached_session_id = -1;
 int list_sessions = 0;
 int kill_session_id = -1;
 int new_session_detach = -1;
+int restore_sessions = 0;
+int watch_session_id = -1;
+int latency_session_id = -1;
 
 static void print_help(const char *prog) {
   printf("%s", TR(MSG_HELP_TITLE));
@@ -66,8 +69,11 @@ static void print_help(const char *prog) {
   printf("%s", TR(MSG_HELP_OPTIONS));
   printf("%s", TR(MSG_HELP_OPT_LIST));
   printf("%s", TR(MSG_HELP_OPT_ATTACH));
+  printf("%s", TR(MSG_HELP_OPT_WATCH));
+  printf("%s", TR(MSG_HELP_OPT_LATENCY));
   printf("%s", TR(MSG_HELP_OPT_KILL));
   printf("%s", TR(MSG_HELP_OPT_NEW));
+  printf("%s", TR(MSG_HELP_OPT_RESTORE));
   printf("%s", TR(MSG_HELP_OPT_HELP));
   printf("%s", TR(MSG_HELP_KEYBINDINGS));
   printf("%s", TR(MSG_HELP_KEY_DETACH));
@@ -80,8 +86,11 @@ static void print_help(const char *prog) {
   printf(TR(MSG_HELP_EX_NEW), prog);
   printf(TR(MSG_HELP_EX_LIST), prog);
   printf(TR(MSG_HELP_EX_ATTACH), prog);
+  printf(TR(MSG_HELP_EX_WATCH), prog);
+  printf(TR(MSG_HELP_EX_LATENCY), prog);
   printf(TR(MSG_HELP_EX_KILL), prog);
   printf(TR(MSG_HELP_EX_NEW_DETACH), prog);
+  printf(TR(MSG_HELP_EX_RESTORE), prog);
 }
 
 int main(int argc, char *argv[]) {
@@ -98,14 +107,17 @@ int main(int argc, char *argv[]) {
 
       {"l", no_argument, 0, 'l'},
       {"s", required_argument, 0, 's'},
+      {"watch", required_argument, 0, 'w'},
+      {"latency", required_argument, 0, 'L'},
       {"k", required_argument, 0, 'k'},
       {"send_keys", required_argument, 0, '_'},
       {"new-session", no_argument, 0, 'n'},
       {"n", no_argument, 0, 'n'},
       {"list-panes", required_argument, 0, 'p'},
+      {"restore", no_argument, 0, 'R'},
       {0, 0, 0, 0}};
 
-  while ((opt = getopt_long(argc, argv, "hls:k:_:np:", long_options,
+  while ((opt = getopt_long(argc, argv, "hls:w:L:k:_:np:R", long_options,
                             &option_index)) != -1) {
     switch (opt) {
     case 'h':
@@ -118,6 +130,13 @@ int main(int argc, char *argv[]) {
       detached_session_id = strtol(optarg, NULL, 10);
       log_info("attaching to session id=%d\n", detached_session_id);
       break;
+    case 'w':
+      watch_session_id = strtol(optarg, NULL, 10);
+      log_info("watching session id=%d\n", watch_session_id);
+      break;
+    case 'L':
+      latency_session_id = strtol(optarg, NULL, 10);
+      break;
     case 'k':
       kill_session_id = strtol(optarg, NULL, 10);
       log_info("killing session id=%d\n", kill_session_id);
@@ -131,6 +150,9 @@ int main(int argc, char *argv[]) {
     case 'n':
       new_session_detach = 1;
       break;
+    case 'R':
+      restore_sessions = 1;
+      break;
     case '?':
       if (optind < argc && strcmp(argv[optind], "new-session") == 0) {
         optind++;
@@ -0,0 +1,393 @@
+/**
+ * checkpoint.c - muxkit 会话检查点模块实现
+ *
+ * 写盘流程：
+ * - 主循环到期调用 checkpoint_run，统计有变化的会话后 fork 一个子进程
+ * - 子进程看到的是 fork 时刻内存的写时复制副本，主循环继续处理 PTY 输出，
+ *   互不影响；序列化、LZ 压缩、写文件、fsync 全部在子进程里完成
+ * - 每个会话写 session-<id>.tmp，fsync 后 rename 为 session-<id>，
+ *   一批写完后对目录 fsync 一次
+ * - 同一时刻最多一个写盘子进程，SIGCHLD 回收后才开始下一批
+ *
+ * 会话变化的判断：pane 数量或尺寸变化设置 session->checkpoint_dirty，
+ * 服务端模拟的 pane 收到输出时给窗口设置 WINDOW_CHANGED。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "checkpoint.h"
+#include "log.h"
+#include "main.h"
+#include "render.h"
+#include "util.h"
+#include "window.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static int interval_ms = -1;  // 写盘间隔，-1 表示尚未读取配置
+static long long next_due_ms; // 下一次检查点时刻
+static pid_t writer_pid;      // 正在写盘的子进程，0 表示空闲
+// 写盘期间被删除的会话，子进程结束后再删一次，避免 rename 把文件写回来
+static int pending_remove[MUXKIT_CHECKPOINT_MAX];
+static int npending_remove;
+
+static long long checkpoint_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int checkpoint_interval(void) {
+  if (interval_ms < 0) {
+    interval_ms = MUXKIT_CHECKPOINT_INTERVAL;
+    const char *env = getenv("MUXKIT_CHECKPOINT_INTERVAL");
+    if (env && strtol(env, NULL, 10) >= 0)
+      interval_ms = (int)strtol(env, NULL, 10);
+    next_due_ms = checkpoint_now_ms() + interval_ms;
+  }
+  return interval_ms;
+}
+
+/*
+  检查点目录：套接字所在目录下的 checkpoints/，create 为 1 时按需创建
+*/
+static int checkpoint_dir(char *buf, size_t size, int create) {
+  extern char *socket_path;
+  const char *slash = socket_path ? strrchr(socket_path, '/') : NULL;
+  if (!slash)
+    return -1;
+  int n = snprintf(buf, size, "%.*s/checkpoints",
+                   (int)(slash - socket_path), socket_path);
+  if (n < 0 || (size_t)n >= size) {
+    log_error("checkpoint directory path too long");
+    return -1;
+  }
+  if (create && mkdir(buf, 0700) == -1 && errno != EEXIST) {
+    log_error("mkdir %s failed: %s", buf, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  会话检查点文件路径，suffix 为临时文件后缀。
+  路径被截断时返回 -1：截断后的临时文件名可能与正式文件相同
+*/
+static int checkpoint_path(char *buf, size_t size, const char *dir, int id,
+                           const char *suffix) {
+  int n = snprintf(buf, size, "%s/session-%d%s", dir, id, suffix);
+  if (n < 0 || (size_t)n >= size) {
+    log_error("checkpoint path for session %d too long", id);
+    return -1;
+  }
+  return 0;
+}
+
+static int session_changed(const struct session *s) {
+  if (s->child_exited || s->pane_count == 0)
+    return 0;
+  return s->checkpoint_dirty ||
+         (s->active_window && (s->active_window->flags & WINDOW_CHANGED));
+}
+
+/*
+  写入一个 pane 的记录：取服务端模拟器的网格，已退出的 pane 长度为 0
+*/
+static int checkpoint_write_pane(int fd, struct session *s, int idx) {
+  struct checkpoint_pane cp = {.pane_id = idx, .len = 0};
+  void *data = NULL;
+
+  struct window_pane *p = NULL;
+  if (s->active_window) {
+    struct window_pane *it;
+    list_for_each_entry(it, &s->active_window->panes, link) {
+      if (it->id == (unsigned int)idx) {
+        p = it;
+        break;
+      }
+    }
+  }
+  if (p) {
+    // 子进程里压缩不影响主循环，磁盘上总是压缩
+    cp.len = grid_serialize(p->grid, idx, p->cx, p->cy,
+                            grid_snapshot_flags() | GRID_SNAPSHOT_LZ, &data);
+  }
+
+  int ret = 0;
+  if (write_n(fd, &cp, sizeof(cp)) < 0 ||
+      (cp.len && write_n(fd, data, cp.len) < 0))
+    ret = -1;
+  free(data);
+  return ret;
+}
+
+/*
+  写入一个会话：临时文件写完并 fsync 后原子替换
+*/
+static int checkpoint_write(const char *dir, struct session *s) {
+  char path[MUXKIT_BUF_PATH], tmp[MUXKIT_BUF_PATH];
+  if (checkpoint_path(path, sizeof(path), dir, s->id, "") < 0 ||
+      checkpoint_path(tmp, sizeof(tmp), dir, s->id, ".tmp") < 0)
+    return -1;
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    log_error("open %s failed: %s", tmp, strerror(errno));
+    return -1;
+  }
+
+  struct checkpoint_header hdr = {
+      .magic = CHECKPOINT_MAGIC,
+      .version = CHECKPOINT_VERSION,
+      .pane_count = s->pane_count,
+      .id = s->id,
+      .ws_row = s->ws.ws_row,
+      .ws_col = s->ws.ws_col,
+  };
+  if (write_n(fd, &hdr, sizeof(hdr)) < 0)
+    goto fail;
+  for (int i = 0; i < s->pane_count; i++) {
+    if (checkpoint_write_pane(fd, s, i) < 0)
+      goto fail;
+  }
+  if (fsync(fd) == -1)
+    goto fail;
+  close(fd);
+  if (rename(tmp, path) == -1) {
+    log_error("rename %s failed: %s", tmp, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+
+fail:
+  log_error("write checkpoint of session %d failed: %s", s->id,
+            strerror(errno));
+  close(fd);
+  unlink(tmp);
+  return -1;
+}
+
+int checkpoint_timeout(void) {
+  // 写盘子进程结束时 SIGCHLD 会打断等待
+  if (checkpoint_interval() <= 0 || writer_pid > 0)
+    return -1;
+  long long left = next_due_ms - checkpoint_now_ms();
+  return left > 0 ? (int)left : 0;
+}
+
+void checkpoint_run(struct list_head *sessions) {
+  if (checkpoint_interval() <= 0 || writer_pid > 0)
+    return;
+  long long now = checkpoint_now_ms();
+  if (now < next_due_ms)
+    return;
+  next_due_ms = now + interval_ms;
+
+  int n = 0;
+  struct session *s;
+  list_for_each_entry(s, sessions, link) {
+    if (session_changed(s))
+      n++;
+  }
+  if (n == 0)
+    return;
+
+  char dir[MUXKIT_BUF_PATH];
+  if (checkpoint_dir(dir, sizeof(dir), 1) < 0)
+    return;
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    log_error("fork checkpoint writer failed: %s", strerror(errno));
+    return;
+  }
+  if (pid == 0) {
+    int failed = 0;
+    list_for_each_entry(s, sessions, link) {
+      if (session_changed(s) && checkpoint_write(dir, s) < 0)
+        failed = 1;
+    }
+    // 一批只同步一次目录，让所有 rename 落盘
+    int dfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0) {
+      fsync(dfd);
+      close(dfd);
+    }
+    _exit(failed);
+  }
+
+  writer_pid = pid;
+  list_for_each_entry(s, sessions, link) {
+    s->checkpoint_dirty = 0;
+    if (s->active_window)
+      s->active_window->flags &= ~WINDOW_CHANGED;
+  }
+  log_debug("checkpoint: writing %d sessions in pid %d", n, pid);
+}
+
+int checkpoint_reap(pid_t pid, int status, struct list_head *sessions) {
+  if (pid != writer_pid || writer_pid <= 0)
+    return 0;
+  writer_pid = 0;
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    log_warn("checkpoint writer failed, retrying next interval");
+    struct session *s;
+    list_for_each_entry(s, sessions, link) s->checkpoint_dirty = 1;
+  }
+  for (int i = 0; i < npending_remove; i++)
+    checkpoint_remove(pending_remove[i]);
+  npending_remove = 0;
+  return 1;
+}
+
+static int cmp_int(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+int checkpoint_list(int *ids, int max) {
+  char dir[MUXKIT_BUF_PATH];
+  if (checkpoint_dir(dir, sizeof(dir), 0) < 0)
+    return -1;
+  DIR *d = opendir(dir);
+  if (!d)
+    return errno == ENOENT ? 0 : -1;
+
+  int n = 0;
+  struct dirent *de;
+  while ((de = readdir(d)) && n < max) {
+    if (strncmp(de->d_name, "session-", 8) != 0)
+      continue;
+    char *end;
+    long id = strtol(de->d_name + 8, &end, 10);
+    if (end == de->d_name + 8 || *end != '\0' || id < 0)
+      continue; // 跳过 .tmp 等
+    ids[n++] = (int)id;
+  }
+  closedir(d);
+  qsort(ids, n, sizeof(*ids), cmp_int);
+  return n;
+}
+
+int checkpoint_load(int id, struct checkpoint *ck) {
+  char dir[MUXKIT_BUF_PATH], path[MUXKIT_BUF_PATH];
+  if (checkpoint_dir(dir, sizeof(dir), 0) < 0)
+    return -1;
+  if (checkpoint_path(path, sizeof(path), dir, id, "") < 0)
+    return -1;
+
+  memset(ck, 0, sizeof(*ck));
+  for (int i = 0; i < MAX_PANES; i++)
+    ck->grid_fd[i] = -1;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    log_error("open %s failed: %s", path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct checkpoint_header)) {
+    log_error("checkpoint %s: truncated", path);
+    close(fd);
+    return -1;
+  }
+  size_t size = st.st_size;
+  const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    log_error("mmap %s failed: %s", path, strerror(errno));
+    return -1;
+  }
+
+  struct checkpoint_header hdr;
+  memcpy(&hdr, map, sizeof(hdr));
+  if (hdr.magic != CHECKPOINT_MAGIC || hdr.version != CHECKPOINT_VERSION ||
+      hdr.id != id || hdr.pane_count == 0 || hdr.pane_count > MAX_PANES) {
+    log_error("checkpoint %s: bad header", path);
+    goto fail;
+  }
+  ck->id = id;
+  ck->pane_count = hdr.pane_count;
+  ck->ws.ws_row = hdr.ws_row;
+  ck->ws.ws_col = hdr.ws_col;
+
+  size_t off = sizeof(hdr);
+  for (int i = 0; i < ck->pane_count; i++) {
+    struct checkpoint_pane cp;
+    if (size - off < sizeof(cp))
+      goto corrupt;
+    memcpy(&cp, map + off, sizeof(cp));
+    off += sizeof(cp);
+    if (cp.pane_id >= (uint32_t)ck->pane_count || cp.len > size - off)
+      goto corrupt;
+    if (cp.len == 0)
+      continue;
+    // 快照本身的 CRC 在恢复网格时校验
+    int gfd = shm_create("muxkit-grid", cp.len);
+    if (gfd == -1)
+      goto fail;
+    if (write_n(gfd, map + off, cp.len) < 0) {
+      close(gfd);
+      goto fail;
+    }
+    if (ck->grid_fd[cp.pane_id] >= 0)
+      close(ck->grid_fd[cp.pane_id]);
+    ck->grid_fd[cp.pane_id] = gfd;
+    ck->grid_len[cp.pane_id] = cp.len;
+    off += cp.len;
+  }
+  munmap((void *)map, size);
+  return 0;
+
+corrupt:
+  log_error("checkpoint %s: corrupt pane record", path);
+fail:
+  for (int i = 0; i < MAX_PANES; i++) {
+    if (ck->grid_fd[i] >= 0)
+      close(ck->grid_fd[i]);
+    ck->grid_fd[i] = -1;
+  }
+  munmap((void *)map, size);
+  return -1;
+}
+
+void checkpoint_remove(int id) {
+  char dir[MUXKIT_BUF_PATH], path[MUXKIT_BUF_PATH];
+  if (checkpoint_dir(dir, sizeof(dir), 0) < 0)
+    return;
+  if (checkpoint_path(path, sizeof(path), dir, id, "") < 0)
+    return;
+  if (unlink(path) == -1 && errno != ENOENT)
+    log_warn("remove %s failed: %s", path, strerror(errno));
+  if (writer_pid > 0 && npending_remove < MUXKIT_CHECKPOINT_MAX)
+    pending_remove[npending_remove++] = id;
+}
@@ -3,11 +3,13 @@
  *
  * 本模块实现了 muxkit 服务端守护进程的核心功能：
  * - 守护进程创建 (double-fork 模式)
- * - Unix 域套接字监听和客户端连接管理
+ * - Unix 域套接字监听和客户端连接管理（epoll 事件循环，见 reactor.c）
  * - 会话 (session) 生命周期管理
  * - PTY 创建和 shell 进程管理
  * - 多窗格 (pane) 支持
  * - 会话分离/附加功能
+ * - 分离期间继续读取 PTY，由服务端终端模拟器维护屏幕和历史
+ * - 定期把会话写入磁盘检查点，重启后可恢复（见 checkpoint.c）
  * - SIGCHLD 信号处理和子进程回收
  *
  * 消息协议：
@@ -17,7 +19,8 @@
  *   MSG_LIST_SESSIONS - 列出所有会话
  *   MSG_DETACHKILL   - 终止指定会话
  *   MSG_EXITED       - 客户端退出通知
- *   MSG_GRID_SAVE    - 保存屏幕网格数据
+ *   MSG_GRID_SAVE    - 保存屏幕网格快照（memfd 经 SCM_RIGHTS 传递）
+ *   MSG_RESTORE      - 从磁盘检查点恢复会话
  *
  * MIT License
  * Copyright (c) 2024 LatosProject
@@ -43,13 +46,20 @@
 
 #define _XOPEN_SOURCE 700
 #include "server.h"
+#include "bufpool.h"
+#include "checkpoint.h"
 #include "i18n.h"
+#include "input.h"
 #include "list.h"
 #include "log.h"
 #include "main.h"
 #include "muxkit-protocol.h"
+#include "reactor.h"
+#include "render.h"
 #include "spawn.h"
+#include "stream.h"
 #include "util.h"
+#include "window.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -57,15 +67,58 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 extern char *socket_path;
 struct list_head session_list;
 static volatile sig_atomic_t sigchld_pending = 0;
+static struct reactor *server_reactor;
+// 新会话 ID 的下限，避开磁盘上尚未恢复的检查点
+static int session_id_floor;
+
+#define CONN_MAX_FDS (MAX_PANES * 2 + 2) /* 发送队列中最多排队的 fd */
+
+/**
+ * 客户端连接
+ *
+ * 注册项直接指向所属连接，连接再直接指向关联的 session，
+ * 处理消息时不需要按 fd 遍历 session 列表。
+ *
+ * 服务端发给客户端的所有数据都先进入发送队列，用非阻塞 send 写出，
+ * 写不完时等待可写。未发出的字节低于低水位才从 pane 输出流拉取下一批，
+ * 超过高水位时暂停读取这个连接的请求，降到低水位以下再恢复：
+ * 一个卡住的客户端只占用高水位这么多内存，也不会拖慢其他连接。
+ */
+struct server_conn {
+  struct reactor_handler handler; // fd 即客户端 socket
+  struct session *session;        // 关联的 session，未关联时为 NULL
+  struct list_head link;          // session->clients 中的节点
+  int observer;                   // 只读观察者
+  uint64_t cursor[MAX_PANES];     // 每个 pane 输出流的发送进度
+  int next_pane;                  // 下一次拉取从哪个 pane 开始，轮流避免饿死
+
+  char *out;                       // 发送队列
+  size_t out_len;                  // 已排队字节数
+  size_t out_off;                  // 已发送字节数
+  size_t out_cap;                  // 队列容量
+  int out_fds[CONN_MAX_FDS];       // 排队的 fd，随占位字节发送后关闭
+  size_t out_fd_at[CONN_MAX_FDS];  // 占位字节在队列中的位置
+  int out_nfds;                    // 排队的 fd 数量
+  int out_fd_next;                 // 下一个待发送的 fd
+  unsigned int events;             // 当前注册的事件
+  int paused;                      // 超过高水位，暂停读取请求
+  int closing;                     // 发完队列后关闭，不再读取请求
+  int broken;                      // 处理消息期间推送失败，处理完后关闭
+
+  struct msg_reader in;            // 接收缓冲区
+};
+
+// 正在处理消息的连接，推送失败时不能当场释放
+static struct server_conn *handling_conn;
 ssize_t read_n(int fd, void *buf, size_t n) {
   size_t recvd = 0;
   char *p = buf;
@@ -114,7 +167,7 @@ void server_signal_handler(int sig) {
 */
 void session_init(struct session *s) {
   s->id = -1;
-  s->client_fd = -1;
+  s->conn = NULL;
   s->pane_count = 0;
   for (int i = 0; i < MAX_PANES; i++) {
     s->master_fds[i] = -1;
@@ -124,24 +177,27 @@ void session_init(struct session *s) {
   s->slave_pid = -1;
   s->child_exited = 0;
   s->detached = 0;
-  for (int i = 0; i < MAX_PANES; i++) {
-    s->master_fds[i] = -1;
-    s->pane_pids[i] = -1;
-    s->grid_data[i] = NULL;
-    s->grid_data_len[i] = 0;
-  }
+  s->active_window = NULL;
+  s->checkpoint_dirty = 0;
+  s->throttled = 0;
+  memset(s->streams, 0, sizeof(s->streams));
+  memset(s->latency, 0, sizeof(s->latency));
+  list_init(&s->clients);
   list_init(&s->link);
   tcgetattr(STDIN_FILENO, &(s->orig_termios));
   ioctl(STDIN_FILENO, TIOCGWINSZ, &(s->ws));
 }
 
+static void server_pane_event(struct reactor_handler *h, unsigned int events);
+static void server_conn_close(struct server_conn *conn);
+
 /*
-  根据 client_fd 查找 session
+  根据 session id 查找 session
 */
-static struct session *find_session_by_client_fd(int fd) {
+static struct session *find_session_by_id(int id) {
   struct session *sess;
   list_for_each_entry(sess, &session_list, link) {
-    if (sess->client_fd == fd) {
+    if (sess->id == id) {
       return sess;
     }
   }
@@ -149,60 +205,833 @@ static struct session *find_session_by_client_fd(int fd) {
 }
 
 /*
-  根据 session id 查找 session
+  根据 pane 下标查找服务端模拟器中的 pane
 */
-static struct session *find_session_by_id(int id) {
-  struct session *sess;
-  list_for_each_entry(sess, &session_list, link) {
-    if (sess->id == id) {
-      return sess;
-    }
+static struct window_pane *session_find_pane(struct session *s, int idx) {
+  struct window_pane *p;
+  if (!s->active_window)
+    return NULL;
+  list_for_each_entry(p, &s->active_window->panes, link) {
+    if (p->id == (unsigned int)idx)
+      return p;
   }
   return NULL;
 }
 
 /*
-  处理来自客户端的消息
+  有拥有者时由拥有者的模拟器应答终端查询，分离后由服务端应答
 */
-int server_receive(int fd) {
-  // 读取消息类型
-  struct msg_header hdr;
-  if (read_n(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
-    log_error("read header failed: %s", strerror(errno));
-    goto cleanup;
+static void session_set_reply(struct session *s, int reply) {
+  struct window_pane *p;
+  if (!s->active_window)
+    return;
+  list_for_each_entry(p, &s->active_window->panes, link) {
+    if (reply)
+      p->flags &= ~PANE_NO_REPLY;
+    else
+      p->flags |= PANE_NO_REPLY;
+  }
+}
+
+/*
+  拥有者在这个 pane 上落后超过半个输出流时暂停读取 PTY，
+  由 shell 的 PTY 缓冲区反压，与客户端直接读 PTY 时的流控一致。
+  观察者不参与，落后太多时改收快照
+*/
+static int session_owner_behind(struct session *s, int idx) {
+  const struct stream *st = &s->streams[idx];
+  return s->conn && st->head - s->conn->cursor[idx] > st->cap / 2;
+}
+
+/*
+  按当前状态注册 pane 的 master_fd：没被暂停时关注可读，
+  有积压的终端应答时关注可写
+*/
+static void session_pane_watch(struct session *s, struct window_pane *p) {
+  if (p->master_fd < 0)
+    return;
+  unsigned int events = 0;
+  if (!(s->throttled & (1ULL << p->id)))
+    events |= REACTOR_READ;
+  if (p->in_len > 0)
+    events |= REACTOR_WRITE;
+  if (!events)
+    reactor_del(server_reactor, &p->handler);
+  else if (p->handler.active)
+    reactor_mod(server_reactor, &p->handler, events);
+  else
+    reactor_add(server_reactor, &p->handler, p->master_fd, events,
+                server_pane_event);
+}
+
+/*
+  服务端模拟器的应答写不下：等 PTY 可写，不阻塞事件循环
+*/
+static void server_pane_blocked(struct window_pane *p) {
+  session_pane_watch(p->window->data, p);
+}
+
+/*
+  拥有者跟上之后恢复读取被暂停的 pane
+*/
+static void session_resume(struct session *s) {
+  for (int i = 0; i < s->pane_count && s->throttled; i++) {
+    if (!(s->throttled & (1ULL << i)) || session_owner_behind(s, i))
+      continue;
+    s->throttled &= ~(1ULL << i);
+    struct window_pane *p = session_find_pane(s, i);
+    if (p)
+      session_pane_watch(s, p);
+  }
+}
+
+/*
+  发送队列中尚未发出的字节数
+*/
+static size_t conn_pending(const struct server_conn *conn) {
+  return conn->out_len - conn->out_off;
+}
+
+/*
+  丢掉已发出的部分，把未发出的字节和 fd 移到队首
+*/
+static void conn_compact(struct server_conn *conn) {
+  size_t off = conn->out_off;
+  memmove(conn->out, conn->out + off, conn->out_len - off);
+  conn->out_len -= off;
+  conn->out_off = 0;
+  int j = 0;
+  for (int i = conn->out_fd_next; i < conn->out_nfds; i++, j++) {
+    conn->out_fds[j] = conn->out_fds[i];
+    conn->out_fd_at[j] = conn->out_fd_at[i] - off;
   }
+  conn->out_nfds = j;
+  conn->out_fd_next = 0;
+}
 
-  // 读取消息体
-  char *buf = NULL;
-  if (hdr.len > MAX_MSG_PAYLOAD) {
-    log_error("payload too large: %zu", hdr.len);
+/*
+  为 n 字节腾出空间：先压缩队列，不够再从池中换更大一级
+*/
+static int conn_reserve(struct server_conn *conn, size_t n) {
+  if (conn->out_off > 0 && conn->out_len + n > conn->out_cap)
+    conn_compact(conn);
+  size_t need = conn->out_len + n;
+  if (need <= conn->out_cap)
+    return 0;
+  char *out = bufpool_grow(conn->out, conn->out_len, &conn->out_cap, need);
+  if (!out) {
+    log_error("grow send queue failed");
     return -1;
   }
-  if (hdr.len > 0) {
-    buf = malloc(hdr.len);
-    if (!buf) {
-      log_error("malloc failed");
+  conn->out = out;
+  return 0;
+}
+
+/*
+  把不带消息头的应答放入发送队列（版本握手、会话列表等一次性应答）
+*/
+static int conn_queue_raw(struct server_conn *conn, const void *data,
+                          size_t len) {
+  if (conn_reserve(conn, len) < 0)
+    return -1;
+  memcpy(conn->out + conn->out_len, data, len);
+  conn->out_len += len;
+  return 0;
+}
+
+/*
+  把一帧放入发送队列：消息头加两段负载。
+  fd >= 0 时之后再排一个占位字节，发送时用 send_fd 带上这个 fd，
+  队列接管 fd，发送或丢弃后关闭
+*/
+static int conn_queue(struct server_conn *conn, enum msgtype type,
+                      const void *a, size_t alen, const void *b, size_t blen,
+                      int fd) {
+  struct msg_header hdr = {type, alen + blen};
+  if (fd >= 0 && conn->out_nfds >= CONN_MAX_FDS) {
+    if (conn->out_fd_next == 0) {
+      log_error("too many fds queued on connection %d", conn->handler.fd);
+      close(fd);
       return -1;
     }
-    if (read_n(fd, buf, hdr.len) != hdr.len) {
-      log_error("read payload failed: %s", strerror(errno));
-      goto cleanup;
+    conn_compact(conn);
+  }
+  if (conn_reserve(conn, sizeof(hdr) + alen + blen + (fd >= 0)) < 0) {
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  memcpy(conn->out + conn->out_len, &hdr, sizeof(hdr));
+  conn->out_len += sizeof(hdr);
+  if (alen) {
+    memcpy(conn->out + conn->out_len, a, alen);
+    conn->out_len += alen;
+  }
+  if (blen) {
+    memcpy(conn->out + conn->out_len, b, blen);
+    conn->out_len += blen;
+  }
+  if (fd >= 0) {
+    conn->out_fds[conn->out_nfds] = fd;
+    conn->out_fd_at[conn->out_nfds] = conn->out_len;
+    conn->out_nfds++;
+    conn->out[conn->out_len++] = 0;
+  }
+  return 0;
+}
+
+/*
+  尽量写出发送队列，不阻塞
+  返回 0 表示写完或套接字已满，-1 表示连接出错
+*/
+static int conn_send(struct server_conn *conn) {
+  int fd = conn->handler.fd;
+  while (conn->out_off < conn->out_len) {
+    size_t end = conn->out_len;
+    int err;
+    if (conn->out_fd_next < conn->out_nfds) {
+      end = conn->out_fd_at[conn->out_fd_next];
+      if (end == conn->out_off) {
+        int pass = conn->out_fds[conn->out_fd_next];
+        if (send_fd(fd, pass, MSG_DONTWAIT | MSG_NOSIGNAL) == 0) {
+          close(pass);
+          conn->out_fd_next++;
+          conn->out_off++;
+          continue;
+        }
+        err = errno;
+        goto error;
+      }
+    }
+    ssize_t n = send(fd, conn->out + conn->out_off, end - conn->out_off,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n >= 0) {
+      conn->out_off += n;
+      continue;
+    }
+    err = errno;
+  error:
+    if (err == EINTR)
+      continue;
+    if (err == EAGAIN || err == EWOULDBLOCK)
+      return 0;
+    log_debug("send to connection %d failed: %s", fd, strerror(err));
+    return -1;
+  }
+  conn->out_len = conn->out_off = 0;
+  conn->out_nfds = conn->out_fd_next = 0;
+  // 快照、会话列表等撑大的队列发完就还回池中
+  if (conn->out_cap > MUXKIT_BUFPOOL_IDLE) {
+    bufpool_put(conn->out, conn->out_cap);
+    conn->out = NULL;
+    conn->out_cap = 0;
+  }
+  return 0;
+}
+
+/*
+  把模拟器中一个 pane 的网格快照放入发送队列
+*/
+static int conn_queue_snapshot(struct server_conn *conn,
+                               struct window_pane *p) {
+  struct msg_grid mg = {.pane_id = p->id};
+  int fd = grid_snapshot_create(p->grid, p->id, p->cx, p->cy,
+                                grid_snapshot_flags(), &mg.len);
+  if (fd < 0) {
+    log_error("snapshot pane %u failed", p->id);
+    return -1;
+  }
+  return conn_queue(conn, MSG_GRID_SAVE, &mg, sizeof(mg), NULL, 0, fd);
+}
+
+/*
+  从一个 pane 的输出流取下一条记录放入发送队列，连续的输出合并成一帧。
+  游标已被覆盖时改发模拟器的网格快照，之后从 head 继续
+*/
+static int conn_pull_pane(struct server_conn *conn, int idx) {
+  static char chunk[MUXKIT_STREAM_CHUNK];
+  struct session *s = conn->session;
+  struct stream *st = &s->streams[idx];
+  struct msg_pane mp = {.pane_id = idx};
+  struct stream_record rec;
+  uint64_t pos = conn->cursor[idx];
+
+  if (stream_peek(st, pos, &rec) < 0) {
+    struct window_pane *p = session_find_pane(s, idx);
+    log_debug("connection %d fell behind on pane %d, resync",
+              conn->handler.fd, idx);
+    conn->cursor[idx] = st->head;
+    if (!p) // pane 已退出，只差退出事件
+      return conn_queue(conn, MSG_PANE_EXIT, &mp, sizeof(mp), NULL, 0, -1);
+    return conn_queue_snapshot(conn, p);
+  }
+
+  switch (rec.type) {
+  case STREAM_OUTPUT: {
+    size_t len = 0;
+    do {
+      stream_data(st, pos, &rec, chunk + len);
+      len += rec.len;
+      pos += sizeof(rec) + rec.len;
+    } while (stream_peek(st, pos, &rec) > 0 && rec.type == STREAM_OUTPUT &&
+             len + rec.len <= sizeof(chunk));
+    conn->cursor[idx] = pos;
+    return conn_queue(conn, MSG_PANE_OUTPUT, &mp, sizeof(mp), chunk, len, -1);
+  }
+  case STREAM_RESIZE:
+    mp.cols = rec.cols;
+    mp.rows = rec.rows;
+    conn->cursor[idx] = pos + sizeof(rec) + rec.len;
+    return conn_queue(conn, MSG_PANE_RESIZE, &mp, sizeof(mp), NULL, 0, -1);
+  default: // STREAM_EXIT
+    conn->cursor[idx] = pos + sizeof(rec) + rec.len;
+    return conn_queue(conn, MSG_PANE_EXIT, &mp, sizeof(mp), NULL, 0, -1);
+  }
+}
+
+/*
+  按 pane 轮流拉取输出流，直到队列到达高水位或所有流都已发完
+  返回 1 拉到了数据，0 没有新数据，-1 出错
+*/
+static int conn_pull(struct server_conn *conn) {
+  struct session *s = conn->session;
+  int pulled = 0, idle = 0;
+  if (!s)
+    return 0;
+  while (conn_pending(conn) < MUXKIT_CONN_HIGH_WATER &&
+         idle < s->pane_count) {
+    int i = conn->next_pane;
+    conn->next_pane = (i + 1) % s->pane_count;
+    if (!s->streams[i].buf || conn->cursor[i] >= s->streams[i].head) {
+      idle++;
+      continue;
+    }
+    if (conn_pull_pane(conn, i) < 0)
+      return -1;
+    pulled = 1;
+    idle = 0;
+  }
+  return pulled;
+}
+
+/*
+  写出发送队列，低于低水位时继续拉取输出流，直到套接字写满或没有新数据；
+  按水位调整关心的事件：有未发出的数据时等待可写，超过高水位时暂停读取。
+  返回 -1 表示连接出错或 closing 的连接已发完，由调用者关闭
+*/
+static int conn_flush(struct server_conn *conn) {
+  for (;;) {
+    if (conn_send(conn) < 0)
+      return -1;
+    if (conn_pending(conn) >= MUXKIT_CONN_LOW_WATER || conn->closing)
+      break;
+    int r = conn_pull(conn);
+    if (r < 0)
+      return -1;
+    if (r == 0)
+      break;
+  }
+
+  size_t pending = conn_pending(conn);
+  if (conn->closing && pending == 0)
+    return -1;
+  if (pending >= MUXKIT_CONN_HIGH_WATER && !conn->paused) {
+    log_debug("connection %d above high water (%zu bytes), pause reading",
+              conn->handler.fd, pending);
+    conn->paused = 1;
+  } else if (pending < MUXKIT_CONN_LOW_WATER) {
+    conn->paused = 0;
+  }
+  unsigned int events = (pending ? REACTOR_WRITE : 0) |
+                        (conn->paused || conn->closing ? 0 : REACTOR_READ);
+  if (events != conn->events) {
+    reactor_mod(server_reactor, &conn->handler, events);
+    conn->events = events;
+  }
+  struct session *s = conn->session;
+  if (s && s->conn == conn && s->throttled)
+    session_resume(s);
+  return 0;
+}
+
+/*
+  关闭客户端连接，解除与 session 的关联。
+  拥有者断开后会话转为分离状态，shell 继续运行，观察者不受影响
+*/
+static void server_conn_close(struct server_conn *conn) {
+  struct session *s = conn->session;
+  if (s) {
+    list_del(&conn->link);
+    if (s->conn == conn) {
+      s->conn = NULL;
+      s->detached = 1;
+      session_set_reply(s, 1);
+      session_resume(s);
+      log_info("session %d detached, shell continues running", s->id);
+    }
+  }
+  for (int i = conn->out_fd_next; i < conn->out_nfds; i++)
+    close(conn->out_fds[i]);
+  bufpool_put(conn->out, conn->out_cap);
+  msg_reader_free(&conn->in);
+  reactor_del(server_reactor, &conn->handler);
+  close(conn->handler.fd);
+  free(conn);
+  log_debug("buffer pool: %lu gets, %lu hits, %lu mallocs, %zu bytes cached",
+            bufpool_stats()->gets, bufpool_stats()->hits,
+            bufpool_stats()->mallocs, bufpool_stats()->cached);
+}
+
+/*
+  推送失败：断开连接。正在处理消息的连接只做标记，由 server_drain 返回后关闭
+*/
+static void conn_fail(struct server_conn *conn) {
+  if (conn == handling_conn)
+    conn->broken = 1;
+  else
+    server_conn_close(conn);
+}
+
+/*
+  把输出流推给 session 的所有连接
+*/
+static void session_flush(struct session *s) {
+  struct server_conn *conn, *tmp;
+  list_for_each_entry_safe(conn, tmp, &s->clients, link) {
+    if (conn_flush(conn) < 0)
+      conn_fail(conn);
+  }
+}
+
+/*
+  PTY 尺寸由拥有者设置，服务端模拟器跟随，并在输出流中记下新尺寸
+*/
+static void session_sync_size(struct session *s, struct window_pane *p) {
+  struct winsize ws;
+  if (ioctl(p->master_fd, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0 ||
+      ws.ws_row == 0)
+    return;
+  if (ws.ws_col == p->sx && ws.ws_row == p->sy)
+    return;
+  pane_resize(p, ws.ws_col, ws.ws_row);
+  stream_append(&s->streams[p->id], STREAM_RESIZE, ws.ws_col, ws.ws_row, NULL,
+                0);
+  s->checkpoint_dirty = 1;
+}
+
+/*
+  pane 的 shell 退出：读完 PTY 中剩余的输出，追加退出记录，
+  销毁模拟器 pane 并关闭 master_fd。EOF 和 SIGCHLD 都会走到这里，只处理一次
+*/
+static void session_pane_exit(struct session *s, int idx) {
+  if (s->master_fds[idx] < 0)
+    return;
+  struct window_pane *p = session_find_pane(s, idx);
+  if (p) {
+    char buff[MUXKIT_STREAM_CHUNK];
+    ssize_t n;
+    while ((n = read(p->master_fd, buff, sizeof(buff))) > 0 ||
+           (n < 0 && errno == EINTR)) {
+      if (n > 0) {
+        pane_input(p, buff, n);
+        stream_append(&s->streams[idx], STREAM_OUTPUT, 0, 0, buff, n);
+      }
+    }
+    reactor_del(server_reactor, &p->handler);
+    list_del(&p->link);
+    pane_destroy(p);
+  }
+  log_debug("pane %d of session %d: pty closed", idx, s->id);
+  s->throttled &= ~(1ULL << idx);
+  close(s->master_fds[idx]);
+  s->master_fds[idx] = -1;
+  stream_append(&s->streams[idx], STREAM_EXIT, 0, 0, NULL, 0);
+  s->checkpoint_dirty = 1;
+  session_flush(s);
+}
+
+/*
+  PTY 可写时写出积压的终端应答；可读时读到 EAGAIN 或预算用完为止。
+  每块输出先送入服务端模拟器，再追加到输出流推给附加的连接
+*/
+static void server_pane_event(struct reactor_handler *h, unsigned int events) {
+  struct window_pane *p = container_of(h, struct window_pane, handler);
+  struct session *s = p->window->data;
+  char buff[MUXKIT_STREAM_CHUNK];
+  size_t total = 0;
+
+  if (events & REACTOR_WRITE)
+    pane_flush_input(p);
+  if (!(events & (REACTOR_READ | REACTOR_ERROR))) {
+    session_pane_watch(s, p);
+    return;
+  }
+
+  session_sync_size(s, p);
+  while (total < MUXKIT_READ_BUDGET) {
+    if (session_owner_behind(s, p->id)) {
+      s->throttled |= 1ULL << p->id;
+      break;
     }
+    ssize_t n = read(p->master_fd, buff, sizeof(buff));
+    if (n > 0) {
+      pane_input(p, buff, n);
+      stream_append(&s->streams[p->id], STREAM_OUTPUT, 0, 0, buff, n);
+      session_flush(s);
+      total += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      break;
+    // EOF 或 EIO，shell 已退出
+    session_pane_exit(s, p->id);
+    return;
+  }
+  session_pane_watch(s, p);
+  s->active_window->flags |= WINDOW_CHANGED;
+}
+
+/*
+  为新 pane 创建服务端模拟器和输出流，开始读取 PTY
+*/
+static int session_emulate_pane(struct session *s, int idx) {
+  if (!s->active_window) {
+    s->active_window = window_create("session");
+    if (!s->active_window) {
+      log_error("create emulator window for session %d failed", s->id);
+      return -1;
+    }
+    s->active_window->data = s;
+  }
+  struct window_pane *p =
+      pane_create(s->active_window, s->ws.ws_col, s->ws.ws_row, 0, 0);
+  if (!p) {
+    log_error("create emulator pane %d for session %d failed", idx, s->id);
+    return -1;
+  }
+  p->id = idx;
+  if (stream_init(&s->streams[idx], MUXKIT_STREAM_RING) < 0) {
+    list_del(&p->link);
+    pane_destroy(p);
+    return -1;
+  }
+  if (s->conn)
+    p->flags |= PANE_NO_REPLY;
+  pane_set_master_fd(p, s->master_fds[idx]);
+  p->input_blocked = server_pane_blocked;
+  int flags = fcntl(p->master_fd, F_GETFL);
+  if (flags != -1)
+    fcntl(p->master_fd, F_SETFL, flags | O_NONBLOCK);
+  session_pane_watch(s, p);
+  s->active_window->flags |= WINDOW_CHANGED;
+  return 0;
+}
+
+/*
+  连接附加到会话：拥有者拿到所有 PTY fd，观察者只读。
+  应答包括每个 pane 的尺寸和模拟器网格快照，之后从输出流的 head 开始推送
+*/
+static int session_attach(struct session *s, struct server_conn *conn,
+                          int observer) {
+  conn->session = s;
+  conn->observer = observer;
+  list_add_tail(&conn->link, &s->clients);
+  if (!observer) {
+    s->conn = conn;
+    s->detached = 0;
+    session_set_reply(s, 0);
+  }
+
+  struct msg_attach ma = {.pane_count = 0, .next_pane_id = s->pane_count};
+  struct window_pane *p;
+  if (s->active_window) {
+    list_for_each_entry(p, &s->active_window->panes, link) ma.pane_count++;
+  }
+  if (conn_queue(conn, MSG_READY, &ma, sizeof(ma), NULL, 0, -1) < 0)
+    return -1;
+  for (int i = 0; i < s->pane_count; i++)
+    conn->cursor[i] = s->streams[i].head;
+  if (s->active_window) {
+    list_for_each_entry(p, &s->active_window->panes, link) {
+      struct msg_pane mp = {.pane_id = p->id, .cols = p->sx, .rows = p->sy};
+      int fd = -1;
+      if (!observer && (fd = dup(p->master_fd)) >= 0)
+        mp.flags |= MSG_PANE_FD;
+      if (conn_queue(conn, MSG_PANE_NEW, &mp, sizeof(mp), NULL, 0, fd) < 0 ||
+          conn_queue_snapshot(conn, p) < 0)
+        return -1;
+    }
+  }
+  log_info("%s session %d with %d panes", observer ? "watching" : "attached to",
+           s->id, ma.pane_count);
+  return conn_flush(conn);
+}
+
+/*
+  通知所有连接新建了 pane，拥有者同时拿到 PTY fd
+*/
+static void session_announce_pane(struct session *s, int idx) {
+  struct window_pane *p = session_find_pane(s, idx);
+  struct server_conn *conn, *tmp;
+  list_for_each_entry_safe(conn, tmp, &s->clients, link) {
+    struct msg_pane mp = {.pane_id = idx, .cols = p->sx, .rows = p->sy};
+    int fd = -1;
+    if (conn == s->conn && (fd = dup(p->master_fd)) >= 0)
+      mp.flags |= MSG_PANE_FD;
+    conn->cursor[idx] = s->streams[idx].head;
+    if (conn_queue(conn, MSG_PANE_NEW, &mp, sizeof(mp), NULL, 0, fd) < 0 ||
+        conn_flush(conn) < 0)
+      conn_fail(conn);
   }
+}
+
+/*
+  释放 session 的所有资源：断开连接、销毁模拟器、关闭 PTY
+*/
+static void session_destroy(struct session *s) {
+  struct server_conn *conn, *tmp;
+  list_for_each_entry_safe(conn, tmp, &s->clients, link) {
+    server_conn_close(conn);
+  }
+  if (s->active_window) {
+    struct window_pane *p, *ptmp;
+    list_for_each_entry_safe(p, ptmp, &s->active_window->panes, link) {
+      reactor_del(server_reactor, &p->handler);
+      list_del(&p->link);
+      pane_destroy(p);
+    }
+    window_destroy(s->active_window);
+    s->active_window = NULL;
+  }
+  for (int i = 0; i < MAX_PANES; i++) {
+    if (s->master_fds[i] >= 0)
+      close(s->master_fds[i]);
+    stream_free(&s->streams[i]);
+    free(s->latency[i]);
+  }
+  list_del(&s->link);
+  free(s);
+}
 
+/*
+  会话结束：删除检查点并释放
+*/
+static void session_free(struct session *s) {
+  checkpoint_remove(s->id);
+  session_destroy(s);
+}
+
+/*
+  按 ID 升序插入会话链表（新建会话的 ID 取链表尾 + 1）
+*/
+static void session_insert(struct session *s) {
+  struct session *pos;
+  list_for_each_entry(pos, &session_list, link) {
+    if (pos->id > s->id) {
+      list_add_tail(&s->link, &pos->link);
+      return;
+    }
+  }
+  list_add_tail(&s->link, &session_list);
+}
+
+/*
+  为 session 新建一个 pane：创建 PTY、启动 shell 并交给服务端模拟器
+  返回 pane 下标，失败返回 -1
+*/
+static int session_spawn_pane(struct session *s) {
+  if (s->pane_count >= MAX_PANES) {
+    log_error("max panes reached");
+    return -1;
+  }
+
+  // 创建伪终端
+  int master_fd = posix_openpt(O_RDWR);
+  if (master_fd == -1) {
+    log_error("posix_openpt failed: %s", strerror(errno));
+    return -1;
+  }
+  // 解锁 slave 设备
+  grantpt(master_fd);
+  unlockpt(master_fd);
+
+  s->slave_name = ptsname(master_fd);
+  s->slave_fd = open(s->slave_name, O_RDWR);
+  ioctl(s->slave_fd, TIOCSWINSZ, &s->ws);
+
+  log_info("create pane %d for session id:%d", s->pane_count, s->id);
+
+  s->slave_pid = spawn_child(s);
+
+  /* 父进程关闭 slave_fd，否则 shell 退出后 master 不会收到 EOF */
+  close(s->slave_fd);
+  s->slave_fd = -1;
+
+  if (s->slave_pid < 0) {
+    log_error("spawn_child failed");
+    close(master_fd);
+    return -1;
+  }
+
+  // 保存到数组
+  int idx = s->pane_count;
+  s->master_fds[idx] = master_fd;
+  s->pane_pids[idx] = s->slave_pid;
+  if (session_emulate_pane(s, idx) < 0) {
+    // 没有模拟器就没有人读 PTY，放弃这个 pane
+    kill(s->slave_pid, SIGKILL);
+    close(master_fd);
+    s->master_fds[idx] = -1;
+    s->pane_pids[idx] = -1;
+    return -1;
+  }
+  s->pane_count++;
+  s->checkpoint_dirty = 1;
+
+  log_info("spawned child process with pid %d, total panes: %d", s->slave_pid,
+           s->pane_count);
+  return idx;
+}
+
+/*
+  从磁盘检查点恢复会话：每个 pane 启动新的 shell，
+  旧的屏幕和历史交给服务端模拟器，会话处于分离状态等待 attach。
+  已存在的会话 ID 跳过（其检查点就是当前会话写的）
+*/
+static void server_restore(char *response, size_t size) {
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  int ids[MUXKIT_CHECKPOINT_MAX];
+  int n = checkpoint_list(ids, MUXKIT_CHECKPOINT_MAX);
+  int restored = 0, panes = 0;
+  for (int i = 0; i < n; i++) {
+    if (find_session_by_id(ids[i]))
+      continue;
+    struct checkpoint ck;
+    if (checkpoint_load(ids[i], &ck) < 0)
+      continue;
+
+    struct session *s = malloc(sizeof(struct session));
+    if (!s) {
+      log_error("malloc session failed");
+      for (int j = 0; j < MAX_PANES; j++) {
+        if (ck.grid_fd[j] >= 0)
+          close(ck.grid_fd[j]);
+      }
+      break;
+    }
+    session_init(s);
+    s->id = ck.id;
+    if (ck.ws.ws_row && ck.ws.ws_col)
+      s->ws = ck.ws;
+    for (int j = 0; j < ck.pane_count; j++) {
+      if (session_spawn_pane(s) < 0)
+        break;
+    }
+    // 旧的屏幕和历史直接恢复到服务端模拟器
+    for (int j = 0; j < MAX_PANES; j++) {
+      if (ck.grid_fd[j] < 0)
+        continue;
+      struct window_pane *p = session_find_pane(s, j);
+      if (p) {
+        unsigned int pane_id, cx, cy;
+        if (grid_snapshot_restore(p->grid, ck.grid_fd[j], ck.grid_len[j],
+                                  &pane_id, &cx, &cy) == 0) {
+          p->cx = cx;
+          p->cy = cy;
+          if (p->grid->width != p->sx || p->grid->height != p->sy)
+            pane_resize(p, p->sx, p->sy);
+          sync_vterm_from_grid(p);
+        } else {
+          log_warn("restore grid of pane %d in session %d failed", j, s->id);
+        }
+      }
+      close(ck.grid_fd[j]);
+    }
+    if (s->pane_count == 0) {
+      // 启动 shell 失败，保留检查点下次再试
+      session_destroy(s);
+      continue;
+    }
+    session_insert(s);
+    s->detached = 1;
+    restored++;
+    panes += s->pane_count;
+    log_info("restored session %d with %d panes", s->id, s->pane_count);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+  log_info("restored %d sessions (%d panes) in %.1f ms", restored, panes, ms);
+  snprintf(response, size, TR(MSG_SESSIONS_RESTORED), restored, panes, ms);
+}
+
+/*
+  一次性命令的应答：长度加字符串，发完后关闭连接
+  返回 1 等待发完，-1 已经发完或出错，由调用者关闭
+*/
+static int conn_reply(struct server_conn *conn, const char *response) {
+  size_t len = strlen(response) + 1;
+  conn->closing = 1;
+  if (conn_queue_raw(conn, &len, sizeof(len)) < 0 ||
+      conn_queue_raw(conn, response, len) < 0)
+    return -1;
+  return conn_flush(conn) < 0 ? -1 : 1;
+}
+
+/*
+  延迟报告：每个上报过的 pane 一组，最后是整个会话的合计。
+  返回 malloc 的字符串，由调用者释放
+*/
+static char *session_latency_report(struct session *s) {
+  size_t size = (MAX_PANES + 2) * LAT_STAGES * MUXKIT_BUF_MEDIUM;
+  char *report = malloc(size);
+  if (!report)
+    return NULL;
+  struct latency_hist total[LAT_STAGES];
+  memset(total, 0, sizeof(total));
+  size_t off = snprintf(report, size, TR(MSG_LATENCY_TITLE), s->id);
+  for (int i = 0; i < MAX_PANES; i++) {
+    if (!s->latency[i])
+      continue;
+    char label[MUXKIT_BUF_SMALL];
+    snprintf(label, sizeof(label), "pane %d", i);
+    off += latency_format(report + off, size - off, label, s->latency[i]);
+    for (int st = 0; st < LAT_STAGES; st++)
+      latency_merge(&total[st], &s->latency[i][st]);
+  }
+  if (total[LAT_TOTAL].count == 0)
+    snprintf(report, size, TR(MSG_LATENCY_NONE), s->id);
+  else
+    latency_format(report + off, size - off, "session", total);
+  return report;
+}
+
+/*
+  处理一条来自客户端的消息，buf 指向接收缓冲区中的负载
+  返回 1 继续，-1 由调用者关闭连接
+*/
+static int server_handle(struct server_conn *conn, struct msg_header hdr,
+                         char *buf) {
   if (hdr.type == MSG_VERSION) {
     int server_version = PROTOCOL_VERSION;
-    int *client_version = (int *)buf;
-    if (server_version != *client_version) {
+    int client_version = 0;
+    if (hdr.len == sizeof(client_version))
+      memcpy(&client_version, buf, sizeof(client_version));
+    if (server_version != client_version) {
       log_error("protocol version mismatch: client=%d, server=%d",
-                server_version, *client_version);
+                client_version, server_version);
       goto cleanup;
     }
-    if (write_n(fd, &server_version, sizeof(server_version)) < 0) {
-      log_error("write server version failed: %s", strerror(errno));
+    if (conn_queue_raw(conn, &server_version, sizeof(server_version)) < 0 ||
+        conn_flush(conn) < 0) {
+      log_error("write server version failed");
       goto cleanup;
     }
-    free(buf);
     return 1;
   }
   // 列出会话列表
@@ -226,21 +1055,16 @@ int server_receive(int fd) {
       snprintf(response, sizeof(response), "%s", TR(MSG_NO_SESSIONS));
     }
 
-    size_t len = strlen(response) + 1;
-    if (write_n(fd, &len, sizeof(len)) < 0 || write_n(fd, response, len) < 0) {
-      log_error("write session list failed: %s", strerror(errno));
-      goto cleanup;
-    }
-
     log_info("listed %d sessions", count);
-    free(buf);
-    return -1;
+    return conn_reply(conn, response);
   }
 
   // 杀死指定会话
   if (hdr.type == MSG_DETACHKILL) {
     char response[MUXKIT_BUF_MEDIUM] = {0};
     int session_id;
+    if (hdr.len != sizeof(session_id))
+      goto cleanup;
     memcpy(&session_id, buf, sizeof(session_id));
 
     struct session *target = find_session_by_id(session_id);
@@ -251,16 +1075,11 @@ int server_receive(int fd) {
         if (target->pane_pids[i] > 0) {
           kill(target->pane_pids[i], SIGKILL);
         }
-        if (target->master_fds[i] >= 0) {
-          close(target->master_fds[i]);
-        }
       }
+      // master_fd 在 session_free 中注销并关闭
       if (target->slave_fd >= 0)
         close(target->slave_fd);
-      if (target->client_fd >= 0)
-        close(target->client_fd);
-      list_del(&target->link);
-      free(target);
+      session_free(target);
       snprintf(response, sizeof(response), TR(MSG_SESSION_KILLED), session_id);
     } else {
       log_warn("kill-session failed: session %d not found", session_id);
@@ -268,102 +1087,138 @@ int server_receive(int fd) {
                session_id);
     }
 
-    size_t len = strlen(response) + 1;
-    if (write_n(fd, &len, sizeof(len)) < 0 || write_n(fd, response, len) < 0) {
-      log_error("write kill-session response failed: %s", strerror(errno));
+    return conn_reply(conn, response);
+  }
+
+  // 查询会话的输入延迟
+  if (hdr.type == MSG_LATENCY_QUERY) {
+    char response[MUXKIT_BUF_MEDIUM] = {0};
+    int session_id;
+    if (hdr.len != sizeof(session_id))
       goto cleanup;
+    memcpy(&session_id, buf, sizeof(session_id));
+    struct session *target = find_session_by_id(session_id);
+    if (!target) {
+      snprintf(response, sizeof(response), TR(MSG_SESSION_NOT_FOUND),
+               session_id);
+      return conn_reply(conn, response);
     }
-    goto cleanup;
+    char *report = session_latency_report(target);
+    if (!report)
+      goto cleanup;
+    int ret = conn_reply(conn, report);
+    free(report);
+    return ret;
+  }
+
+  // 从检查点恢复会话
+  if (hdr.type == MSG_RESTORE) {
+    char response[MUXKIT_BUF_MEDIUM] = {0};
+    server_restore(response, sizeof(response));
+    return conn_reply(conn, response);
   }
 
   // 消息类型需要关联 session
-  struct session *cur = find_session_by_client_fd(fd);
+  struct session *cur = conn->session;
 
-  // 如果没找到，说明是新连接，创建新 session
-  if (cur == NULL) {
+  // 新连接的第一条建会话消息，创建新 session
+  if (cur == NULL && (hdr.type == MSG_COMMAND || hdr.type == MSG_RESIZE)) {
     cur = malloc(sizeof(struct session));
+    if (!cur) {
+      log_error("malloc session failed");
+      goto cleanup;
+    }
     session_init(cur);
-    cur->client_fd = fd;
+    cur->conn = conn;
+    conn->session = cur;
+    list_add_tail(&conn->link, &cur->clients);
 
     // 设置 session id
-    if (list_empty(&session_list)) {
-      cur->id = 0;
-    } else {
+    cur->id = session_id_floor;
+    if (!list_empty(&session_list)) {
       struct session *last =
           list_last_entry(&session_list, struct session, link);
-      cur->id = last->id + 1;
+      if (last->id + 1 > cur->id)
+        cur->id = last->id + 1;
     }
     list_add_tail(&cur->link, &session_list);
-    log_debug("created new session id=%d for fd=%d", cur->id, fd);
+    log_debug("created new session id=%d for fd=%d", cur->id,
+              conn->handler.fd);
   }
 
   // 判断消息类型
   switch (hdr.type) {
   // 处理命令
   case MSG_COMMAND:
+    if (hdr.len == 0 || buf[hdr.len - 1] != '\0') {
+      log_warn("MSG_COMMAND: command not terminated");
+      return 1;
+    }
     if (strcmp(buf, "new-session") == 0 || strcmp(buf, "pane-split") == 0) {
+      if (cur->conn != conn) {
+        log_warn("%s from observer on fd %d ignored", buf,
+                 conn->handler.fd);
+        return 1;
+      }
       // 检查 pane 数量限制
       if (cur->pane_count >= MAX_PANES) {
         log_error("max panes reached");
-        free(buf);
         return 1;
       }
 
-      // 创建伪终端
-      int new_master_fd = posix_openpt(O_RDWR);
-      if (new_master_fd == -1) {
-        log_error("posix_openpt failed: %s", strerror(errno));
-        free(buf);
+      int idx = session_spawn_pane(cur);
+      if (idx == -1) {
         return -1;
       }
-      // 解锁 slave 设备
-      grantpt(new_master_fd);
-      unlockpt(new_master_fd);
-
-      // 传回 client
-      send_fd(fd, new_master_fd);
-      cur->slave_name = ptsname(new_master_fd);
-      cur->slave_fd = open(cur->slave_name, O_RDWR);
-      ioctl(cur->slave_fd, TIOCSWINSZ, &cur->ws);
-
-      log_info("create pane %d for session id:%d", cur->pane_count, cur->id);
-
-      cur->slave_pid = spawn_child(cur);
-
-      /* 父进程关闭 slave_fd，否则 shell 退出后 master 不会收到 EOF */
-      close(cur->slave_fd);
-      cur->slave_fd = -1;
-
-      if (cur->slave_pid < 0) {
-        log_error("spawn_child failed");
-        close(new_master_fd);
-        return -1;
-      }
-
-      // 保存到数组
-      cur->master_fds[cur->pane_count] = new_master_fd;
-      cur->pane_pids[cur->pane_count] = cur->slave_pid;
-      cur->pane_count++;
-
-      log_info("spawned child process with pid %d, total panes: %d",
-               cur->slave_pid, cur->pane_count);
+      // 通知附加的连接，PTY fd 随 MSG_PANE_NEW 传给拥有者
+      session_announce_pane(cur, idx);
     }
-    free(buf);
     return 1;
   case MSG_RESIZE:
     log_debug("resize session");
     if (cur == NULL) {
-      log_warn("MSG_RESIZE: session not found for fd %d", fd);
-      free(buf);
+      log_warn("MSG_RESIZE: session not found for fd %d",
+               conn->handler.fd);
+      return 1;
+    }
+    if (cur->conn != conn) {
+      log_warn("MSG_RESIZE from observer on fd %d ignored",
+               conn->handler.fd);
+      return 1;
+    }
+    // 只保存新 pane 的尺寸，不给 PTY 发 TIOCSWINSZ
+    // （拥有者负责给每个 pane 发送正确的尺寸，模拟器跟随）
+    if (hdr.len != sizeof(cur->ws)) {
+      log_warn("MSG_RESIZE: bad payload length %zu", hdr.len);
       return 1;
     }
-    // 只保存整体尺寸，不给 PTY 发 TIOCSWINSZ
-    // （client 负责给每个 pane 发送正确的尺寸）
     memcpy(&cur->ws, buf, sizeof(cur->ws));
-    free(buf);
+    cur->checkpoint_dirty = 1;
+    if (cur->active_window) {
+      struct window_pane *p;
+      list_for_each_entry(p, &cur->active_window->panes, link) {
+        session_sync_size(cur, p);
+      }
+      session_flush(cur);
+    }
+    return 1;
+  case MSG_LATENCY: {
+    // 拥有者上报的新增样本，累加到 pane 的直方图
+    struct msg_latency ml;
+    if (!cur || cur->conn != conn || hdr.len != sizeof(ml))
+      return 1;
+    memcpy(&ml, buf, sizeof(ml));
+    if (ml.pane_id >= MAX_PANES)
+      return 1;
+    struct latency_hist **h = &cur->latency[ml.pane_id];
+    if (!*h && !(*h = calloc(LAT_STAGES, sizeof(**h))))
+      return 1;
+    for (int i = 0; i < LAT_STAGES; i++)
+      latency_merge(&(*h)[i], &ml.stages[i]);
     return 1;
+  }
   case MSG_EXITED:
-    log_info("exit a session, pid:%s", buf);
+    log_info("exit a session, pid:%.*s", (int)hdr.len, buf);
     struct session *sess;
     list_for_each_entry(sess, &session_list, link) {
       log_info("session id=%d, pid=%d", sess->id, sess->slave_pid);
@@ -372,274 +1227,236 @@ int server_receive(int fd) {
     break;
   case MSG_DETACH:
     if (hdr.len == 0) {
+      // 分离：关闭本连接，拥有者断开后会话转为分离状态
       log_info("detach a session");
-      sess = NULL;
-      sess = find_session_by_client_fd(fd);
-      if (sess) {
-        sess->detached = 1;
-        log_debug("session id=%d marked as detached", sess->id);
-      }
-    } else {
-      // attach: 客户端发送的是二进制 int
-      int session_id;
-      memcpy(&session_id, buf, sizeof(session_id));
-      struct session *target = find_session_by_id(session_id);
-      if (target && target->detached) {
-        log_debug("attaching to detached session id=%d, pane_count=%d",
-                  target->id, target->pane_count);
-        // 先发送 pane 数量
-        if (write_n(fd, &target->pane_count, sizeof(int)) < 0) {
-          log_error("write pane_count failed: %s", strerror(errno));
-          free(buf);
-          return -1;
-        }
-        // 再发送所有 pane 的 fd
-        for (int i = 0; i < target->pane_count; i++) {
-          send_fd(fd, target->master_fds[i]);
-        }
-        // 统计并发送 grid 数量
-        int grid_count = 0;
-        for (int i = 0; i < target->pane_count; i++) {
-          if (target->grid_data[i] && target->grid_data_len[i] > 0)
-            grid_count++;
-        }
-        log_info("attach: pane_count=%d, grid_count=%d", target->pane_count,
-                 grid_count);
-        for (int i = 0; i < target->pane_count; i++) {
-          log_info("attach: grid_data[%d]=%p, len=%zd", i, target->grid_data[i],
-                   target->grid_data_len[i]);
-        }
-        if (write_n(fd, &grid_count, sizeof(grid_count)) < 0) {
-          log_error("write grid_count failed: %s", strerror(errno));
-          free(buf);
-          return -1;
-        }
-        for (int i = 0; i < target->pane_count; i++) {
-          if (target->grid_data[i] && target->grid_data_len[i] > 0) {
-            struct msg_header gh = {MSG_GRID_SAVE, target->grid_data_len[i]};
-            log_info("attach: sending grid header type=%d, len=%zu", gh.type,
-                     gh.len);
-            ssize_t hdr_written = write_n(fd, &gh, sizeof(gh));
-            if (hdr_written < 0) {
-              log_error("write grid header failed: %s", strerror(errno));
-              free(buf);
-              return -1;
-            }
-            log_info("attach: header write_n returned %zd", hdr_written);
-            ssize_t data_written =
-                write_n(fd, target->grid_data[i], target->grid_data_len[i]);
-            if (data_written < 0) {
-              log_error("write grid data failed: %s", strerror(errno));
-              free(buf);
-              return -1;
-            }
-            log_info("attach: data write_n returned %zd (expected %zd)",
-                     data_written, target->grid_data_len[i]);
-            free(target->grid_data[i]);
-            target->grid_data[i] = NULL;
-            target->grid_data_len[i] = 0;
-          }
-        }
-        target->client_fd = fd;
-        target->detached = 0;
-      } else {
-        log_warn("attach failed: session %d not found or not detached",
-                 session_id);
-        // 发送失败标记：pane_count = 0
-        int zero = 0;
-        if (write_n(fd, &zero, sizeof(int)) < 0) {
-          log_error("write attach failure marker failed: %s", strerror(errno));
-          free(buf);
-          return -1;
-        }
-      }
+      return -1;
     }
-    free(buf);
-    return 1; // 返回 1，让 detach 处理代码来关闭 fd
-  case MSG_GRID_SAVE:
-    sess = find_session_by_client_fd(fd);
-    log_info("MSG_GRID_SAVE: sess=%p, fd=%d", (void *)sess, fd);
-    if (sess) {
-      unsigned int pane_id;
-      memcpy(&pane_id, buf, sizeof(pane_id));
-      log_info("MSG_GRID_SAVE: pane_id=%u, len=%zu", pane_id, hdr.len);
-      if (pane_id < MAX_PANES) {
-        free(sess->grid_data[pane_id]);
-        sess->grid_data[pane_id] = buf;
-        sess->grid_data_len[pane_id] = hdr.len;
-        buf = NULL;
-        log_info("MSG_GRID_SAVE: stored at grid_data[%u]", pane_id);
-      }
+    // attach：客户端发送的是二进制 int，与 MSG_WATCH 相同
+    /* fallthrough */
+  case MSG_WATCH: {
+    int session_id;
+    int observer = hdr.type == MSG_WATCH;
+    if (hdr.len != sizeof(session_id)) {
+      log_warn("attach: bad payload length %zu", hdr.len);
+      goto cleanup;
+    }
+    memcpy(&session_id, buf, sizeof(session_id));
+    struct session *target = find_session_by_id(session_id);
+    // 拥有者只能有一个，观察者不限
+    if (target && !conn->session && (observer || !target->conn)) {
+      if (session_attach(target, conn, observer) < 0)
+        goto cleanup;
+    } else {
+      log_warn("attach failed: session %d not found or not detached",
+               session_id);
+      // 失败标记：pane_count = 0
+      struct msg_attach ma = {0};
+      if (conn_queue(conn, MSG_READY, &ma, sizeof(ma), NULL, 0, -1) < 0 ||
+          conn_flush(conn) < 0)
+        goto cleanup;
     }
-    free(buf);
     return 1;
+  }
   default:
     log_warn("unknown msgtype %d", hdr.type);
   }
-  free(buf);
   return 1;
 
 cleanup:
-  if (buf)
-    free(buf);
   return -1;
 }
 
 /*
-  服务器主循环，监听客户端连接请求
+  处理接收缓冲区中所有完整的消息，eof 为 1 表示对端已关闭，
+  已到达的消息处理完再断开
 */
-void server_loop(int listen_fd) {
-  log_info("server loop started, listening on fd %d", listen_fd);
+static int server_drain(struct server_conn *conn, int eof) {
+  struct msg_header hdr;
+  char *buf;
+  int ret;
+  while (!conn->paused && !conn->closing &&
+         (ret = msg_reader_next(&conn->in, &hdr, &buf)) != 0) {
+    if (ret < 0)
+      return -1;
+    handling_conn = conn;
+    ret = server_handle(conn, hdr, buf);
+    handling_conn = NULL;
+    if (ret < 0 || conn->broken)
+      return -1;
+  }
+  return eof && !conn->closing ? -1 : 1;
+}
 
-  // 在循环开始前设置信号处理器
-  struct sigaction sa;
-  sa.sa_handler = server_signal_handler;
-  sa.sa_flags = 0; // 不用 SA_RESTART，让 select 被信号打断
-  sigemptyset(&sa.sa_mask);
-  sigaction(SIGCHLD, &sa, NULL);
-  sigaction(SIGPIPE, &sa, NULL);
-  fd_set read_fds;
-  int max_fd;
-  int client_fds[MAX_CLIENTS] = {-1};
-  // 初始化客户端 fd 数组
-  for (int i = 0; i < MAX_CLIENTS; i++) {
-    client_fds[i] = -1;
+/*
+  连接可读：读一次到接收缓冲区，处理其中所有完整的消息，
+  不完整的留到下次可读。暂停读取或等待关闭时剩余的消息留在缓冲区
+  返回 -1 表示连接已断开或出错，由调用者关闭
+*/
+int server_receive(struct server_conn *conn) {
+  int fd = conn->handler.fd;
+  ssize_t n = msg_reader_fill(&conn->in, fd);
+  if (n < 0 && errno != EAGAIN) {
+    log_error("read from connection %d failed: %s", fd, strerror(errno));
+    return -1;
   }
-  while (1) {
-    FD_ZERO(&read_fds);
-    FD_SET(listen_fd, &read_fds); // 添加监听 fd
-    max_fd = listen_fd;
-
-    // 当client_fds不为空时，把client_fds加入监听集合
-    // 添加所有已连接的客户端 fd
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-      if (client_fds[i] >= 0) {
-        FD_SET(client_fds[i], &read_fds);
-        if (client_fds[i] > max_fd) {
-          max_fd = client_fds[i];
-        }
-      }
-    }
+  return server_drain(conn, n == 0);
+}
 
-    // 阻塞，等待 fd 可读
-    int select_ok = 1;
-    if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0) {
-      if (errno == EINTR) {
-        select_ok = 0; // 不 continue，让后续代码检查 sigchld_pending
-      } else {
-        log_error("select failed: %s", strerror(errno));
-        break;
-      }
-    }
+/*
+  客户端连接就绪：可写时继续推送，可读时处理已到达的消息
+*/
+static void server_conn_event(struct reactor_handler *h, unsigned int events) {
+  struct server_conn *conn = container_of(h, struct server_conn, handler);
+  if ((events & REACTOR_WRITE) && conn_flush(conn) < 0) {
+    server_conn_close(conn);
+    return;
+  }
+  // 暂停读取或等待关闭的连接只关心挂断
+  if (conn->paused || conn->closing) {
+    if (events & REACTOR_ERROR)
+      server_conn_close(conn);
+    return;
+  }
+  // 客户端断开连接或分离则关闭 fd，PTY 和 shell 继续运行
+  if (events & (REACTOR_READ | REACTOR_ERROR)) {
+    if (server_receive(conn) < 0)
+      server_conn_close(conn);
+  } else if (server_drain(conn, 0) < 0) {
+    // 刚恢复读取，先处理缓冲区里剩下的消息
+    server_conn_close(conn);
+  }
+}
 
-    // 只有 select 成功时才处理 fd
-    if (select_ok) {
-      // 检查监听 fd是否可读，有新客户端连接
-      if (FD_ISSET(listen_fd, &read_fds)) {
-        int new_fd = accept(listen_fd, NULL, NULL);
-        if (new_fd >= 0) {
-          for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (client_fds[i] == -1) {
-              client_fds[i] = new_fd;
+/*
+  监听 fd 可读：接受新客户端连接
+*/
+static void server_listen_event(struct reactor_handler *h,
+                                unsigned int events) {
+  int new_fd = accept(h->fd, NULL, NULL);
+  if (new_fd < 0) {
+    if (errno != EINTR && errno != EAGAIN)
+      log_error("accept failed: %s", strerror(errno));
+    return;
+  }
+  struct server_conn *conn = calloc(1, sizeof(*conn));
+  if (!conn) {
+    log_error("malloc connection failed");
+    close(new_fd);
+    return;
+  }
+  // 请求先读进接收缓冲区，套接字不会阻塞主循环
+  int flags = fcntl(new_fd, F_GETFL);
+  if (flags != -1)
+    fcntl(new_fd, F_SETFL, flags | O_NONBLOCK);
+  if (msg_reader_init(&conn->in, MAX_MSG_PAYLOAD) < 0) {
+    close(new_fd);
+    free(conn);
+    return;
+  }
+  conn->events = REACTOR_READ;
+  if (reactor_add(server_reactor, &conn->handler, new_fd, conn->events,
+                  server_conn_event) < 0) {
+    msg_reader_free(&conn->in);
+    close(new_fd);
+    free(conn);
+  }
+}
+
+/*
+  回收退出的子进程，清理所有 pane 都已退出的 session
+*/
+static void server_reap_children(void) {
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    if (checkpoint_reap(pid, status, &session_list))
+      continue;
+    struct session *sess;
+    list_for_each_entry(sess, &session_list, link) {
+      // 检查是否是这个 session 的某个 pane
+      for (int i = 0; i < sess->pane_count; i++) {
+        if (sess->pane_pids[i] == pid) {
+          log_info("pane %d (pid %d) exited in session %d", i, pid,
+                   sess->id);
+          // 读完剩余输出并通知客户端，PTY 尚未 EOF 时在这里关闭
+          session_pane_exit(sess, i);
+          sess->pane_pids[i] = -1;
+
+          // 检查是否所有 pane 都退出了
+          int all_exited = 1;
+          for (int j = 0; j < sess->pane_count; j++) {
+            if (sess->pane_pids[j] > 0) {
+              all_exited = 0;
               break;
             }
           }
-        }
-      }
-
-      for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client_fds[i] >= 0 &&
-            FD_ISSET(client_fds[i],
-                     &read_fds)) { // 只处理内核提供的可读的 fd
-          // 客户端断开连接则关闭 fd
-          if (server_receive(client_fds[i]) < 0) {
-            close(client_fds[i]);
-            client_fds[i] = -1;
-          }
+          // 清理 session 时关闭所有连接，通知客户端退出
+          if (all_exited)
+            sess->child_exited = 1;
+          break;
         }
       }
     }
+  }
+  // 安全删除已退出的 session
+  struct session *sess, *tmp;
+  list_for_each_entry_safe(sess, tmp, &session_list, link) {
+    if (sess->child_exited) {
+      log_info("cleaning up session id=%d", sess->id);
+      session_free(sess);
+    }
+  }
+}
 
-    // 处理 detach 的 session
-    struct session *sess;
-    list_for_each_entry(sess, &session_list, link) {
-      if (sess->detached == 1) {
-        // 先从 client_fds 数组中移除(此时 sess->client_fd 还保存着旧值)
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-          if (client_fds[i] == sess->client_fd) {
-            client_fds[i] = -1; // 清空槽位,防止 fd 复用时冲突
-            break;
-          }
-        }
+/*
+  服务器主循环，监听客户端连接请求
+*/
+void server_loop(int listen_fd) {
+  log_info("server loop started, listening on fd %d", listen_fd);
 
-        // 关闭客户端连接(但保持 PTY 和 shell 继续运行)
-        close(sess->client_fd);
-        sess->client_fd = -1; // 标记 session 已没有客户端连接
+  // 在循环开始前设置信号处理器
+  struct sigaction sa;
+  sa.sa_handler = server_signal_handler;
+  sa.sa_flags = 0; // 不用 SA_RESTART，让 epoll_wait 被信号打断
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+  sigaction(SIGPIPE, &sa, NULL);
 
-        log_info("session %d detached, shell continues running", sess->id);
-      }
+  server_reactor = reactor_create();
+  if (!server_reactor) {
+    log_error("create reactor failed");
+    return;
+  }
+  struct reactor_handler listen_handler = {0};
+  if (reactor_add(server_reactor, &listen_handler, listen_fd, REACTOR_READ,
+                  server_listen_event) < 0) {
+    reactor_destroy(server_reactor);
+    return;
+  }
+
+  // 磁盘上还有未恢复的检查点时，新会话不占用它们的 ID
+  int ids[MUXKIT_CHECKPOINT_MAX];
+  int nids = checkpoint_list(ids, MUXKIT_CHECKPOINT_MAX);
+  if (nids > 0)
+    session_id_floor = ids[nids - 1] + 1;
+
+  while (1) {
+    // 阻塞到 fd 可读或检查点到期；被信号打断时返回 0，继续检查 sigchld_pending
+    if (reactor_wait(server_reactor, checkpoint_timeout()) < 0) {
+      log_error("reactor wait failed: %s", strerror(errno));
+      break;
     }
 
-    // 无论 select 是否成功，都检查 sigchld_pending
     if (sigchld_pending) {
       sigchld_pending = 0;
-      // 回收所有退出的子进程
-      int status;
-      pid_t pid;
-      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        struct session *sess;
-        list_for_each_entry(sess, &session_list, link) {
-          // 检查是否是这个 session 的某个 pane
-          for (int i = 0; i < sess->pane_count; i++) {
-            if (sess->pane_pids[i] == pid) {
-              log_info("pane %d (pid %d) exited in session %d", i, pid,
-                       sess->id);
-              // 关闭这个 pane 的 master_fd
-              if (sess->master_fds[i] >= 0) {
-                close(sess->master_fds[i]);
-                sess->master_fds[i] = -1;
-              }
-              sess->pane_pids[i] = -1;
-
-              // 检查是否所有 pane 都退出了
-              int all_exited = 1;
-              for (int j = 0; j < sess->pane_count; j++) {
-                if (sess->pane_pids[j] > 0) {
-                  all_exited = 0;
-                  break;
-                }
-              }
-              if (all_exited) {
-                sess->child_exited = 1;
-                // 关闭 client 连接，通知 client 退出
-                if (sess->client_fd >= 0) {
-                  // 同步清理 client_fds 数组
-                  for (int k = 0; k < MAX_CLIENTS; k++) {
-                    if (client_fds[k] == sess->client_fd) {
-                      client_fds[k] = -1;
-                      break;
-                    }
-                  }
-                  close(sess->client_fd);
-                  sess->client_fd = -1;
-                }
-              }
-              break;
-            }
-          }
-        }
-      }
-      // 安全删除已退出的 session
-      struct session *sess, *tmp;
-      list_for_each_entry_safe(sess, tmp, &session_list, link) {
-        if (sess->child_exited) {
-          log_info("cleaning up session id=%d", sess->id);
-          list_del(&sess->link);
-          free(sess);
-        }
-      }
+      server_reap_children();
     }
+    checkpoint_run(&session_list);
   }
+
+  reactor_del(server_reactor, &listen_handler);
+  reactor_destroy(server_reactor);
+  server_reactor = NULL;
 }
 
 /*
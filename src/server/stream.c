@@ -0,0 +1,115 @@
+/**
+ * stream.c - muxkit pane 输出流模块实现
+ *
+ * 缓冲区下标为绝对偏移 & (cap - 1)，记录可以跨越缓冲区末尾，
+ * 读写都拆成最多两段 memcpy。tail 总是落在记录边界上：
+ * 追加前按记录头逐条前移，直到新记录放得下。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "stream.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+int stream_init(struct stream *s, size_t cap) {
+  size_t n = 1;
+  while (n < cap)
+    n <<= 1;
+  s->buf = malloc(n);
+  if (!s->buf) {
+    log_error("malloc stream buffer failed");
+    return -1;
+  }
+  s->cap = n;
+  s->head = 0;
+  s->tail = 0;
+  return 0;
+}
+
+void stream_free(struct stream *s) {
+  free(s->buf);
+  s->buf = NULL;
+  s->cap = 0;
+  s->head = 0;
+  s->tail = 0;
+}
+
+/*
+  写入 n 字节到绝对偏移 pos，跨越末尾时分两段
+*/
+static void ring_put(struct stream *s, uint64_t pos, const void *src,
+                     size_t n) {
+  size_t off = pos & (s->cap - 1);
+  size_t first = s->cap - off < n ? s->cap - off : n;
+  memcpy(s->buf + off, src, first);
+  memcpy(s->buf, (const char *)src + first, n - first);
+}
+
+/*
+  从绝对偏移 pos 读取 n 字节
+*/
+static void ring_get(const struct stream *s, uint64_t pos, void *dst,
+                     size_t n) {
+  size_t off = pos & (s->cap - 1);
+  size_t first = s->cap - off < n ? s->cap - off : n;
+  memcpy(dst, s->buf + off, first);
+  memcpy((char *)dst + first, s->buf, n - first);
+}
+
+int stream_append(struct stream *s, uint16_t type, uint16_t cols,
+                  uint16_t rows, const void *data, uint32_t len) {
+  struct stream_record rec = {
+      .len = len, .type = type, .cols = cols, .rows = rows};
+  size_t total = sizeof(rec) + len;
+  if (!s->buf || total > s->cap / 2)
+    return -1;
+
+  // 丢弃最旧的记录，直到新记录放得下
+  while (s->head + total - s->tail > s->cap) {
+    struct stream_record old;
+    ring_get(s, s->tail, &old, sizeof(old));
+    s->tail += sizeof(old) + old.len;
+  }
+  ring_put(s, s->head, &rec, sizeof(rec));
+  if (len)
+    ring_put(s, s->head + sizeof(rec), data, len);
+  s->head += total;
+  return 0;
+}
+
+int stream_peek(const struct stream *s, uint64_t pos,
+                struct stream_record *rec) {
+  if (pos < s->tail)
+    return -1;
+  if (pos >= s->head)
+    return 0;
+  ring_get(s, pos, rec, sizeof(*rec));
+  return 1;
+}
+
+void stream_data(const struct stream *s, uint64_t pos,
+                 const struct stream_record *rec, void *out) {
+  if (rec->len)
+    ring_get(s, pos + sizeof(*rec), out, rec->len);
+}
@@ -0,0 +1,153 @@
+/**
+ * frame.c - muxkit 帧输出缓冲模块实现
+ *
+ * 本模块实现每帧输出缓冲：
+ * - 渲染函数追加 ANSI 序列和字符到内存缓冲区
+ * - 一帧结束时一次 write() 写出全部数据
+ * - 统计每帧字节数和系统调用次数，便于验证优化效果
+ *
+ * 缓冲区按需倍增扩容，frame_flush() 后长度清零但保留容量，
+ * 稳定运行后不再分配内存。
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "frame.h"
+#include "log.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct frame stdout_frame = {NULL, 0, 0, STDOUT_FILENO, {0}};
+static struct frame *cur_frame = &stdout_frame;
+
+void frame_init(struct frame *f, int fd) {
+  memset(f, 0, sizeof(*f));
+  f->fd = fd;
+}
+
+void frame_free(struct frame *f) {
+  free(f->buf);
+  f->buf = NULL;
+  f->len = 0;
+  f->cap = 0;
+}
+
+/*
+  确保缓冲区至少还有 need 字节空间
+*/
+static int frame_reserve(struct frame *f, size_t need) {
+  if (f->len + need <= f->cap)
+    return 0;
+  size_t cap = f->cap ? f->cap : FRAME_BUF_INIT;
+  while (cap < f->len + need)
+    cap *= 2;
+  char *nbuf = realloc(f->buf, cap);
+  if (!nbuf) {
+    log_error("frame realloc %zu failed", cap);
+    return -1;
+  }
+  f->buf = nbuf;
+  f->cap = cap;
+  return 0;
+}
+
+void frame_append(struct frame *f, const char *data, size_t len) {
+  if (len == 0 || frame_reserve(f, len) < 0)
+    return;
+  memcpy(f->buf + f->len, data, len);
+  f->len += len;
+}
+
+void frame_puts(struct frame *f, const char *s) {
+  frame_append(f, s, strlen(s));
+}
+
+void frame_printf(struct frame *f, const char *fmt, ...) {
+  va_list args;
+  // 先尝试直接格式化到剩余空间，绝大多数转义序列都很短
+  if (frame_reserve(f, 64) < 0)
+    return;
+  va_start(args, fmt);
+  int n = vsnprintf(f->buf + f->len, f->cap - f->len, fmt, args);
+  va_end(args);
+  if (n < 0)
+    return;
+  if ((size_t)n >= f->cap - f->len) {
+    if (frame_reserve(f, n + 1) < 0)
+      return;
+    va_start(args, fmt);
+    vsnprintf(f->buf + f->len, f->cap - f->len, fmt, args);
+    va_end(args);
+  }
+  f->len += n;
+}
+
+void frame_fill(struct frame *f, char c, size_t n) {
+  if (n == 0 || frame_reserve(f, n) < 0)
+    return;
+  memset(f->buf + f->len, c, n);
+  f->len += n;
+}
+
+int frame_flush(struct frame *f) {
+  if (f->len == 0)
+    return 0;
+
+  size_t sent = 0;
+  unsigned int calls = 0;
+  int ret = 0;
+  while (sent < f->len) {
+    ssize_t n = write(f->fd, f->buf + sent, f->len - sent);
+    calls++;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue; // 被信号打断，重试
+      log_error("frame write failed: %s", strerror(errno));
+      ret = -1;
+      break;
+    }
+    sent += n;
+  }
+
+  f->stats.bytes = sent;
+  f->stats.syscalls = calls;
+  f->stats.frames++;
+  f->stats.total_bytes += sent;
+  f->stats.total_syscalls += calls;
+  log_debug("frame %lu: %zu bytes, %u syscalls", f->stats.frames, sent,
+            calls);
+
+  f->len = 0;
+  return ret;
+}
+
+struct frame *frame_current(void) { return cur_frame; }
+
+struct frame *frame_set_current(struct frame *f) {
+  struct frame *old = cur_frame;
+  cur_frame = f ? f : &stdout_frame;
+  return old;
+}
@@ -0,0 +1,619 @@
+/**
+ * history.c - muxkit 历史行存储模块实现
+ *
+ * 写入：
+ * - 裁掉末尾空白单元格，按样式和单元格种类切分游程后编码
+ * - 按最坏情况预留空间，当前段放不下时开新段，记录不跨段
+ * - 超出行数上限时逐行淘汰，超出字节数上限时整段淘汰，
+ *   段内所有行都被淘汰后释放整段
+ *
+ * 读取：
+ * - 绝对行号 & (index_cap - 1) 直接得到记录位置
+ * - 解码到调用者提供的单元格缓冲区
+ *
+ * 落盘（可选，max_disk > 0 时启用）：
+ * - 常驻内存的段超过 max_bytes 时，最旧的内存段写入运行时目录下的
+ *   临时文件（创建后立即 unlink，进程退出自动回收），释放内存
+ * - 读取已落盘的段时按需 mmap，最多同时映射 HISTORY_MAP_MAX 段，
+ *   超出时按时钟顺序解除最早的映射
+ * - 落盘部分超过 max_disk 时丢弃最旧的段，并打洞归还磁盘空间；
+ *   文件系统不支持打洞时该历史停止落盘，已落盘的段丢完后截断文件
+ *
+ * MIT License
+ * Copyright (c) 2024 LatosProject
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include "history.h"
+#include "log.h"
+#include "render.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define RUN_TEXT 0 /* 宽度为 1 的单码点单元格，UTF-8 编码 */
+#define RUN_RAW 1  /* 原样保存 uint32 字符字 */
+
+#define VARINT_MAX 5 /* uint32 varint 最大字节数 */
+
+/* 单元格最坏情况编码长度：单独成游程（头 + 样式）+ 4 字节数据 */
+#define CELL_WORST (2 * VARINT_MAX + 4)
+/* 记录头最坏情况长度：记录长度 + 行标志 + 单元格数 + 行宽 */
+#define HEADER_WORST (3 * VARINT_MAX + 1)
+
+static size_t varint_put(char *p, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (char)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (char)v;
+  return n;
+}
+
+/*
+  读取 varint，越界或超长返回 0
+*/
+static size_t varint_get(const char *p, const char *end, uint32_t *v) {
+  uint32_t r = 0;
+  for (size_t n = 0; n < VARINT_MAX && p + n < end; n++) {
+    uint8_t b = (uint8_t)p[n];
+    r |= (uint32_t)(b & 0x7f) << (7 * n);
+    if (!(b & 0x80)) {
+      *v = r;
+      return n + 1;
+    }
+  }
+  return 0;
+}
+
+/*
+  解码一个 UTF-8 字符，失败返回 0
+*/
+static size_t utf8_get(const char *p, const char *end, uint32_t *cp) {
+  uint8_t b = (uint8_t)p[0];
+  size_t n;
+  uint32_t r;
+  if (b < 0x80) {
+    *cp = b;
+    return 1;
+  } else if ((b & 0xe0) == 0xc0) {
+    n = 2;
+    r = b & 0x1f;
+  } else if ((b & 0xf0) == 0xe0) {
+    n = 3;
+    r = b & 0x0f;
+  } else if ((b & 0xf8) == 0xf0) {
+    n = 4;
+    r = b & 0x07;
+  } else {
+    return 0;
+  }
+  if (p + n > end)
+    return 0;
+  for (size_t i = 1; i < n; i++)
+    r = (r << 6) | ((uint8_t)p[i] & 0x3f);
+  *cp = r;
+  return n;
+}
+
+static int cell_is_text(const struct cell *c) {
+  return !cell_is_cluster(c) && cell_width(c) == 1;
+}
+
+static int cell_is_trailing_blank(const struct cell *c) {
+  uint32_t cp = cell_codepoint(c);
+  return !cell_is_cluster(c) && (cp == 0 || cp == ' ') &&
+         c->style == GRID_STYLE_DEFAULT;
+}
+
+struct history *history_create(unsigned int max_lines, size_t max_bytes) {
+  struct history *h = calloc(1, sizeof(*h));
+  if (!h)
+    return NULL;
+  h->max_lines = max_lines;
+  h->max_bytes = max_bytes;
+  h->spill_fd = -1;
+  return h;
+}
+
+void history_set_spill(struct history *h, size_t max_disk) {
+  if (h)
+    h->max_disk = max_disk;
+}
+
+/*
+  释放段占用的内存或映射
+*/
+static void history_segment_release(struct history_segment *s) {
+  if (!s->cold)
+    free(s->data);
+  else if (s->data)
+    munmap(s->data, s->used);
+  s->data = NULL;
+}
+
+void history_clear(struct history *h) {
+  if (!h)
+    return;
+  for (unsigned int i = 0; i < h->nsegs; i++)
+    history_segment_release(&h->segs[i]);
+  h->seg_base += h->nsegs;
+  h->nsegs = 0;
+  h->ncold = 0;
+  h->bytes = 0;
+  h->disk_bytes = 0;
+  h->first = h->end;
+  if (h->spill_fd >= 0 && ftruncate(h->spill_fd, 0) == 0)
+    h->spill_end = 0;
+}
+
+void history_destroy(struct history *h) {
+  if (!h)
+    return;
+  history_clear(h);
+  if (h->spill_fd >= 0)
+    close(h->spill_fd);
+  free(h->segs);
+  free(h->index);
+  free(h);
+}
+
+unsigned int history_lines(const struct history *h) {
+  return h ? (unsigned int)(h->end - h->first) : 0;
+}
+
+/*
+  落盘文件中已丢弃的区域打洞归还磁盘空间，失败返回 -1
+*/
+static int history_punch(struct history *h, const struct history_segment *s) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+  return fallocate(h->spill_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                   s->file_off, s->used);
+#else
+  (void)h;
+  (void)s;
+  errno = EOPNOTSUPP;
+  return -1;
+#endif
+}
+
+/*
+  释放最旧的段
+*/
+static void history_drop_segment(struct history *h) {
+  struct history_segment *s = &h->segs[0];
+  int cold = s->cold;
+  if (h->first < s->end_line)
+    h->first = s->end_line;
+  if (cold) {
+    h->disk_bytes -= s->used;
+    h->ncold--;
+    // 文件只追加不回卷，打洞失败时磁盘占用会一直增长：
+    // 这个历史不再落盘，已落盘的段丢完后截断文件
+    if (history_punch(h, s) == -1 && !h->spill_error) {
+      log_warn("history spill hole punch failed, spilling disabled: %s",
+               strerror(errno));
+      h->spill_error = 1;
+    }
+  } else {
+    h->bytes -= s->cap;
+  }
+  history_segment_release(s);
+  memmove(&h->segs[0], &h->segs[1], (h->nsegs - 1) * sizeof(h->segs[0]));
+  h->nsegs--;
+  h->seg_base++;
+  if (cold && h->ncold == 0 && ftruncate(h->spill_fd, 0) == 0)
+    h->spill_end = 0;
+}
+
+/*
+  在运行时目录创建落盘文件，创建后立即 unlink
+*/
+static int history_spill_open(struct history *h) {
+  if (h->spill_fd >= 0)
+    return 0;
+  int fd = runtime_tmpfile("history");
+  if (fd == -1)
+    return -1;
+  h->spill_fd = fd;
+  h->spill_end = 0;
+  return 0;
+}
+
+/*
+  最旧的内存段写入落盘文件并释放内存
+*/
+static int history_spill(struct history *h) {
+  if (h->spill_error || history_spill_open(h) < 0) {
+    h->spill_error = 1;
+    return -1;
+  }
+  struct history_segment *s = &h->segs[h->ncold];
+  size_t done = 0;
+  while (done < s->used) {
+    ssize_t n = pwrite(h->spill_fd, s->data + done, s->used - done,
+                       h->spill_end + (off_t)done);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      log_warn("history spill write failed: %s", strerror(errno));
+      h->spill_error = 1;
+      return -1;
+    }
+    done += n;
+  }
+
+  free(s->data);
+  s->data = NULL;
+  s->cold = 1;
+  s->file_off = h->spill_end;
+  h->bytes -= s->cap;
+  h->disk_bytes += s->used;
+  h->ncold++;
+
+  // mmap 偏移必须按页对齐
+  long page = sysconf(_SC_PAGESIZE);
+  h->spill_end += (off_t)((s->used + page - 1) / page * page);
+  return 0;
+}
+
+/*
+  按行数和字节数上限淘汰旧行
+*/
+static void history_trim(struct history *h) {
+  if (h->end - h->first > h->max_lines)
+    h->first = h->end - h->max_lines;
+  // 整段都已淘汰的旧段直接释放，最新的段保留继续写入
+  while (h->nsegs > 1 && h->segs[0].end_line <= h->first)
+    history_drop_segment(h);
+  // 内存超限：能落盘就落盘，否则丢弃最旧的段
+  while (h->ncold + 1 < h->nsegs && h->bytes > h->max_bytes) {
+    if (h->max_disk == 0 || history_spill(h) < 0)
+      history_drop_segment(h);
+  }
+  while (h->ncold > 0 && h->disk_bytes > h->max_disk)
+    history_drop_segment(h);
+}
+
+/*
+  获取段数据，已落盘的段按需映射
+*/
+static const char *history_segment_data(struct history *h,
+                                        struct history_segment *s) {
+  if (s->data)
+    return s->data;
+
+  // 映射槽已满，解除时钟指针处的映射
+  uint32_t victim = h->mapped[h->map_clock];
+  if (h->map_used[h->map_clock] && victim - h->seg_base < h->nsegs) {
+    struct history_segment *vs = &h->segs[victim - h->seg_base];
+    if (vs->cold && vs->data) {
+      munmap(vs->data, vs->used);
+      vs->data = NULL;
+    }
+  }
+
+  void *p = mmap(NULL, s->used, PROT_READ, MAP_SHARED, h->spill_fd,
+                 s->file_off);
+  if (p == MAP_FAILED) {
+    log_warn("history mmap failed: %s", strerror(errno));
+    return NULL;
+  }
+  s->data = p;
+  h->mapped[h->map_clock] = (uint32_t)(s - h->segs) + h->seg_base;
+  h->map_used[h->map_clock] = 1;
+  h->map_clock = (h->map_clock + 1) % HISTORY_MAP_MAX;
+  return s->data;
+}
+
+/*
+  确保索引能容纳 lines 行
+*/
+static int history_reserve_index(struct history *h, uint64_t lines) {
+  if (lines <= h->index_cap)
+    return 0;
+  unsigned int cap = h->index_cap ? h->index_cap : 1024;
+  while (cap < lines)
+    cap *= 2;
+  struct history_ref *index = malloc(cap * sizeof(*index));
+  if (!index)
+    return -1;
+  for (uint64_t l = h->first; l < h->end; l++)
+    index[l & (cap - 1)] = h->index[l & (h->index_cap - 1)];
+  free(h->index);
+  h->index = index;
+  h->index_cap = cap;
+  return 0;
+}
+
+/*
+  在最新的段中预留 need 字节，放不下时开新段
+*/
+static char *history_reserve(struct history *h, size_t need) {
+  if (h->nsegs > 0) {
+    struct history_segment *s = &h->segs[h->nsegs - 1];
+    if (s->cap - s->used >= need)
+      return s->data + s->used;
+  }
+  if (h->nsegs == h->segs_cap) {
+    unsigned int cap = h->segs_cap ? h->segs_cap * 2 : 16;
+    struct history_segment *segs = realloc(h->segs, cap * sizeof(*segs));
+    if (!segs)
+      return NULL;
+    h->segs = segs;
+    h->segs_cap = cap;
+  }
+  size_t cap = need > HISTORY_SEGMENT_SIZE ? need : HISTORY_SEGMENT_SIZE;
+  char *data = malloc(cap);
+  if (!data) {
+    log_error("history segment malloc %zu failed", cap);
+    return NULL;
+  }
+  struct history_segment *s = &h->segs[h->nsegs++];
+  s->data = data;
+  s->used = 0;
+  s->cap = cap;
+  s->end_line = h->end;
+  s->cold = 0;
+  s->file_off = 0;
+  h->bytes += cap;
+  return data;
+}
+
+/*
+  记录已写入最新的段，更新索引并淘汰旧行
+*/
+static void history_commit(struct history *h, size_t len) {
+  struct history_segment *s = &h->segs[h->nsegs - 1];
+  struct history_ref *ref = &h->index[h->end & (h->index_cap - 1)];
+  ref->seg = h->seg_base + h->nsegs - 1;
+  ref->off = (uint32_t)s->used;
+  s->used += len;
+  s->end_line = ++h->end;
+  history_trim(h);
+}
+
+/*
+  编码单元格到 body，返回长度
+*/
+static size_t history_encode(char *body, const struct cell *cells,
+                             unsigned int n, unsigned int width,
+                             uint8_t flags) {
+  char *p = body;
+  *p++ = (char)flags;
+  p += varint_put(p, n);
+  p += varint_put(p, width);
+  for (unsigned int i = 0; i < n;) {
+    int kind = cell_is_text(&cells[i]) ? RUN_TEXT : RUN_RAW;
+    uint32_t style = cells[i].style;
+    unsigned int j = i + 1;
+    while (j < n && cells[j].style == style &&
+           (cell_is_text(&cells[j]) ? RUN_TEXT : RUN_RAW) == kind)
+      j++;
+    p += varint_put(p, (uint32_t)(j - i) << 1 | (uint32_t)kind);
+    p += varint_put(p, style);
+    for (; i < j; i++) {
+      if (kind == RUN_TEXT) {
+        p += unicode_to_utf8(cell_codepoint(&cells[i]), p);
+      } else {
+        memcpy(p, &cells[i].ch, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+      }
+    }
+  }
+  return p - body;
+}
+
+size_t history_record_bound(unsigned int n) {
+  return HEADER_WORST + (size_t)n * CELL_WORST;
+}
+
+size_t history_record_encode(void *out, const struct cell *cells,
+                             unsigned int n, uint8_t flags) {
+  char *rec = out;
+  unsigned int width = n;
+  while (n > 0 && cell_is_trailing_blank(&cells[n - 1]))
+    n--;
+
+  // 先把正文编码到长度字段之后，再按实际长度前移
+  char *body = rec + VARINT_MAX;
+  size_t body_len = history_encode(body, cells, n, width, flags);
+  size_t hdr = varint_put(rec, (uint32_t)body_len);
+  if (hdr < VARINT_MAX)
+    memmove(rec + hdr, body, body_len);
+  return hdr + body_len;
+}
+
+int history_push(struct history *h, const struct cell *cells, unsigned int n,
+                 uint8_t flags) {
+  if (!h || h->max_lines == 0)
+    return 0;
+  if (history_reserve_index(h, h->end - h->first + 1) < 0)
+    return -1;
+
+  // 按未裁剪的宽度预留，实际长度只会更短
+  char *rec = history_reserve(h, history_record_bound(n));
+  if (!rec)
+    return -1;
+  history_commit(h, history_record_encode(rec, cells, n, flags));
+  return 0;
+}
+
+/*
+  获取记录正文位置
+*/
+static const char *history_locate(struct history *h, unsigned int idx,
+                                  const char **end) {
+  if (idx >= h->end - h->first)
+    return NULL;
+  const struct history_ref *ref =
+      &h->index[(h->first + idx) & (h->index_cap - 1)];
+  struct history_segment *s = &h->segs[ref->seg - h->seg_base];
+  const char *data = history_segment_data(h, s);
+  if (!data)
+    return NULL;
+  const char *p = data + ref->off;
+  const char *seg_end = data + s->used;
+  uint32_t len;
+  size_t n = varint_get(p, seg_end, &len);
+  if (n == 0 || len > (size_t)(seg_end - p - n))
+    return NULL;
+  *end = p + n + len;
+  return p + n;
+}
+
+/*
+  解析记录头，p 指向记录正文，返回单元格数并把 p 移到第一个游程
+*/
+static int history_header(const char **p, const char *end,
+                          unsigned int *width, uint8_t *flags) {
+  if (*p >= end)
+    return -1;
+  if (flags)
+    *flags = (uint8_t)**p;
+  (*p)++;
+  uint32_t ncells, w;
+  size_t n = varint_get(*p, end, &ncells);
+  if (n == 0)
+    return -1;
+  *p += n;
+  if ((n = varint_get(*p, end, &w)) == 0)
+    return -1;
+  *p += n;
+  if (width)
+    *width = w;
+  return (int)ncells;
+}
+
+int history_info(struct history *h, unsigned int idx, unsigned int *width,
+                 uint8_t *flags) {
+  const char *end;
+  const char *p = h ? history_locate(h, idx, &end) : NULL;
+  if (!p)
+    return -1;
+  return history_header(&p, end, width, flags);
+}
+
+/*
+  解码记录正文到 out（width 个单元格），返回保存的单元格数
+*/
+static int history_decode(const char *p, const char *end, struct cell *out,
+                          unsigned int width, uint8_t *flags) {
+  int ret = history_header(&p, end, NULL, flags);
+  if (ret < 0)
+    return -1;
+  uint32_t ncells = (uint32_t)ret;
+  size_t n;
+  if (!out)
+    return (int)ncells;
+
+  memset(out, 0, width * sizeof(*out));
+  unsigned int x = 0;
+  while (x < ncells && p < end) {
+    uint32_t head, style;
+    if ((n = varint_get(p, end, &head)) == 0)
+      break;
+    p += n;
+    if ((n = varint_get(p, end, &style)) == 0)
+      break;
+    p += n;
+    for (uint32_t i = 0; i < (head >> 1) && p < end; i++, x++) {
+      // 宽度之外的部分不需要解码
+      if (x >= width)
+        return (int)ncells;
+      uint32_t ch;
+      if ((head & 1) == RUN_TEXT) {
+        uint32_t cp;
+        if ((n = utf8_get(p, end, &cp)) == 0)
+          return (int)ncells;
+        p += n;
+        ch = cp | 1u << CELL_WIDTH_SHIFT;
+      } else {
+        if (end - p < (long)sizeof(ch))
+          return (int)ncells;
+        memcpy(&ch, p, sizeof(ch));
+        p += sizeof(ch);
+      }
+      out[x].ch = ch;
+      out[x].style = style;
+    }
+  }
+  return (int)ncells;
+}
+
+int history_get(struct history *h, unsigned int idx, struct cell *out,
+                unsigned int width, uint8_t *flags) {
+  const char *end;
+  const char *p = h ? history_locate(h, idx, &end) : NULL;
+  if (!p)
+    return -1;
+  return history_decode(p, end, out, width, flags);
+}
+
+long history_record_decode(const void *rec, size_t len, struct cell *out,
+                           unsigned int width, uint8_t *flags) {
+  const char *p = rec;
+  uint32_t body_len;
+  size_t n = varint_get(p, p + len, &body_len);
+  if (n == 0 || body_len > len - n || body_len == 0)
+    return -1;
+  if (history_decode(p + n, p + n + body_len, out, width, flags) < 0)
+    return -1;
+  return (long)(n + body_len);
+}
+
+const void *history_record(struct history *h, unsigned int idx,
+                           size_t *len) {
+  const char *end;
+  if (!h || !history_locate(h, idx, &end))
+    return NULL;
+  const struct history_ref *ref =
+      &h->index[(h->first + idx) & (h->index_cap - 1)];
+  // history_locate 已确保段数据可用
+  const char *rec = h->segs[ref->seg - h->seg_base].data + ref->off;
+  *len = end - rec;
+  return rec;
+}
+
+long history_push_record(struct history *h, const void *rec, size_t len) {
+  const char *p = rec;
+  uint32_t body_len;
+  size_t n = varint_get(p, p + len, &body_len);
+  if (n == 0 || body_len > len - n || body_len == 0)
+    return -1;
+  size_t total = n + body_len;
+  if (!h || h->max_lines == 0)
+    return (long)total;
+
+  if (history_reserve_index(h, h->end - h->first + 1) < 0)
+    return -1;
+  char *dst = history_reserve(h, total);
+  if (!dst)
+    return -1;
+  memcpy(dst, p, total);
+  history_commit(h, total);
+  return (long)total;
+}
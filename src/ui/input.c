@@ -8,7 +8,11 @@
  * - Unicode codepoint 到 UTF-8 编码转换
  *
  * 数据流：
- *   PTY 输出 -> pane_input() -> libvterm -> sync_grid_from_vterm() -> grid
+ *   PTY 输出 -> pane_input() -> libvterm -> damage/moverect 回调 -> grid
+ *
+ * grid 只在 libvterm 报告损坏的区域重新读取单元格 (sync_grid_rect)，
+ * 滚动通过 moverect 回调在 grid 上直接 memmove (grid_move_rect)。
+ * sync_grid_from_vterm() 保留为整屏同步。
  *
  * 会话恢复流程：
  *   grid (反序列化) -> sync_vterm_from_grid() -> libvterm
@@ -54,7 +58,7 @@ void sync_vterm_from_grid(struct window_pane *p) {
   // 清屏并重置状态
   vterm_input_write(p->vt, "\033[H\033[2J\033[0m", 11);
 
-  uint8_t last_fg = 0, last_bg = 0, last_attr = 0, last_flags = 0x03;
+  uint32_t last_style = GRID_STYLE_DEFAULT;
 
   for (unsigned int y = 0; y < g->height; y++) {
     len = snprintf(seq, sizeof(seq), "\033[%u;1H", y + 1);
@@ -63,35 +67,18 @@ void sync_vterm_from_grid(struct window_pane *p) {
     for (unsigned int x = 0; x < g->width;) {
       struct cell *c = &g->cells[y * g->width + x];
 
-      // 只在属性变化时更新
-      if (c->attr != last_attr || c->fg != last_fg || c->bg != last_bg ||
-          c->flags != last_flags) {
-        vterm_input_write(p->vt, "\033[0m", 4);
-        if (c->attr & 0x01)
-          vterm_input_write(p->vt, "\033[1m", 4);
-        if (c->attr & 0x02)
-          vterm_input_write(p->vt, "\033[4m", 4);
-        if (c->attr & 0x04)
-          vterm_input_write(p->vt, "\033[3m", 4);
-        if (c->attr & 0x08)
-          vterm_input_write(p->vt, "\033[7m", 4);
-        if (!(c->flags & 0x01)) {
-          len = snprintf(seq, sizeof(seq), "\033[38;5;%um", c->fg);
-          vterm_input_write(p->vt, seq, len);
-        }
-        if (!(c->flags & 0x02)) {
-          len = snprintf(seq, sizeof(seq), "\033[48;5;%um", c->bg);
-          vterm_input_write(p->vt, seq, len);
-        }
-        last_attr = c->attr;
-        last_fg = c->fg;
-        last_bg = c->bg;
-        last_flags = c->flags;
+      // 只在样式变化时更新，直接使用预编码的 SGR
+      if (c->style != last_style) {
+        const struct grid_style *st = grid_style_get(g, c->style);
+        vterm_input_write(p->vt, st->sgr, st->sgr_len);
+        last_style = c->style;
       }
 
-      if (c->ch[0]) {
-        vterm_input_write(p->vt, c->ch, strlen(c->ch));
-        x += (c->width > 0) ? c->width : 1;
+      char buf[CELL_UTF8_MAX];
+      size_t n = grid_cell_utf8(g, c, buf);
+      if (n > 0) {
+        vterm_input_write(p->vt, buf, n);
+        x += (cell_width(c) > 0) ? cell_width(c) : 1;
       } else {
         vterm_input_write(p->vt, " ", 1);
         x++;
@@ -102,69 +89,54 @@ void sync_vterm_from_grid(struct window_pane *p) {
   // 恢复保存的光标位置
   len = snprintf(seq, sizeof(seq), "\033[%u;%uH", p->cy + 1, p->cx + 1);
   vterm_input_write(p->vt, seq, len);
+  vterm_screen_flush_damage(p->vts);
 }
 
-// 从 libvterm 同步屏幕内容到 grid
-void sync_grid_from_vterm(struct window_pane *p) {
-  if (!p->vts || !p->grid)
-    return;
-
-  for (unsigned int y = 0; y < p->sy; y++) {
-    for (unsigned int x = 0; x < p->sx; x++) {
-      // 终端解析完成的数据
-      VTermPos pos = {.row = y, .col = x};
-      VTermScreenCell cell;
-      memset(&cell, 0, sizeof(cell));
-      vterm_screen_get_cell(p->vts, pos, &cell);
-
-      // grid 中的单元格
-      struct cell *c = &p->grid->cells[y * p->grid->width + x];
-      memset(c, 0, sizeof(*c));
-
-      if (cell.chars[0]) {
-        unicode_to_utf8(cell.chars[0], c->ch);
-      } else {
-        c->ch[0] = 0;
-      }
-      c->width = cell.width; // 始终从 libvterm 获取宽度
-
-      // 提取颜色
-      c->flags = 0;
-      if (VTERM_COLOR_IS_DEFAULT_FG(&cell.fg)) {
-        c->flags |= 0x01; // 使用默认前景色
-      } else if (VTERM_COLOR_IS_INDEXED(&cell.fg)) {
-        c->fg = cell.fg.indexed.idx;
-      } else if (VTERM_COLOR_IS_RGB(&cell.fg)) {
-        // RGB 转 216 色立方体 + 灰度
-        uint8_t r = cell.fg.rgb.red, g = cell.fg.rgb.green,
-                b = cell.fg.rgb.blue;
-        c->fg = 16 + (r / 51) * 36 + (g / 51) * 6 + (b / 51);
-      }
-
-      if (VTERM_COLOR_IS_DEFAULT_BG(&cell.bg)) {
-        c->flags |= 0x02; // 使用默认背景色
-      } else if (VTERM_COLOR_IS_INDEXED(&cell.bg)) {
-        c->bg = cell.bg.indexed.idx;
-      } else if (VTERM_COLOR_IS_RGB(&cell.bg)) {
-        uint8_t r = cell.bg.rgb.red, g = cell.bg.rgb.green,
-                b = cell.bg.rgb.blue;
-        c->bg = 16 + (r / 51) * 36 + (g / 51) * 6 + (b / 51);
-      }
+/*
+  libvterm 颜色转 256 色索引，RGB 映射到 216 色立方体
+*/
+static uint8_t color_to_index(const VTermColor *col) {
+  if (VTERM_COLOR_IS_INDEXED(col))
+    return col->indexed.idx;
+  if (VTERM_COLOR_IS_RGB(col))
+    return 16 + (col->rgb.red / 51) * 36 + (col->rgb.green / 51) * 6 +
+           (col->rgb.blue / 51);
+  return 0;
+}
 
-      // 提取属性
-      c->attr = 0;
-      if (cell.attrs.bold)
-        c->attr |= 0x01;
-      if (cell.attrs.underline)
-        c->attr |= 0x02;
-      if (cell.attrs.italic)
-        c->attr |= 0x04;
-      if (cell.attrs.reverse)
-        c->attr |= 0x08;
-    }
-  }
+// libvterm 单元格转换为 grid 单元格
+void cell_from_vterm(struct grid *g, struct cell *c,
+                     const VTermScreenCell *cell) {
+  // 宽字符右半部分的 chars[0] 为 0xFFFFFFFF，按空单元格保存
+  grid_cell_set_chars(g, c, cell->chars, cell->width); // 始终从 libvterm 获取宽度
+
+  // 提取颜色
+  uint8_t flags = 0, fg = 0, bg = 0;
+  if (VTERM_COLOR_IS_DEFAULT_FG(&cell->fg))
+    flags |= 0x01; // 使用默认前景色
+  else
+    fg = color_to_index(&cell->fg);
+  if (VTERM_COLOR_IS_DEFAULT_BG(&cell->bg))
+    flags |= 0x02; // 使用默认背景色
+  else
+    bg = color_to_index(&cell->bg);
+
+  // 提取属性
+  uint8_t attr = 0;
+  if (cell->attrs.bold)
+    attr |= 0x01;
+  if (cell->attrs.underline)
+    attr |= 0x02;
+  if (cell->attrs.italic)
+    attr |= 0x04;
+  if (cell->attrs.reverse)
+    attr |= 0x08;
+
+  c->style = grid_style_intern(g, style_pen_pack(fg, bg, attr, flags));
+}
 
-  // 同步光标位置
+// 同步光标位置和行标志
+static void sync_cursor_from_vterm(struct window_pane *p) {
   VTermPos cursor;
   VTermState *state = vterm_obtain_state(p->vt); // state 状态机跟踪光标位置
   vterm_state_get_cursorpos(state, &cursor);     // 查询光标
@@ -180,6 +152,47 @@ void sync_grid_from_vterm(struct window_pane *p) {
   }
 }
 
+// 从 libvterm 同步矩形区域到 grid
+void sync_grid_rect(struct window_pane *p, VTermRect rect) {
+  if (!p->vts || !p->grid)
+    return;
+  struct grid *g = p->grid;
+
+  unsigned int end_row = rect.end_row < 0 ? 0 : (unsigned int)rect.end_row;
+  unsigned int end_col = rect.end_col < 0 ? 0 : (unsigned int)rect.end_col;
+  if (end_row > g->height)
+    end_row = g->height;
+  if (end_col > g->width)
+    end_col = g->width;
+
+  // 宽字符的宽度由右侧单元格决定，向左多读一格，
+  // 避免覆盖宽字符后半部分时左侧单元格宽度过期
+  int start_col = rect.start_col > 0 ? rect.start_col - 1 : 0;
+
+  for (int y = rect.start_row < 0 ? 0 : rect.start_row; y < (int)end_row;
+       y++) {
+    struct cell *line = &g->cells[y * g->width];
+    for (int x = start_col; x < (int)end_col; x++) {
+      // 终端解析完成的数据
+      VTermPos pos = {.row = y, .col = x};
+      VTermScreenCell cell;
+      vterm_screen_get_cell(p->vts, pos, &cell);
+      cell_from_vterm(g, &line[x], &cell);
+    }
+  }
+}
+
+// 从 libvterm 同步屏幕内容到 grid
+void sync_grid_from_vterm(struct window_pane *p) {
+  if (!p->vts || !p->grid)
+    return;
+
+  VTermRect all = {
+      .start_row = 0, .end_row = p->sy, .start_col = 0, .end_col = p->sx};
+  sync_grid_rect(p, all);
+  sync_cursor_from_vterm(p);
+}
+
 /*
   网格输入到 vterm
 */
@@ -188,5 +201,8 @@ void pane_input(struct window_pane *p, const char *data, size_t len) {
     return;
 
   vterm_input_write(p->vt, data, len);
-  sync_grid_from_vterm(p);
+  // 合并的滚动和损坏区域在此统一回调：
+  // moverect 在 grid 上 memmove，damage 只重新读取损坏的单元格
+  vterm_screen_flush_damage(p->vts);
+  sync_cursor_from_vterm(p);
 }
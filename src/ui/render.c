@@ -14,10 +14,17 @@
  * 3. 定位光标到正确位置
  * 4. 显示光标
  *
+ * 所有输出先追加到当前帧缓冲区 (frame_current)，
+ * 由事件循环在帧结束时 frame_flush() 一次写出。
+ *
+ * 增量渲染：
+ * - libvterm damage 回调通过 grid_mark_dirty 记录脏行
+ * - render_pane_damage 只输出脏行，render_pane 整体重绘
+ *
  * 历史滚动：
- * - 使用环形缓冲区保存历史行
- * - scroll_offset 控制当前视图偏移
- * - grid_get_display_line 返回正确的显示行
+ * - 历史按写入时的宽度保存，改变宽度时不重排
+ * - scroll_offset/scroll_pos 以逻辑行为锚点记录视图顶部
+ * - 滚动和 grid_get_display_line 只对经过的逻辑行按当前宽度折行
  *
  * MIT License
  * Copyright (c) 2024 LatosProject
@@ -43,114 +50,599 @@
 
 #include "render.h"
 #include "client.h"
+#include "codec.h"
+#include "frame.h"
 #include "i18n.h"
 #include "list.h"
+#include "log.h"
 #include "main.h"
+#include "util.h"
 #include "version.h"
 #include "window.h"
+#include <errno.h>
 #include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #define CURSOR_HIDE "\033[?25l"
 #define CURSOR_SHOW "\033[?25h"
 /*
   历史初始化
  */
-void grid_init_history(struct grid *g, unsigned int max_lines) {
-  g->history_cells = calloc(max_lines * g->width, sizeof(struct cell));
-  g->history_line_flags = calloc(max_lines, sizeof(uint8_t));
-  g->history_size = max_lines;
+void grid_init_history(struct grid *g, unsigned int max_lines,
+                       size_t max_bytes, size_t max_disk) {
+  history_destroy(g->history);
+  g->history = history_create(max_lines, max_bytes);
+  history_set_spill(g->history, max_disk);
   g->scroll_offset = 0;
-  g->history_count = 0;
+  g->scroll_pos = 0;
+  g->reflow.y = UINT_MAX;
+  g->reflow.line_back = UINT_MAX;
+}
+
+/*
+  默认历史上限，环境变量优先
+*/
+void grid_history_limits(unsigned int *max_lines, size_t *max_bytes,
+                         size_t *max_disk) {
+  const char *env;
+  *max_lines = MUXKIT_HISTORY_LINES;
+  *max_bytes = MUXKIT_HISTORY_BYTES;
+  *max_disk = MUXKIT_HISTORY_DISK_BYTES;
+  if ((env = getenv("MUXKIT_HISTORY_LINES")) && strtol(env, NULL, 10) >= 0)
+    *max_lines = (unsigned int)strtol(env, NULL, 10);
+  if ((env = getenv("MUXKIT_HISTORY_BYTES")) && strtoll(env, NULL, 10) > 0)
+    *max_bytes = (size_t)strtoll(env, NULL, 10);
+  if ((env = getenv("MUXKIT_HISTORY_DISK_BYTES")) && strtoll(env, NULL, 10) >= 0)
+    *max_disk = (size_t)strtoll(env, NULL, 10);
+}
+
+/*
+  解码首行距历史末尾 back 行的逻辑行（拼接后续的自动换行行）
+  除最后一行外，被裁掉的末尾空白按写入时的行宽补回，保证换行处的空格不丢失
+*/
+static int reflow_load(struct grid *g, unsigned int back) {
+  struct grid_reflow *r = &g->reflow;
+  if (r->line && r->line_back == back && r->line_end == g->history->end)
+    return 0;
+  r->line_back = UINT_MAX;
+
+  unsigned int lines = history_lines(g->history);
+  unsigned int idx = lines - back;
+  uint8_t flags;
+  r->len = 0;
+  r->nrec = 0;
+  for (int last = 0; !last; idx++) {
+    unsigned int width;
+    int n = history_info(g->history, idx, &width, NULL);
+    if (n < 0)
+      return -1;
+    last = idx + 1 >= lines ||
+           history_info(g->history, idx + 1, NULL, &flags) < 0 ||
+           !(flags & HISTORY_LINE_WRAPPED);
+    size_t row_len = (!last && width > (unsigned int)n) ? width : (size_t)n;
+    if (r->len + row_len > r->cap) {
+      size_t cap = r->cap ? r->cap : 256;
+      while (cap < r->len + row_len)
+        cap *= 2;
+      struct cell *line = realloc(r->line, cap * sizeof(*line));
+      if (!line)
+        return -1;
+      r->line = line;
+      r->cap = cap;
+    }
+    history_get(g->history, idx, &r->line[r->len], row_len, NULL);
+    r->len += row_len;
+    r->nrec++;
+  }
+  r->line_back = back;
+  r->line_end = g->history->end;
+  return 0;
+}
+
+/*
+  从 pos 开始按 width 折出一行，返回下一行的起始单元格
+  宽字符跨越行尾时整体移到下一行
+*/
+static unsigned int reflow_break(const struct grid_reflow *r, unsigned int pos,
+                                 unsigned int width) {
+  if (r->len - pos <= width)
+    return r->len;
+  unsigned int end = pos + width;
+  if (width > 1 && cell_width(&r->line[end - 1]) == 2)
+    end--;
+  return end;
+}
+
+/*
+  前一个逻辑行的首行距历史末尾的行数，没有更早的行返回 0
+*/
+static unsigned int reflow_prev(struct grid *g, unsigned int back) {
+  unsigned int lines = history_lines(g->history);
+  unsigned int idx = lines - back;
+  uint8_t flags;
+  if (idx == 0)
+    return 0;
+  idx--;
+  while (idx > 0 && history_info(g->history, idx, NULL, &flags) >= 0 &&
+         (flags & HISTORY_LINE_WRAPPED))
+    idx--;
+  return lines - idx;
 }
 
 /*
   历史向下滚动
 */
 void grid_scroll_down(struct grid *g, unsigned int lines) {
-  if (lines > g->scroll_offset)
-    g->scroll_offset = 0;
-  else
-    g->scroll_offset -= lines;
+  unsigned int back = g->scroll_offset;
+  unsigned int pos = g->scroll_pos;
+  if (back > history_lines(g->history)) {
+    back = history_lines(g->history);
+    pos = 0;
+  }
+  for (; lines > 0 && back > 0; lines--) {
+    if (reflow_load(g, back) < 0) {
+      back = 0;
+      break;
+    }
+    unsigned int next = reflow_break(&g->reflow, pos, g->width);
+    if (next < g->reflow.len) {
+      pos = next;
+    } else {
+      // 越过逻辑行末尾，进入下一个逻辑行（或回到屏幕）
+      back -= g->reflow.nrec;
+      pos = 0;
+    }
+  }
+  g->scroll_offset = back;
+  g->scroll_pos = back ? pos : 0;
+  g->reflow.y = UINT_MAX;
 }
 
 /*
   历史向上滚动
 */
 void grid_scroll_up(struct grid *g, unsigned int lines) {
-  // 可滚动的最大行数是 min(history_count, history_size)
-  unsigned int max_scroll =
-      (g->history_count < g->history_size) ? g->history_count : g->history_size;
-  if (g->scroll_offset + lines > max_scroll)
-    g->scroll_offset = max_scroll;
-  else
-    g->scroll_offset += lines;
+  unsigned int back = g->scroll_offset;
+  unsigned int pos = back ? g->scroll_pos : 0;
+  if (back > history_lines(g->history)) {
+    back = history_lines(g->history);
+    pos = 0;
+  }
+  while (lines > 0) {
+    if (pos == 0) {
+      // 移到前一个逻辑行的最后一个折行
+      unsigned int prev = reflow_prev(g, back);
+      if (prev == 0 || reflow_load(g, prev) < 0)
+        break;
+      back = prev;
+      unsigned int next;
+      while ((next = reflow_break(&g->reflow, pos, g->width)) <
+             g->reflow.len)
+        pos = next;
+      lines--;
+      continue;
+    }
+    // 逻辑行内向上：从行首折行，数出 pos 之前的折行起点
+    if (reflow_load(g, back) < 0)
+      break;
+    unsigned int count = 0;
+    for (unsigned int p = 0; p < pos; p = reflow_break(&g->reflow, p, g->width))
+      count++;
+    unsigned int target = count > lines ? count - lines : 0;
+    lines -= count - target;
+    pos = 0;
+    for (unsigned int i = 0; i < target; i++)
+      pos = reflow_break(&g->reflow, pos, g->width);
+  }
+  g->scroll_offset = back;
+  g->scroll_pos = pos;
+  g->reflow.y = UINT_MAX;
 }
 
 /*
   销毁历史
 */
 void grid_free_history(struct grid *g) {
-  if (g->history_cells) {
-    free(g->history_cells);
-    g->history_cells = NULL;
-  }
-  if (g->history_line_flags) {
-    free(g->history_line_flags);
-    g->history_line_flags = NULL;
-  }
-  g->history_count = 0;
+  history_destroy(g->history);
+  g->history = NULL;
+  free(g->scratch);
+  g->scratch = NULL;
+  g->scratch_width = 0;
+  free(g->reflow.line);
+  memset(&g->reflow, 0, sizeof(g->reflow));
+  g->reflow.y = UINT_MAX;
   g->scroll_offset = 0;
+  g->scroll_pos = 0;
 }
 
 /*
   将网格制定行添入历史
 */
 void grid_push_line_to_history(struct grid *g, unsigned int line) {
-  if (!g->history_cells || g->history_size == 0)
+  uint8_t flags = (g->line_flags && (g->line_flags[line] & 0x01))
+                      ? HISTORY_LINE_WRAPPED
+                      : 0;
+  history_push(g->history, &g->cells[line * g->width], g->width, flags);
+}
+
+/*
+  折行游标下移一个显示行
+*/
+static void reflow_advance(struct grid *g) {
+  struct grid_reflow *r = &g->reflow;
+  if (r->back == 0) {
+    r->pos++;
     return;
-  // 计算历史中的目标位置（环形缓冲区）
-  unsigned int dst_line = g->history_count % g->history_size;
-  // 复制该行到历史
-  memcpy(&g->history_cells[dst_line * g->width], &g->cells[line * g->width],
-         g->width * sizeof(struct cell));
-  g->history_count++; // 始终递增，用于环形缓冲区索引
+  }
+  if (reflow_load(g, r->back) < 0) {
+    // 解码失败，之后的行按超出范围处理
+    r->back = 0;
+    r->pos = g->height;
+    return;
+  }
+  unsigned int next = reflow_break(r, r->pos, r->width);
+  if (next < r->len) {
+    r->pos = next;
+  } else {
+    r->back -= r->nrec;
+    r->pos = 0;
+  }
 }
 
 /*
-  获取网格制定行
+  获取网格制定行，历史行折行后写入 g->scratch，下次调用前有效
 */
 struct cell *grid_get_display_line(struct grid *g, unsigned int y) {
   if (g->scroll_offset == 0) { // 未滚动
     return &g->cells[y * g->width];
   }
-  if (!g->history_count || g->history_size == 0)
-    return NULL;
 
-  // 可用的历史行数
-  unsigned int available =
-      (g->history_count < g->history_size) ? g->history_count : g->history_size;
+  // 游标失效（视图、宽度或历史变化）或回退时从视图顶部重新开始
+  struct grid_reflow *r = &g->reflow;
+  if (r->y == UINT_MAX || y < r->y || r->width != g->width ||
+      r->end != g->history->end) {
+    unsigned int lines = history_lines(g->history);
+    r->back = g->scroll_offset;
+    r->pos = g->scroll_pos;
+    // 滚动期间旧行被淘汰，停在最旧一行
+    if (r->back > lines) {
+      r->back = lines;
+      r->pos = 0;
+    }
+    r->y = 0;
+    r->width = g->width;
+    r->end = g->history->end;
+  }
+  for (; r->y < y; r->y++)
+    reflow_advance(g);
 
-  int history_line = (int)available - (int)g->scroll_offset + (int)y;
-  // 滚动超出历史范围
-  if (history_line < 0)
-    return NULL;
   // 非历史记录部分
-  if (history_line >= (int)available) {
-    int screen_y = history_line - available;
-    return &g->cells[screen_y * g->width];
+  if (r->back == 0)
+    return r->pos < g->height ? &g->cells[r->pos * g->width] : NULL;
+
+  if (g->scratch_width != g->width) {
+    struct cell *scratch = realloc(g->scratch, g->width * sizeof(*scratch));
+    if (!scratch)
+      return NULL;
+    g->scratch = scratch;
+    g->scratch_width = g->width;
   }
+  if (reflow_load(g, r->back) < 0)
+    return NULL;
+  unsigned int next = reflow_break(r, r->pos, g->width);
+  memcpy(g->scratch, &r->line[r->pos], (next - r->pos) * sizeof(struct cell));
+  memset(&g->scratch[next - r->pos], 0,
+         (g->width - (next - r->pos)) * sizeof(struct cell));
+  return g->scratch;
+}
 
-  unsigned int actual;
-  if (g->history_count <= g->history_size) {
-    actual = history_line;
-  } else {
-    unsigned int oldest = g->history_count % g->history_size;
-    actual = (oldest + history_line) % g->history_size;
+/*
+  字符簇内容哈希 (FNV-1a)
+*/
+static uint32_t cluster_hash(const char *text) {
+  uint32_t h = 2166136261u;
+  for (; *text; text++)
+    h = (h ^ (uint8_t)*text) * 16777619u;
+  return h;
+}
+
+/*
+  扩容字符簇哈希表并重新插入所有条目
+*/
+static int cluster_rehash(struct cell_clusters *cl, unsigned int hash_cap) {
+  uint32_t *hash = calloc(hash_cap, sizeof(*hash));
+  if (!hash)
+    return -1;
+  for (unsigned int i = 0; i < cl->count; i++) {
+    unsigned int slot = cluster_hash(cl->text[i]) & (hash_cap - 1);
+    while (hash[slot])
+      slot = (slot + 1) & (hash_cap - 1);
+    hash[slot] = i + 1;
+  }
+  free(cl->hash);
+  cl->hash = hash;
+  cl->hash_cap = hash_cap;
+  return 0;
+}
+
+/*
+  查找或插入字符簇，返回下标，失败返回 -1
+*/
+static int cluster_intern(struct cell_clusters *cl, const char *text) {
+  // 调用者保证 strlen(text) < CELL_UTF8_MAX
+  // 表满后已有的字符簇仍可查到，新字符簇由调用者退回首个码点
+  if (cl->hash_cap == 0 ||
+      (cl->count < MUXKIT_CLUSTER_MAX && (cl->count + 1) * 2 > cl->hash_cap)) {
+    if (cluster_rehash(cl, cl->hash_cap ? cl->hash_cap * 2 : 64) < 0)
+      return -1;
+  }
+
+  unsigned int slot = cluster_hash(text) & (cl->hash_cap - 1);
+  while (cl->hash[slot]) {
+    unsigned int idx = cl->hash[slot] - 1;
+    if (strcmp(cl->text[idx], text) == 0)
+      return (int)idx;
+    slot = (slot + 1) & (cl->hash_cap - 1);
+  }
+
+  if (cl->count >= MUXKIT_CLUSTER_MAX || cl->count > CELL_CP_MASK)
+    return -1;
+  if (cl->count == cl->cap) {
+    unsigned int cap = cl->cap ? cl->cap * 2 : 16;
+    char(*text_arr)[CELL_UTF8_MAX] =
+        realloc(cl->text, cap * sizeof(*cl->text));
+    if (!text_arr)
+      return -1;
+    cl->text = text_arr;
+    cl->cap = cap;
+  }
+  memcpy(cl->text[cl->count], text, strlen(text) + 1);
+  cl->hash[slot] = cl->count + 1;
+  return (int)cl->count++;
+}
+
+/*
+  设置单元格字符（支持多码点字符簇）
+*/
+void grid_cell_set_chars(struct grid *g, struct cell *c, const uint32_t *chars,
+                         unsigned int width) {
+  if (chars[0] == 0 || chars[0] > 0x10ffff || chars[1] == 0) {
+    cell_set_char(c, chars[0], width);
+    return;
+  }
+
+  // 多码点：拼接 UTF-8 后存入字符簇表
+  char text[CELL_UTF8_MAX];
+  size_t len = 0;
+  for (int i = 0; i < CELL_CLUSTER_MAX_CHARS && chars[i]; i++) {
+    char buf[5];
+    int n = unicode_to_utf8(chars[i], buf);
+    if (n <= 0 || len + n >= sizeof(text))
+      break;
+    memcpy(text + len, buf, n);
+    len += n;
+  }
+  text[len] = 0;
+
+  int idx = cluster_intern(&g->clusters, text);
+  if (idx < 0) {
+    cell_set_char(c, chars[0], width);
+    return;
+  }
+  c->ch = CELL_CLUSTER | (uint32_t)idx |
+          (uint32_t)(width & 0x3) << CELL_WIDTH_SHIFT;
+}
+
+/*
+  获取单元格 UTF-8 文本
+*/
+size_t grid_cell_utf8(const struct grid *g, const struct cell *c, char *out) {
+  if (cell_is_cluster(c)) {
+    unsigned int idx = c->ch & CELL_CP_MASK;
+    if (idx < g->clusters.count) {
+      size_t len = strlen(g->clusters.text[idx]);
+      memcpy(out, g->clusters.text[idx], len + 1);
+      return len;
+    }
+    out[0] = 0;
+    return 0;
+  }
+  uint32_t cp = cell_codepoint(c);
+  if (cp == 0) {
+    out[0] = 0;
+    return 0;
+  }
+  int n = unicode_to_utf8(cp, out);
+  return n > 0 ? (size_t)n : 0;
+}
+
+/*
+  释放字符簇表
+*/
+void grid_free_clusters(struct grid *g) {
+  free(g->clusters.text);
+  free(g->clusters.hash);
+  memset(&g->clusters, 0, sizeof(g->clusters));
+}
+
+/*
+  默认样式：样式表为空（新建网格）或 id 越界时使用
+*/
+static const struct grid_style default_style = {STYLE_PEN_DEFAULT, 4,
+                                                "\033[0m"};
+
+/*
+  预编码画笔的 SGR 序列，合并为一条 \033[0;...m
+*/
+static void style_encode(struct grid_style *st) {
+  uint8_t attr = pen_attr(st->pen), flags = pen_flags(st->pen);
+  int n = snprintf(st->sgr, sizeof(st->sgr), "\033[0%s%s%s%s",
+                   (attr & 0x01) ? ";1" : "", (attr & 0x02) ? ";4" : "",
+                   (attr & 0x04) ? ";3" : "", (attr & 0x08) ? ";7" : "");
+  if (!(flags & 0x01))
+    n += snprintf(st->sgr + n, sizeof(st->sgr) - n, ";38;5;%u",
+                  pen_fg(st->pen));
+  if (!(flags & 0x02))
+    n += snprintf(st->sgr + n, sizeof(st->sgr) - n, ";48;5;%u",
+                  pen_bg(st->pen));
+  n += snprintf(st->sgr + n, sizeof(st->sgr) - n, "m");
+  st->sgr_len = (uint8_t)n;
+}
+
+static uint32_t pen_hash(uint32_t pen) { return pen * 2654435761u; }
+
+/*
+  扩容样式哈希表并重新插入所有条目
+*/
+static int style_rehash(struct grid_styles *st, unsigned int hash_cap) {
+  uint32_t *hash = calloc(hash_cap, sizeof(*hash));
+  if (!hash)
+    return -1;
+  for (unsigned int i = 0; i < st->count; i++) {
+    unsigned int slot = pen_hash(st->items[i].pen) & (hash_cap - 1);
+    while (hash[slot])
+      slot = (slot + 1) & (hash_cap - 1);
+    hash[slot] = i + 1;
+  }
+  free(st->hash);
+  st->hash = hash;
+  st->hash_cap = hash_cap;
+  return 0;
+}
+
+/*
+  查找或插入画笔，失败返回 -1
+*/
+static int style_insert(struct grid_styles *st, uint32_t pen) {
+  if (st->hash_cap == 0 || (st->count + 1) * 2 > st->hash_cap) {
+    if (style_rehash(st, st->hash_cap ? st->hash_cap * 2 : 64) < 0)
+      return -1;
+  }
+
+  unsigned int slot = pen_hash(pen) & (st->hash_cap - 1);
+  while (st->hash[slot]) {
+    unsigned int id = st->hash[slot] - 1;
+    if (st->items[id].pen == pen)
+      return (int)id;
+    slot = (slot + 1) & (st->hash_cap - 1);
+  }
+
+  if (st->count == st->cap) {
+    unsigned int cap = st->cap ? st->cap * 2 : 32;
+    struct grid_style *items = realloc(st->items, cap * sizeof(*items));
+    if (!items)
+      return -1;
+    st->items = items;
+    st->cap = cap;
+  }
+  st->items[st->count].pen = pen;
+  style_encode(&st->items[st->count]);
+  st->hash[slot] = st->count + 1;
+  return (int)st->count++;
+}
+
+/*
+  获取画笔对应的样式 id
+*/
+uint32_t grid_style_intern(struct grid *g, uint32_t pen) {
+  struct grid_styles *st = &g->styles;
+  if (pen == STYLE_PEN_DEFAULT)
+    return GRID_STYLE_DEFAULT;
+  if (st->count > 0 && st->last_pen == pen)
+    return st->last_id;
+
+  // 条目 0 固定为默认样式，保证全零单元格是默认颜色
+  if (st->count == 0 && style_insert(st, STYLE_PEN_DEFAULT) < 0)
+    return GRID_STYLE_DEFAULT;
+  int id = style_insert(st, pen);
+  if (id < 0)
+    return GRID_STYLE_DEFAULT;
+  st->last_pen = pen;
+  st->last_id = (uint32_t)id;
+  return (uint32_t)id;
+}
+
+/*
+  获取样式条目
+*/
+const struct grid_style *grid_style_get(const struct grid *g, uint32_t id) {
+  if (id >= g->styles.count)
+    return &default_style;
+  return &g->styles.items[id];
+}
+
+/*
+  释放样式表
+*/
+void grid_free_styles(struct grid *g) {
+  free(g->styles.items);
+  free(g->styles.hash);
+  memset(&g->styles, 0, sizeof(g->styles));
+  // 缓存指向默认样式，避免画笔 0 误命中 id 0
+  g->styles.last_pen = STYLE_PEN_DEFAULT;
+}
+
+/*
+  标记脏行 [start, end)
+*/
+void grid_mark_dirty(struct grid *g, unsigned int start, unsigned int end) {
+  if (!g->dirty)
+    return;
+  if (end > g->height)
+    end = g->height;
+  for (unsigned int y = start; y < end; y++) {
+    if (!g->dirty[y]) {
+      g->dirty[y] = 1;
+      g->dirty_count++;
+    }
+  }
+}
+
+/*
+  清除所有脏行
+*/
+void grid_clear_dirty(struct grid *g) {
+  if (g->dirty && g->dirty_count > 0)
+    memset(g->dirty, 0, g->height);
+  g->dirty_count = 0;
+}
+
+/*
+  移动网格中的矩形区域 (src -> dest)，用于 libvterm 滚动
+*/
+void grid_move_rect(struct grid *g, VTermRect dest, VTermRect src) {
+  int rows = src.end_row - src.start_row;
+  int cols = src.end_col - src.start_col;
+  if (rows <= 0 || cols <= 0 || dest.start_row < 0 || src.start_row < 0 ||
+      dest.start_col < 0 || src.start_col < 0)
+    return;
+  if ((unsigned int)(dest.start_row + rows) > g->height ||
+      (unsigned int)(src.start_row + rows) > g->height ||
+      (unsigned int)(dest.start_col + cols) > g->width ||
+      (unsigned int)(src.start_col + cols) > g->width)
+    return;
+
+  // 整行移动时行在内存中连续，一次 memmove 完成
+  if (cols == (int)g->width) {
+    memmove(&g->cells[dest.start_row * g->width],
+            &g->cells[src.start_row * g->width],
+            (size_t)rows * g->width * sizeof(struct cell));
+    return;
+  }
+
+  // 部分列移动，按方向逐行复制，避免覆盖尚未移动的行
+  int downward = dest.start_row > src.start_row;
+  for (int i = 0; i < rows; i++) {
+    int r = downward ? rows - 1 - i : i;
+    memmove(&g->cells[(dest.start_row + r) * g->width + dest.start_col],
+            &g->cells[(src.start_row + r) * g->width + src.start_col],
+            cols * sizeof(struct cell));
   }
-  return &g->history_cells[actual * g->width];
 }
 
 /*
@@ -180,217 +672,210 @@ void render_cleanup(struct screen *s) {
   s->path = NULL;
 }
 
+/*
+  光标移动到 pane 内的正确位置并设置光标形状
+*/
+static void render_cursor(struct frame *f, struct window_pane *p) {
+  extern struct client client;
+  // 同步输入模式下使用竖线光标，否则使用方块光标
+  frame_printf(f, "\033[%u;%uH\033[%c q", p->yoff + p->cy + 1,
+               p->xoff + p->cx + 1, client.sync_input_mode ? '6' : '2');
+  frame_append(f, CURSOR_SHOW, 6);
+}
+
+/*
+  计算 UTF-8 字符串的显示宽度（中文字符占2列）
+*/
+static unsigned int utf8_display_width(const char *s) {
+  unsigned int width = 0;
+  const unsigned char *p = (const unsigned char *)s;
+  while (*p) {
+    if (*p >= 0x80) {
+      // UTF-8 多字节字符，跳过后续字节
+      if ((*p & 0xE0) == 0xC0) {
+        p += 2;
+        width += 1;
+      } else if ((*p & 0xF0) == 0xE0) {
+        p += 3;
+        width += 2;
+      } else if ((*p & 0xF8) == 0xF0) {
+        p += 4;
+        width += 2;
+      } else {
+        p++;
+        width += 1;
+      }
+    } else {
+      p++;
+      width++;
+    }
+  }
+  return width;
+}
+
 /*
   渲染屏幕
 */
 void render_screen(struct session *s) {
   struct window *w = s->active_window;
-  write(STDOUT_FILENO, CURSOR_HIDE, strlen(CURSOR_HIDE));
+  frame_append(frame_current(), CURSOR_HIDE, 6);
   struct window_pane *p;
   // 从链头panes开始，每次取一个包含link的节点，返回给p
   list_for_each_entry(p, &w->panes, link) { render_pane(p); }
 }
 
+/*
+  渲染网格的一行，last 记录上一个单元格的样式 id，用于跨行复用 SGR 状态
+*/
+static void render_row(struct frame *f, struct window_pane *p, unsigned int y,
+                       uint32_t *last) {
+  // ANSI 标准规定终端从 (1,1) 开始
+  frame_printf(f, "\033[%u;%uH", p->yoff + y + 1, p->xoff + 1);
+  struct cell *line = grid_get_display_line(p->grid, y);
+  if (!line) {
+    frame_fill(f, ' ', p->sx);
+    return;
+  }
+  for (unsigned int x = 0; x < p->sx;) {
+    struct cell *c = &line[x];
+
+    // 检查是否需要更新颜色/属性（样式 id 一次整数比较）
+    if (c->style != *last) {
+      const struct grid_style *st = grid_style_get(p->grid, c->style);
+      frame_append(f, st->sgr, st->sgr_len);
+      *last = c->style;
+    }
+
+    uint32_t cp = cell_codepoint(c);
+    if (cp != 0 && cp < 0x80) {
+      // ASCII 快速路径
+      char ch = (char)cp;
+      frame_append(f, &ch, 1);
+      x += cell_width(c) > 0 ? cell_width(c) : 1;
+    } else if (!cell_is_empty(c)) {
+      char buf[CELL_UTF8_MAX];
+      frame_append(f, buf, grid_cell_utf8(p->grid, c, buf));
+      // 宽字符占多列，跳过后续单元格
+      x += cell_width(c) > 0 ? cell_width(c) : 1;
+    } else {
+      frame_append(f, " ", 1);
+      x++;
+    }
+  }
+}
+
+/*
+  渲染结束：重置颜色并放置光标
+*/
+static void render_pane_finish(struct frame *f, struct window_pane *p) {
+  // 重置颜色
+  frame_append(f, "\033[0m", 4);
+
+  // 历史模式下隐藏光标，正常模式下显示
+  if (p->grid->scroll_offset > 0) {
+    frame_append(f, CURSOR_HIDE, 6);
+  } else {
+    render_cursor(f, p);
+  }
+}
+
 /*
   渲染网格
 */
 void render_pane(struct window_pane *p) {
   if (!p || !p->grid)
     return;
+  struct frame *f = frame_current();
   // 隐藏光标
-  write(STDOUT_FILENO, CURSOR_HIDE, 6);
+  frame_append(f, CURSOR_HIDE, 6);
 
-  char buf[128];
-  struct grid *g = p->grid;
-  uint8_t last_fg = 0, last_bg = 0, last_attr = 0, last_flags = 0x03;
+  uint32_t last = GRID_STYLE_DEFAULT;
 
   // 重置颜色
-  write(STDOUT_FILENO, "\033[0m", 4);
+  frame_append(f, "\033[0m", 4);
 
-  for (unsigned int y = 0; y < p->sy; y++) {
-    // ANSI 标准规定终端从 (1,1) 开始
-    int len =
-        snprintf(buf, sizeof(buf), "\033[%u;%uH", p->yoff + y + 1, p->xoff + 1);
-    write(STDOUT_FILENO, buf, len);
-    struct cell *line = grid_get_display_line(g, y);
-    if (!line) {
-      for (unsigned int x = 0; x < p->sx; x++) {
-        write(STDOUT_FILENO, " ", 1);
-      }
-      continue;
-    }
-    for (unsigned int x = 0; x < p->sx;) {
-      struct cell *c = &line[x];
-
-      // 检查是否需要更新颜色/属性
-      int need_update = (c->fg != last_fg || c->bg != last_bg ||
-                         c->attr != last_attr || c->flags != last_flags);
-
-      if (need_update) {
-        // 重置
-        write(STDOUT_FILENO, "\033[0m", 4);
-        // 设置属性
-        if (c->attr & 0x01)
-          write(STDOUT_FILENO, "\033[1m", 4); // bold
-        if (c->attr & 0x02)
-          write(STDOUT_FILENO, "\033[4m", 4); // underline
-        if (c->attr & 0x04)
-          write(STDOUT_FILENO, "\033[3m", 4); // italic
-        if (c->attr & 0x08)
-          write(STDOUT_FILENO, "\033[7m", 4); // reverse
-
-        // 设置前景色 (非默认)
-        if (!(c->flags & 0x01)) {
-          len = snprintf(buf, sizeof(buf), "\033[38;5;%um", c->fg);
-          write(STDOUT_FILENO, buf, len);
-        }
-
-        // 设置背景色 (非默认)
-        if (!(c->flags & 0x02)) {
-          len = snprintf(buf, sizeof(buf), "\033[48;5;%um", c->bg);
-          write(STDOUT_FILENO, buf, len);
-        }
-
-        last_fg = c->fg;
-        last_bg = c->bg;
-        last_attr = c->attr;
-        last_flags = c->flags;
-      }
+  for (unsigned int y = 0; y < p->sy; y++)
+    render_row(f, p, y, &last);
 
-      if (c->ch[0]) {
-        write(STDOUT_FILENO, c->ch, strlen(c->ch));
-        // 宽字符占多列，跳过后续单元格
-        x += (c->width > 0) ? c->width : 1;
-      } else {
-        write(STDOUT_FILENO, " ", 1);
-        x++;
-      }
-    }
+  // 整个窗格已重绘，清除所有脏行
+  grid_clear_dirty(p->grid);
+  render_pane_finish(f, p);
+}
+
+/*
+  只渲染脏行
+*/
+void render_pane_damage(struct window_pane *p) {
+  if (!p || !p->grid)
+    return;
+  struct grid *g = p->grid;
+
+  // 查看历史时视图随历史增长整体移动，脏行与显示行不对应，整体重绘
+  if (g->scroll_offset > 0 || !g->dirty) {
+    render_pane(p);
+    return;
   }
-  // 重置颜色
-  write(STDOUT_FILENO, "\033[0m", 4);
 
-  // 历史模式下隐藏光标，正常模式下显示
-  if (g->scroll_offset > 0) {
-    write(STDOUT_FILENO, CURSOR_HIDE, 6);
-  } else {
-    // 光标移动到 pane 内的正确位置
-    struct client *c = container_of(p, struct client, pane);
-    int clen;
-    if (c->sync_input_mode) {
-      clen = snprintf(buf, sizeof(buf), "\033[%u;%uH\033[6 q",
-                      p->yoff + p->cy + 1, p->xoff + p->cx + 1);
-    } else {
-      clen = snprintf(buf, sizeof(buf), "\033[%u;%uH\033[2 q", p->yoff + p->cy + 1,
-                      p->xoff + p->cx + 1);
+  struct frame *f = frame_current();
+  frame_append(f, CURSOR_HIDE, 6);
+
+  if (g->dirty_count > 0) {
+    uint32_t last = GRID_STYLE_DEFAULT;
+    frame_append(f, "\033[0m", 4);
+    for (unsigned int y = 0; y < p->sy && y < g->height; y++) {
+      if (g->dirty[y])
+        render_row(f, p, y, &last);
     }
-    write(STDOUT_FILENO, buf, clen);
-    write(STDOUT_FILENO, CURSOR_SHOW, 6);
+    grid_clear_dirty(g);
   }
+
+  render_pane_finish(f, p);
 }
 
 /*
   渲染状态栏
 */
 void render_status_bar(struct client *c) {
-  char buf[MUXKIT_BUF_MEDIUM];
-  unsigned int row = c->ws.ws_row + 1; // 最后一行
+  struct frame *f = frame_current();
+  unsigned int row = c->ws.ws_row; // 最后一行
   unsigned int cols = c->ws.ws_col;
-  write(STDOUT_FILENO, CURSOR_HIDE, 6);
+  frame_append(f, CURSOR_HIDE, 6);
   // 移动到最后一行，蓝色背景白色文字
-  int len = snprintf(buf, sizeof(buf), "\033[%u;1H\033[44;97m", row);
-  write(STDOUT_FILENO, buf, len);
+  frame_printf(f, "\033[%u;1H\033[44;97m", row);
 
   // 写状态内容
   const char *wname = c->pane->window->name ? c->pane->window->name : "unnamed";
-  int wstr_len = snprintf(buf, sizeof(buf), " %s ", wname);
-  write(STDOUT_FILENO, buf, wstr_len);
+  frame_printf(f, " %s ", wname);
 
-  // 计算窗口名称的显示宽度（中文字符占2列）
-  unsigned int wname_display_width = 2; // 两边的空格
-  const unsigned char *p = (const unsigned char *)wname;
-  while (*p) {
-    if (*p >= 0x80) {
-      // UTF-8 多字节字符，跳过后续字节
-      if ((*p & 0xE0) == 0xC0) {
-        p += 2;
-        wname_display_width += 1;
-      } else if ((*p & 0xF0) == 0xE0) {
-        p += 3;
-        wname_display_width += 2;
-      } else if ((*p & 0xF8) == 0xF0) {
-        p += 4;
-        wname_display_width += 2;
-      } else {
-        p++;
-        wname_display_width += 1;
-      }
-    } else {
-      p++;
-      wname_display_width++;
-    }
-  }
+  // 计算窗口名称的显示宽度（两边各一个空格）
+  unsigned int used_width = utf8_display_width(wname) + 2;
 
-  int history_display_width = 0;
   if (c->pane->grid->scroll_offset) {
     const char *history_str = TR(MSG_STATUS_HISTORY);
-    int hstr_len = snprintf(buf, sizeof(buf), "%s", history_str);
-    write(STDOUT_FILENO, buf, hstr_len);
+    frame_puts(f, history_str);
     // 计算历史标签的显示宽度
-    p = (const unsigned char *)history_str;
-    while (*p) {
-      if (*p >= 0x80) {
-        if ((*p & 0xE0) == 0xC0) {
-          p += 2;
-          history_display_width += 1;
-        } else if ((*p & 0xF0) == 0xE0) {
-          p += 3;
-          history_display_width += 2;
-        } else if ((*p & 0xF8) == 0xF0) {
-          p += 4;
-          history_display_width += 2;
-        } else {
-          p++;
-          history_display_width += 1;
-        }
-      } else {
-        p++;
-        history_display_width++;
-      }
-    }
+    used_width += utf8_display_width(history_str);
   }
 
-  // 用空格填满整行
-  int vstr_len = snprintf(buf, sizeof(buf), "%s", MUXKIT_VERSION_STRING);
-  unsigned int used_width = wname_display_width + history_display_width;
-
-  for (unsigned int i = used_width; i < cols; i++) {
-    if (i >= cols - 1 - vstr_len) {
-      write(STDOUT_FILENO, buf, vstr_len);
-      write(STDOUT_FILENO, " ", 1);
-      break;
-    }
-    write(STDOUT_FILENO, " ", 1);
+  // 用空格填满整行，版本号靠右
+  const char *vstr = MUXKIT_VERSION_STRING;
+  unsigned int vstr_len = strlen(vstr);
+  if (used_width + vstr_len + 1 <= cols) {
+    frame_fill(f, ' ', cols - 1 - vstr_len - used_width);
+    frame_append(f, vstr, vstr_len);
+    frame_append(f, " ", 1);
+  } else if (used_width < cols) {
+    frame_append(f, vstr, vstr_len);
+    frame_append(f, " ", 1);
   }
 
   // 清除到行尾，防止残留字符
-  write(STDOUT_FILENO, "\033[K", 3);
+  frame_append(f, "\033[K", 3);
   // 重置属性
-  write(STDOUT_FILENO, "\033[0m", 4);
+  frame_append(f, "\033[0m", 4);
   if (c->pane->grid->scroll_offset == 0) {
     // 光标移动到 pane 内的正确位置 （vt解析）
-    int clen;
-    if (c->sync_input_mode) {
-      clen = snprintf(buf, sizeof(buf), "\033[%u;%uH\033[6 q",
-                      c->pane->yoff + c->pane->cy + 1,
-                      c->pane->xoff + c->pane->cx + 1);
-    } else {
-      clen = snprintf(buf, sizeof(buf), "\033[%u;%uH\033[2 q",
-                      c->pane->yoff + c->pane->cy + 1,
-                      c->pane->xoff + c->pane->cx + 1);
-    }
-    write(STDOUT_FILENO, buf, clen);
-    write(STDOUT_FILENO, CURSOR_SHOW, 6);
+    render_cursor(f, c->pane);
   }
 }
 
@@ -398,311 +883,371 @@ void render_status_bar(struct client *c) {
   渲染网格分割线
 */
 void render_pane_borders(struct window_pane *p) {
-  write(STDOUT_FILENO, CURSOR_HIDE, 6);
-  char buf[MUXKIT_BUF_MEDIUM];
+  struct frame *f = frame_current();
+  frame_append(f, CURSOR_HIDE, 6);
   for (unsigned int y = 0; y < p->sy; y++) {
-    int len = snprintf(buf, sizeof(buf), "\033[%u;%uH\033[34m│\033[0m",
-                       p->yoff + y + 1, p->xoff + p->sx + 1);
-    write(STDOUT_FILENO, buf, len);
+    frame_printf(f, "\033[%u;%uH\033[34m│\033[0m", p->yoff + y + 1,
+                 p->xoff + p->sx + 1);
   }
 
   // 光标移动到 pane 内的正确位置 （vt解析）
-  int clen;
-  struct client *c = container_of(p, struct client, pane);
-  if (c->sync_input_mode) {
-    clen = snprintf(buf, sizeof(buf), "\033[%u;%uH\033[6 q", p->yoff + p->cy + 1,
-                    p->xoff + p->cx + 1);
-  } else {
-    clen = snprintf(buf, sizeof(buf), "\033[%u;%uH\033[2 q", p->yoff + p->cy + 1,
-                    p->xoff + p->cx + 1);
-  }
-  write(STDOUT_FILENO, buf, clen);
-  write(STDOUT_FILENO, CURSOR_SHOW, 6);
+  render_cursor(f, p);
 }
 
 /*
-  网格序列化
+  快照正文的字节数上限，hist_size 输出历史记录的字节数
 */
-size_t grid_serialize(struct grid *g, unsigned int pane_id, unsigned int cx,
-                      unsigned int cy, void **out_buf) {
-  unsigned int stored_history =
-      (g->history_count < g->history_size) ? g->history_count : g->history_size;
+static size_t grid_body_bound(struct grid *g, size_t *hist_size) {
+  unsigned int stored_history = history_lines(g->history);
+
+  // 历史行直接复制已编码的记录
+  *hist_size = 0;
+  for (unsigned int i = 0; i < stored_history; i++) {
+    size_t rec_len;
+    if (history_record(g->history, i, &rec_len))
+      *hist_size += rec_len;
+  }
 
-  size_t cells_size = g->width * g->height * sizeof(*g->cells);
-  size_t hist_cells_size = stored_history * g->width * sizeof(*g->cells);
-  size_t total = 8 * sizeof(unsigned int) + cells_size + hist_cells_size;
+  size_t screen_size = (size_t)g->height * history_record_bound(g->width);
+  size_t clusters_size = g->clusters.count * sizeof(*g->clusters.text);
+  size_t styles_size = g->styles.count * sizeof(uint32_t);
+  return 8 * sizeof(uint32_t) + screen_size + sizeof(uint32_t) + *hist_size +
+         sizeof(uint32_t) + clusters_size + sizeof(uint32_t) + styles_size;
+}
 
-  char *buf = malloc(total);
-  if (!buf)
-    return 0;
-  char *p = buf;
-  memcpy(p, &pane_id, sizeof(pane_id));
-  p += sizeof(pane_id);
-  memcpy(p, &cx, sizeof(cx));
-  p += sizeof(cx);
-  memcpy(p, &cy, sizeof(cy));
-  p += sizeof(cy);
-  memcpy(p, &g->width, sizeof(g->width));
-  p += sizeof(g->width);
-  memcpy(p, &g->height, sizeof(g->height));
-  p += sizeof(g->height);
-  memcpy(p, &g->history_size, sizeof(g->history_size));
-  p += sizeof(g->history_size);
-  memcpy(p, &g->history_count, sizeof(g->history_count));
-  p += sizeof(g->history_count);
-  memcpy(p, &g->scroll_offset, sizeof(g->scroll_offset));
-  p += sizeof(g->scroll_offset);
-  memcpy(p, g->cells, cells_size);
-  p += cells_size;
-
-  if (hist_cells_size > 0 && g->history_cells) {
-    if (g->history_count <= g->history_size) {
-      memcpy(p, g->history_cells, hist_cells_size);
-    } else {
-      unsigned int oldest = g->history_count % g->history_size;
-      size_t old_one =
-          (g->history_size - oldest) * g->width * sizeof(*g->cells);
-      size_t new_one = oldest * g->width * sizeof(*g->cells);
-      memcpy(p, &g->history_cells[oldest * g->width], old_one);
-      memcpy(p + old_one, g->history_cells, new_one);
-    }
-  }
-  *out_buf = buf;
-  return total;
+static char *put_u32(char *p, uint32_t v) {
+  memcpy(p, &v, sizeof(v));
+  return p + sizeof(v);
 }
 
 /*
-  网格反序列化
+  写入快照正文，返回实际字节数
 */
-int grid_deserialize(struct grid *g, unsigned int *pane_id, unsigned int *cx,
-                     unsigned int *cy, const void *buf, size_t len) {
-  const char *p = buf;
-
-  if (len < 8 * sizeof(unsigned int))
-    return -1;
-
-  memcpy(pane_id, p, sizeof(*pane_id));
-  p += sizeof(*pane_id);
-  memcpy(cx, p, sizeof(*cx));
-  p += sizeof(*cx);
-  memcpy(cy, p, sizeof(*cy));
-  p += sizeof(*cy);
-  memcpy(&g->width, p, sizeof(g->width));
-  p += sizeof(g->width);
-  memcpy(&g->height, p, sizeof(g->height));
-  p += sizeof(g->height);
-  memcpy(&g->history_size, p, sizeof(g->history_size));
-  p += sizeof(g->history_size);
-  memcpy(&g->history_count, p, sizeof(g->history_count));
-  p += sizeof(g->history_count);
-  memcpy(&g->scroll_offset, p, sizeof(g->scroll_offset));
-  p += sizeof(g->scroll_offset);
-
-  // cells
-  size_t cells_size = g->width * g->height * sizeof(struct cell);
-  unsigned int stored =
-      (g->history_count < g->history_size) ? g->history_count : g->history_size;
-  size_t hist_size = stored * g->width * sizeof(struct cell);
-
-  if (len < 8 * sizeof(unsigned int) + cells_size + hist_size)
-    return -1;
-
-  // 释放旧数据（pane_create 时已分配）
-  free(g->cells);
-  free(g->history_cells);
-
-  g->cells = malloc(cells_size);
-  if (!g->cells)
-    return -1;
-  memcpy(g->cells, p, cells_size);
-  p += cells_size;
-
-  // history
-  if (g->history_size > 0) {
-    g->history_cells = calloc(g->history_size * g->width, sizeof(struct cell));
-    if (!g->history_cells)
-      return -1;
-    if (stored > 0) {
-      memcpy(g->history_cells, p, hist_size);
-    }
-    // 重置 history_count，因为序列化时已经展开成顺序排列了
-    g->history_count = stored;
-  } else {
-    g->history_cells = NULL;
+static size_t grid_body_write(struct grid *g, unsigned int pane_id,
+                              unsigned int cx, unsigned int cy, char *buf,
+                              size_t hist_size) {
+  unsigned int stored_history = history_lines(g->history);
+  char *p = buf;
+  p = put_u32(p, pane_id);
+  p = put_u32(p, cx);
+  p = put_u32(p, cy);
+  p = put_u32(p, g->width);
+  p = put_u32(p, g->height);
+  p = put_u32(p, g->history ? g->history->max_lines : 0);
+  p = put_u32(p, stored_history);
+  p = put_u32(p, g->scroll_offset);
+
+  // 屏幕行与历史行使用同一种记录编码：末尾空白不保存，样式按游程保存
+  for (unsigned int y = 0; y < g->height; y++)
+    p += history_record_encode(p, &g->cells[y * g->width], g->width, 0);
+
+  // 历史记录：总字节数 + 按从旧到新顺序排列的记录
+  // 落盘段在两遍之间可能映射成功或失败，只写入 hist_size 以内的记录，
+  // 总字节数按实际写入回填，不会越过 grid_body_bound 算出的上限
+  char *hist_len_at = p;
+  p += sizeof(uint32_t);
+  size_t hist_written = 0;
+  for (unsigned int i = 0; i < stored_history; i++) {
+    size_t rec_len;
+    const void *rec = history_record(g->history, i, &rec_len);
+    if (!rec)
+      continue;
+    if (rec_len > hist_size - hist_written)
+      break;
+    memcpy(p, rec, rec_len);
+    p += rec_len;
+    hist_written += rec_len;
+  }
+  put_u32(hist_len_at, (uint32_t)hist_written);
+
+  // 字符簇表：单元格中的簇下标指向这里，每项以 NUL 结尾
+  p = put_u32(p, g->clusters.count);
+  for (unsigned int i = 0; i < g->clusters.count; i++) {
+    size_t n = strlen(g->clusters.text[i]) + 1;
+    memcpy(p, g->clusters.text[i], n);
+    p += n;
   }
 
-  return 0;
+  // 样式表：只保存画笔，SGR 在接收端重新编码
+  p = put_u32(p, g->styles.count);
+  for (unsigned int i = 0; i < g->styles.count; i++)
+    p = put_u32(p, g->styles.items[i].pen);
+  return p - buf;
 }
 
 /*
-  判断 cell 是否为空白（
+  快照字节数上限
 */
-static int cell_is_blank(const struct cell *c) {
-  return (c->ch[0] == ' ' || c->ch[0] == 0) && (c->flags & 0x03) == 0x03 &&
-         c->attr == 0;
+static size_t grid_snapshot_bound(struct grid *g, unsigned int flags,
+                                  size_t *body_bound, size_t *hist_size) {
+  *body_bound = grid_body_bound(g, hist_size);
+  return sizeof(struct grid_snapshot_header) +
+         ((flags & GRID_SNAPSHOT_LZ) ? lz_bound(*body_bound) : *body_bound);
 }
 
 /*
-  判断 cell 是否为视觉空白
+  写入快照头和正文，out 至少 grid_snapshot_bound 字节，返回实际字节数
 */
-static int cell_is_visually_blank(const struct cell *c) {
-  return c->ch[0] == ' ' || c->ch[0] == 0;
+static size_t grid_snapshot_write(struct grid *g, unsigned int pane_id,
+                                  unsigned int cx, unsigned int cy,
+                                  unsigned int flags, char *out,
+                                  size_t body_bound, size_t hist_size) {
+  struct grid_snapshot_header hdr = {.magic = GRID_SNAPSHOT_MAGIC,
+                                     .version = GRID_SNAPSHOT_VERSION};
+  char *body = out + sizeof(hdr);
+  size_t raw_len, body_len;
+
+  if (flags & GRID_SNAPSHOT_LZ) {
+    char *raw = malloc(body_bound);
+    if (!raw)
+      return 0;
+    raw_len = grid_body_write(g, pane_id, cx, cy, raw, hist_size);
+    body_len = lz_compress(raw, raw_len, body, lz_bound(body_bound));
+    if (body_len > 0 && body_len < raw_len) {
+      hdr.flags |= GRID_SNAPSHOT_LZ;
+    } else {
+      // 压缩无收益，按原样保存
+      memcpy(body, raw, raw_len);
+      body_len = raw_len;
+    }
+    free(raw);
+  } else {
+    raw_len = body_len = grid_body_write(g, pane_id, cx, cy, body, hist_size);
+  }
+
+  hdr.raw_len = (uint32_t)raw_len;
+  hdr.body_len = (uint32_t)body_len;
+  hdr.crc = crc32(0, body, body_len);
+  memcpy(out, &hdr, sizeof(hdr));
+  return sizeof(hdr) + body_len;
+}
+
+unsigned int grid_snapshot_flags(void) {
+  const char *env = getenv("MUXKIT_SNAPSHOT_LZ");
+  int lz = env ? atoi(env) : MUXKIT_SNAPSHOT_LZ;
+  return lz ? GRID_SNAPSHOT_LZ : 0;
 }
 
 /*
-  根据新宽度重新调整历史缓冲区布局
+  网格序列化
 */
-int grid_resize_history(struct grid *g, unsigned int new_width) {
-  if (!g->history_cells || g->history_size == 0 || new_width == 0)
-    return 0;
-  if (new_width == g->width)
+size_t grid_serialize(struct grid *g, unsigned int pane_id, unsigned int cx,
+                      unsigned int cy, unsigned int flags, void **out_buf) {
+  size_t body_bound, hist_size;
+  size_t bound = grid_snapshot_bound(g, flags, &body_bound, &hist_size);
+  char *buf = malloc(bound);
+  if (!buf)
     return 0;
-
-  unsigned int old_width = g->width;
-  unsigned int stored =
-      (g->history_count < g->history_size) ? g->history_count : g->history_size;
-  if (stored == 0)
+  size_t total = grid_snapshot_write(g, pane_id, cx, cy, flags, buf,
+                                     body_bound, hist_size);
+  if (total == 0) {
+    free(buf);
     return 0;
+  }
+  char *shrunk = realloc(buf, total);
+  *out_buf = shrunk ? shrunk : buf;
+  return total;
+}
 
-  // 获取 flags 和 lines
-  struct cell *old_lines = calloc(stored * old_width, sizeof(struct cell));
-  uint8_t *old_flags = calloc(stored, sizeof(uint8_t));
-  if (!old_lines || !old_flags) {
-    free(old_lines);
-    free(old_flags);
+int grid_snapshot_create(struct grid *g, unsigned int pane_id, unsigned int cx,
+                         unsigned int cy, unsigned int flags, size_t *len) {
+  size_t body_bound, hist_size;
+  size_t bound = grid_snapshot_bound(g, flags, &body_bound, &hist_size);
+  int fd = shm_create("muxkit-grid", bound);
+  if (fd == -1)
+    return -1;
+  void *map = mmap(NULL, bound, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    log_error("mmap grid snapshot failed: %s", strerror(errno));
+    close(fd);
     return -1;
   }
-
-  for (unsigned int i = 0; i < stored; i++) {
-    unsigned int idx;
-    if (g->history_count <= g->history_size)
-      idx = i;
-    else
-      // ring buff
-      idx = ((g->history_count % g->history_size) + i) % g->history_size;
-    memcpy(&old_lines[i * old_width], &g->history_cells[idx * old_width],
-           old_width * sizeof(struct cell));
-    // 复制 flags
-    if (g->history_line_flags)
-      old_flags[i] = g->history_line_flags[idx];
-  }
-
-  unsigned int max_out = (stored * old_width + new_width - 1) / new_width +
-                         stored; // 最坏的情况下多空一行 + stored
-  struct cell *out_cells = calloc(max_out * new_width, sizeof(struct cell));
-  uint8_t *out_flags = calloc(max_out, sizeof(uint8_t));
-  // 单行临时缓冲区
-  struct cell *logical = calloc(stored * old_width, sizeof(struct cell));
-  if (!out_cells || !out_flags || !logical) {
-    free(old_lines);
-    free(old_flags);
-    free(out_cells);
-    free(out_flags);
-    free(logical);
+  // 直接写入共享映射，不经过中间缓冲区，写完按实际大小截断
+  size_t total = grid_snapshot_write(g, pane_id, cx, cy, flags, map,
+                                     body_bound, hist_size);
+  munmap(map, bound);
+  if (total == 0 || ftruncate(fd, (off_t)total) == -1) {
+    close(fd);
     return -1;
   }
+  *len = total;
+  return fd;
+}
 
-  // 初始化 out_cells 的 flags 为默认颜色，避免 padding 单元格渲染为黑色背景
-  for (unsigned int j = 0; j < max_out * new_width; j++)
-    out_cells[j].flags = 0x03;
-
-  // reflow
-  unsigned int out_row = 0;
-  unsigned int i = 0;
-  while (i < stored) {
-    unsigned int logical_len = 0;
-
-    // 收集起始行（continuation=false 或第一行）
-    memcpy(&logical[logical_len], &old_lines[i * old_width],
-           old_width * sizeof(struct cell));
-    logical_len += old_width;
-    i++;
-
-    // 收集后续的 continuation 行（continuation=true 表示"我是前一行的延续"）
-    while (i < stored && (old_flags[i] & 0x01)) {
-      memcpy(&logical[logical_len], &old_lines[i * old_width],
-             old_width * sizeof(struct cell));
-      logical_len += old_width;
-      i++;
-    }
+int grid_snapshot_restore(struct grid *g, int fd, size_t len,
+                          unsigned int *pane_id, unsigned int *cx,
+                          unsigned int *cy) {
+  struct stat st;
+  if (len == 0 || fstat(fd, &st) == -1 || (size_t)st.st_size < len) {
+    log_error("grid snapshot fd %d: bad size", fd);
+    return -1;
+  }
+  void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    log_error("mmap grid snapshot failed: %s", strerror(errno));
+    return -1;
+  }
+  int ret = grid_deserialize(g, pane_id, cx, cy, map, len);
+  munmap(map, len);
+  return ret;
+}
 
-    // 裁剪末尾空白 cell（宽松判断：只看字符内容）
-    while (logical_len > 0 && cell_is_visually_blank(&logical[logical_len - 1]))
-      logical_len--;
+/*
+  按顺序读取快照正文的游标，越界后 p 置为 NULL
+*/
+struct snapshot_reader {
+  const char *p;
+  const char *end;
+};
+
+static uint32_t get_u32(struct snapshot_reader *r) {
+  uint32_t v = 0;
+  if (!r->p || r->end - r->p < (long)sizeof(v)) {
+    r->p = NULL;
+    return 0;
+  }
+  memcpy(&v, r->p, sizeof(v));
+  r->p += sizeof(v);
+  return v;
+}
 
-    if (logical_len == 0) {
-      // 空逻辑行，保留一个空行
-      out_flags[out_row] = 0x00;
-      out_row++;
-      continue;
-    }
+/*
+  解析快照正文
+*/
+static int grid_body_read(struct grid *g, unsigned int *pane_id,
+                          unsigned int *cx, unsigned int *cy, const char *buf,
+                          size_t len) {
+  struct snapshot_reader r = {buf, buf + len};
+  *pane_id = get_u32(&r);
+  *cx = get_u32(&r);
+  *cy = get_u32(&r);
+  unsigned int width = get_u32(&r);
+  unsigned int height = get_u32(&r);
+  unsigned int max_lines = get_u32(&r);
+  unsigned int stored = get_u32(&r);
+  unsigned int scroll_offset = get_u32(&r);
+  if (!r.p || width == 0 || height == 0 || width > GRID_SNAPSHOT_MAX_DIM ||
+      height > GRID_SNAPSHOT_MAX_DIM)
+    return -1;
 
-    // 新行数
-    unsigned int num_new = (logical_len + new_width - 1) / new_width;
-    for (unsigned int j = 0; j < logical_len; j++)
-      // (起始行数 + j所属行) * 宽度 + 所属行第几列
-      out_cells[(out_row + j / new_width) * new_width + j % new_width] =
-          logical[j];
-
-    // 标记 flags：第一行是逻辑行起始（0x00），后续行是延续（0x01）
-    out_flags[out_row] = 0x00;
-    for (unsigned int k = 1; k < num_new; k++)
-      out_flags[out_row + k] = 0x01;
-    out_row += num_new;
-  }
-
-  free(logical);
-
-  // 裁剪末尾的全空白行（vterm resize 推入的屏幕空白填充）
-  while (out_row > 0) {
-    struct cell *row = &out_cells[(out_row - 1) * new_width];
-    int all_blank = 1;
-    for (unsigned int x = 0; x < new_width; x++) {
-      if (!cell_is_visually_blank(&row[x])) {
-        all_blank = 0;
-        break;
-      }
+  // 屏幕行
+  struct cell *cells = calloc((size_t)width * height, sizeof(struct cell));
+  if (!cells)
+    return -1;
+  for (unsigned int y = 0; y < height; y++) {
+    long n = history_record_decode(r.p, r.end - r.p, &cells[y * width], width,
+                                   NULL);
+    if (n < 0) {
+      free(cells);
+      return -1;
     }
-    if (all_blank)
-      out_row--;
-    else
-      break;
+    r.p += n;
   }
-
-  // 取最后 history_size 行放入最终缓冲区
-  struct cell *new_hist =
-      calloc(g->history_size * new_width, sizeof(struct cell));
-  uint8_t *new_flg = calloc(g->history_size, sizeof(uint8_t));
-  if (!new_hist || !new_flg) {
-    free(old_lines);
-    free(old_flags);
-    free(out_cells);
-    free(out_flags);
-    free(new_hist);
-    free(new_flg);
+  // 释放旧数据（pane_create 时已分配）
+  free(g->cells);
+  g->cells = cells;
+  g->width = width;
+  g->height = height;
+
+  // 高度可能变化，重新分配脏行标记
+  free(g->dirty);
+  g->dirty = calloc(g->height, sizeof(uint8_t));
+  g->dirty_count = 0;
+  grid_mark_dirty(g, 0, g->height);
+
+  // history：行数上限沿用发送端，字节上限使用本地配置
+  uint32_t hist_len = get_u32(&r);
+  if (!r.p || hist_len > (size_t)(r.end - r.p))
     return -1;
+  unsigned int def_lines;
+  size_t max_bytes, max_disk;
+  grid_history_limits(&def_lines, &max_bytes, &max_disk);
+  grid_free_history(g);
+  grid_init_history(g, max_lines, max_bytes, max_disk);
+  if (!g->history)
+    return -1;
+  const char *rec = r.p;
+  size_t rec_left = hist_len;
+  for (unsigned int i = 0; i < stored && rec_left > 0; i++) {
+    long n = history_push_record(g->history, rec, rec_left);
+    if (n < 0)
+      return -1;
+    rec += n;
+    rec_left -= n;
+  }
+  g->scroll_offset = scroll_offset < history_lines(g->history)
+                         ? scroll_offset
+                         : history_lines(g->history);
+  r.p += hist_len;
+
+  // 字符簇表
+  grid_free_clusters(g);
+  uint32_t count = get_u32(&r);
+  for (uint32_t i = 0; r.p && i < count; i++) {
+    size_t n = strnlen(r.p, r.end - r.p);
+    if (n >= (size_t)(r.end - r.p) || n >= CELL_UTF8_MAX)
+      return -1;
+    // 按原顺序插入，下标与单元格中保存的一致；
+    // 超出上限的条目（上限更大的版本写的快照）丢弃，对应单元格显示为空
+    if (i < MUXKIT_CLUSTER_MAX && cluster_intern(&g->clusters, r.p) != (int)i)
+      return -1;
+    r.p += n + 1;
   }
 
-  unsigned int keep = (out_row < g->history_size) ? out_row : g->history_size;
-  unsigned int skip = out_row - keep;
-  memcpy(new_hist, &out_cells[skip * new_width],
-         keep * new_width * sizeof(struct cell));
-  memcpy(new_flg, &out_flags[skip], keep * sizeof(uint8_t));
-
-  // 清理
-  free(old_lines);
-  free(old_flags);
-  free(out_cells);
-  free(out_flags);
-  free(g->history_cells);
-  free(g->history_line_flags);
+  // 样式表
+  grid_free_styles(g);
+  count = get_u32(&r);
+  for (uint32_t i = 0; r.p && i < count; i++) {
+    uint32_t pen = get_u32(&r);
+    // 按原顺序插入，id 与单元格中保存的一致
+    if (r.p && style_insert(&g->styles, pen) != (int)i)
+      return -1;
+  }
+  return r.p ? 0 : -1;
+}
 
-  g->history_cells = new_hist;
-  g->history_line_flags = new_flg;
-  g->history_count = keep;
+/*
+  网格反序列化：校验快照头和 CRC，必要时解压后解析正文
+*/
+int grid_deserialize(struct grid *g, unsigned int *pane_id, unsigned int *cx,
+                     unsigned int *cy, const void *buf, size_t len) {
+  struct grid_snapshot_header hdr;
+  if (len < sizeof(hdr))
+    return -1;
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (hdr.magic != GRID_SNAPSHOT_MAGIC) {
+    log_warn("grid snapshot: bad magic %08x", hdr.magic);
+    return -1;
+  }
+  if (hdr.version != GRID_SNAPSHOT_VERSION) {
+    log_warn("grid snapshot: unsupported version %u", hdr.version);
+    return -1;
+  }
+  const char *body = (const char *)buf + sizeof(hdr);
+  if (hdr.body_len > len - sizeof(hdr)) {
+    log_warn("grid snapshot: truncated (%zu of %u bytes)", len - sizeof(hdr),
+             hdr.body_len);
+    return -1;
+  }
+  if (crc32(0, body, hdr.body_len) != hdr.crc) {
+    log_warn("grid snapshot: checksum mismatch");
+    return -1;
+  }
 
-  if (g->scroll_offset > keep)
-    g->scroll_offset = keep;
+  if (!(hdr.flags & GRID_SNAPSHOT_LZ)) {
+    if (hdr.raw_len != hdr.body_len)
+      return -1;
+    return grid_body_read(g, pane_id, cx, cy, body, hdr.body_len);
+  }
 
-  return 0;
+  char *raw = malloc(hdr.raw_len ? hdr.raw_len : 1);
+  if (!raw)
+    return -1;
+  int ret = -1;
+  if (lz_decompress(body, hdr.body_len, raw, hdr.raw_len) == (long)hdr.raw_len)
+    ret = grid_body_read(g, pane_id, cx, cy, raw, hdr.raw_len);
+  else
+    log_warn("grid snapshot: corrupt compressed body");
+  free(raw);
+  return ret;
 }
\ No newline at end of file
@@ -12,6 +12,8 @@
  * - vterm_new: 创建终端模拟器实例
  * - vterm_screen: 获取屏幕对象
  * - screen_sb_pushline: 滚动回调，保存历史行
+ * - screen_damage: 损坏回调，增量同步 grid 并记录脏行
+ * - screen_moverect: 移动回调，滚动时在 grid 上 memmove
  * - vterm_output_callback: 输出回调，发送到 PTY
  *
  * MIT License
@@ -37,55 +39,67 @@
  */
 
 #include "window.h"
+#include "input.h"
 #include "list.h"
+#include "log.h"
+#include "main.h"
 #include "render.h"
 #include "util.h"
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-// vterm 屏幕滚动回调
-static int screen_sb_pushline(int cols, const VTermScreenCell *cells,
-                              void *user) {
+// vterm 屏幕滚动回调，continuation 表示该行是上一行的自动换行延续
+static int screen_sb_pushline4(int cols, const VTermScreenCell *cells,
+                               bool continuation, void *user) {
   struct window_pane *p = user;
-  if (!p || !p->grid || !p->grid->history_cells)
+  if (!p || !p->grid || !p->grid->history)
     return 0;
 
   struct grid *g = p->grid;
-  unsigned int dst_line = g->history_count % g->history_size;
-  struct cell *dst = &g->history_cells[dst_line * g->width];
-
-  // libvterm 提供的 cells 复制
-  for (unsigned int x = 0; x < g->width && (int)x < cols; x++) {
-    const VTermScreenCell *vc = &cells[x];
-    struct cell *c = &dst[x];
-    if (vc->chars[0]) {
-      unicode_to_utf8(vc->chars[0], c->ch);
-    } else {
-      c->ch[0] = ' ';
-      c->ch[1] = 0;
-    }
-    c->width = vc->width ? vc->width : 1;
-    c->fg = VTERM_COLOR_IS_INDEXED(&vc->fg) ? vc->fg.indexed.idx : 0;
-    c->bg = VTERM_COLOR_IS_INDEXED(&vc->bg) ? vc->bg.indexed.idx : 0;
-    c->flags = (VTERM_COLOR_IS_DEFAULT_FG(&vc->fg) ? 0x01 : 0) |
-               (VTERM_COLOR_IS_DEFAULT_BG(&vc->bg) ? 0x02 : 0);
-    c->attr = (vc->attrs.bold ? 0x01 : 0) | (vc->attrs.underline ? 0x02 : 0) |
-              (vc->attrs.italic ? 0x04 : 0) | (vc->attrs.reverse ? 0x08 : 0);
-  }
-  g->history_count++;
+  struct cell row[cols > 0 ? cols : 1];
+
+  // libvterm 提供的 cells 转换后编码进历史
+  for (int x = 0; x < cols; x++)
+    cell_from_vterm(g, &row[x], &cells[x]);
+  history_push(g->history, row, cols > 0 ? cols : 0,
+               continuation ? HISTORY_LINE_WRAPPED : 0);
   return 0;
 }
 
+// vterm 屏幕损坏回调，同步损坏区域到 grid 并记录需要重绘的行
+static int screen_damage(VTermRect rect, void *user) {
+  struct window_pane *p = user;
+  if (!p || !p->grid || !p->grid->cells)
+    return 0;
+  sync_grid_rect(p, rect);
+  grid_mark_dirty(p->grid, rect.start_row, rect.end_row);
+  return 1;
+}
+
+// vterm 区域移动回调（滚动），直接在 grid 上移动单元格
+static int screen_moverect(VTermRect dest, VTermRect src, void *user) {
+  struct window_pane *p = user;
+  if (!p || !p->grid || !p->grid->cells)
+    return 0;
+  grid_move_rect(p->grid, dest, src);
+  grid_mark_dirty(p->grid, dest.start_row, dest.end_row);
+  return 1;
+}
+
 static VTermScreenCallbacks screen_callbacks = {
-    .sb_pushline = screen_sb_pushline,
+    .damage = screen_damage,
+    .moverect = screen_moverect,
+    .sb_pushline4 = screen_sb_pushline4,
 };
 
 // vterm 输出回调 - 将终端响应发送回 PTY
 static void vterm_output_callback(const char *s, size_t len, void *user) {
   struct window_pane *p = user;
-  if (p->master_fd >= 0) {
-    write(p->master_fd, s, len);
-  }
+  // 服务端和附加的客户端解析同一份输出，只能有一方应答
+  if (p->flags & PANE_NO_REPLY)
+    return;
+  pane_write(p, s, len);
 }
 
 /*
@@ -102,6 +116,93 @@ void pane_set_master_fd(struct window_pane *p, int fd) {
   }
 }
 
+/*
+  写到 EAGAIN 或写完为止，返回写入的字节数，出错返回 -1
+*/
+static ssize_t pane_write_some(struct window_pane *p, const char *data,
+                               size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t n = write(p->master_fd, data + sent, len - sent);
+    if (n >= 0) {
+      sent += n;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    log_error("pane %u: write to pty failed: %s", p->id, strerror(errno));
+    return -1;
+  }
+  return (ssize_t)sent;
+}
+
+/*
+  把积压的输入写进 PTY，返回剩余字节数
+*/
+ssize_t pane_flush_input(struct window_pane *p) {
+  if (!p || p->master_fd < 0) {
+    if (p)
+      p->in_len = 0;
+    return -1;
+  }
+  ssize_t n = pane_write_some(p, p->in_buf, p->in_len);
+  if (n < 0) {
+    p->in_len = 0;
+    return -1;
+  }
+  p->in_len -= n;
+  memmove(p->in_buf, p->in_buf + n, p->in_len);
+  return (ssize_t)p->in_len;
+}
+
+/*
+  向窗格 PTY 写入数据，写不下的部分排队
+*/
+int pane_write(struct window_pane *p, const char *data, size_t len) {
+  if (!p || p->master_fd < 0)
+    return -1;
+  // 先写积压的输入，仍有积压时新数据直接排在后面
+  if (p->in_len > 0 && pane_flush_input(p) < 0)
+    return -1;
+  size_t sent = 0;
+  if (p->in_len == 0) {
+    ssize_t n = pane_write_some(p, data, len);
+    if (n < 0)
+      return -1;
+    sent = n;
+  }
+  if (sent == len)
+    return 0;
+
+  // PTY 输入缓冲区满：余下的排队，等 master_fd 可写时写出
+  size_t rest = len - sent;
+  if (p->in_len + rest > MUXKIT_PANE_INPUT_MAX) {
+    log_warn("pane %u: %zu bytes of input backlog, dropping %zu bytes", p->id,
+             p->in_len, rest);
+    return -1;
+  }
+  if (p->in_len + rest > p->in_cap) {
+    size_t cap = p->in_cap ? p->in_cap : MUXKIT_BUF_XLARGE;
+    while (cap < p->in_len + rest)
+      cap *= 2;
+    char *buf = realloc(p->in_buf, cap);
+    if (!buf) {
+      log_error("pane %u: input backlog realloc %zu failed", p->id, cap);
+      return -1;
+    }
+    p->in_buf = buf;
+    p->in_cap = cap;
+  }
+  int was_empty = p->in_len == 0;
+  memcpy(p->in_buf + p->in_len, data + sent, rest);
+  p->in_len += rest;
+  if (was_empty && p->input_blocked)
+    p->input_blocked(p);
+  return 0;
+}
+
 /*
   窗格设置尺寸
 */
@@ -117,8 +218,17 @@ void pane_resize(struct window_pane *p, unsigned int sx, unsigned int sy) {
            copy_width * sizeof(struct cell));
   }
 
+  uint8_t *new_dirty = calloc(sy, sizeof(uint8_t));
+  if (!new_dirty) {
+    free(new_cells);
+    return;
+  }
+
   free(p->grid->cells);
   p->grid->cells = new_cells;
+  free(p->grid->dirty);
+  p->grid->dirty = new_dirty;
+  p->grid->dirty_count = 0;
   p->grid->width = sx;
   p->grid->height = sy;
   p->sx = sx;
@@ -127,6 +237,7 @@ void pane_resize(struct window_pane *p, unsigned int sx, unsigned int sy) {
   // 同步 libvterm 尺寸
   if (p->vt) {
     vterm_set_size(p->vt, sy, sx);
+    vterm_screen_flush_damage(p->vts);
   }
 
   if (p->cx >= sx)
@@ -184,7 +295,11 @@ struct window_pane *pane_create(struct window *w, unsigned int sx,
     p->grid->width = sx;
     p->grid->height = sy;
     p->grid->cells = calloc(sx * sy, sizeof(struct cell));
-    grid_init_history(p->grid, 1000); // 初始化历史缓冲区
+    p->grid->dirty = calloc(sy, sizeof(uint8_t));
+    unsigned int max_lines;
+    size_t max_bytes, max_disk;
+    grid_history_limits(&max_lines, &max_bytes, &max_disk);
+    grid_init_history(p->grid, max_lines, max_bytes, max_disk); // 初始化历史存储
   }
 
   // 初始化 libvterm
@@ -195,7 +310,11 @@ struct window_pane *pane_create(struct window *w, unsigned int sx,
         p->vt); // 初始化screen 屏幕单元格内容（字符+颜色+属性）
     vterm_screen_enable_altscreen(p->vts,
                                   1); // 启用备用屏幕（维护两个屏幕缓冲区）
-    vterm_screen_set_callbacks(p->vts, &screen_callbacks, p); // 设置滚动回调
+    vterm_screen_set_callbacks(p->vts, &screen_callbacks,
+                               p); // 设置滚动和损坏回调
+    vterm_screen_callbacks_has_pushline4(p->vts); // 滚动回调带换行标志
+    // 合并损坏区域和滚动，pane_input 结束时统一 flush
+    vterm_screen_set_damage_merge(p->vts, VTERM_DAMAGE_SCROLL);
     vterm_screen_reset(p->vts, 1);                            // 初始化内存
   }
 
@@ -213,8 +332,12 @@ void pane_destroy(struct window_pane *p) {
     vterm_free(p->vt);
   if (p->grid) {
     grid_free_history(p->grid);
+    grid_free_clusters(p->grid);
+    grid_free_styles(p->grid);
     free(p->grid->cells);
+    free(p->grid->dirty);
     free(p->grid);
   }
+  free(p->in_buf);
   free(p);
 }
\ No newline at end of file